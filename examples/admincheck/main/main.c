@@ -85,62 +85,6 @@ static void event_handler(void* arg, esp_event_base_t event_base,
             case IRC_EVENT_CONNECTED:
                 ESP_LOGI(TAG, "Connected to IRC");
                 break;
-            case IRC_EVENT_NEW_MESSAGE:
-                {
-                    irc_message_t* message = (irc_message_t*) event_data;
-                    char *nick, *user, *hostname, *source, *target, *pch;
-                    int admincheck;
-
-                    if (strncmp(message->verb, "PRIVMSG", 7) == 0 && message->source) {
-
-                        /* Check if the command is "!admin" */
-                        if (strncmp(message->params[1], "!admin", 6) != 0) break;
-
-                        pch = (char*) memchr(message->source, '!', strlen(message->source));
-                        if (!pch) break;
-
-                        /* Split nick, user and hostname */
-                        source = message->source;
-                        source[pch-source] = '\0';
-                        nick = source;
-                        user = source+(pch-source+1);
-
-                        pch = (char*) memchr(user, '@', strlen(user));
-                        if (!pch) break;
-
-                        user[pch-user] = '\0';
-                        hostname = user+(pch-user+1);
-
-                        target = message->params[0];
-
-                        if (strcmp(nick, target) == 0) break;
-
-                        /*
-                         * Check if the target starts with '#' (0x23), '&' (0x26).
-                         *
-                         * If target doesn't start with these characters, it's
-                         * assumed to be a private message and relay them to sender.
-                         */
-                        switch (target[0]) {
-                            case '#':
-                            case '&':
-                                break;
-                            default:
-                                target = nick;
-                                break;
-                        }
-
-                        /* Check user's hostname */
-                        admincheck = strcmp(hostname, ADMIN_IDENT);
-                        irc_sendraw(network, "PRIVMSG %s :%s: Access %s.",
-                                target, nick, (admincheck == 0 ? "Granted" : "Denied"));
-
-                        ESP_LOGI(TAG, "%s - %s (%s)",
-                                (admincheck == 0 ? "GRANTED" : "DENIED"),
-                                nick, hostname);
-                    }
-                }
-                break;
             default:
                 ESP_LOGD(TAG, "Unknown IRC Event");
                 break;
@@ -148,6 +92,53 @@ static void event_handler(void* arg, esp_event_base_t event_base,
     }
 }
 
+static void privmsg_handler(void* arg, esp_event_base_t event_base,
+                                int32_t event_id, void* event_data)
+{
+    irc_message_t* message = (irc_message_t*) event_data;
+    irc_view_t nick, hostname, reply;
+    char *target;
+    bool admincheck;
+
+    if (!message->source || message->params_count < 2) return;
+
+    /* Check if the command is "!admin" */
+    if (strncmp(message->params[1], "!admin", 6) != 0) return;
+
+    /* The source is left as is for other handlers */
+    nick = irc_source_nick(message);
+    hostname = irc_source_host(message);
+    if (!hostname.ptr) return;
+
+    target = message->params[0];
+
+    if (irc_view_equal(nick, target)) return;
+
+    /*
+     * Check if the target is a channel (it starts with one of the
+     * server's CHANTYPES, '#' or '&' on most networks).
+     *
+     * If it isn't, it's assumed to be a private message and relay
+     * them to sender.
+     */
+    if (irc_is_channel(network, target)) {
+        reply.ptr = target;
+        reply.len = strlen(target);
+    } else {
+        reply = nick;
+    }
+
+    /* Check user's hostname */
+    admincheck = irc_view_equal(hostname, ADMIN_IDENT);
+    irc_sendraw(network, "PRIVMSG %.*s :%.*s: Access %s.",
+            (int) reply.len, reply.ptr, (int) nick.len, nick.ptr,
+            (admincheck ? "Granted" : "Denied"));
+
+    ESP_LOGI(TAG, "%s - %.*s (%.*s)",
+            (admincheck ? "GRANTED" : "DENIED"),
+            (int) nick.len, nick.ptr, (int) hostname.len, hostname.ptr);
+}
+
 void app_main(void)
 {
     esp_err_t ret;
@@ -214,7 +205,14 @@ void app_main(void)
         return;
     }
 
-    ESP_ERROR_CHECK(irc_event_handler_register(network, &event_handler, NULL));
+    ESP_ERROR_CHECK(irc_event_handler_register_id(network, IRC_EVENT_DISCONNECTED,
+                                                  &event_handler, NULL));
+    ESP_ERROR_CHECK(irc_event_handler_register_id(network, IRC_EVENT_CONNECTING,
+                                                  &event_handler, NULL));
+    ESP_ERROR_CHECK(irc_event_handler_register_id(network, IRC_EVENT_CONNECTED,
+                                                  &event_handler, NULL));
+    ESP_ERROR_CHECK(irc_message_handler_register(network, IRC_VERB_PRIVMSG,
+                                                 &privmsg_handler, NULL));
 
     while (!connected) {
         ESP_LOGI(TAG, "Waiting for internet connection");
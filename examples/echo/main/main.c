@@ -81,47 +81,6 @@ static void event_handler(void* arg, esp_event_base_t event_base,
             case IRC_EVENT_CONNECTED:
                 ESP_LOGI(TAG, "Connected to IRC");
                 break;
-            case IRC_EVENT_NEW_MESSAGE:
-                {
-                    irc_message_t* message = (irc_message_t*) event_data;
-                    char *nick, *host, *source, *target, *pch;
-
-                    if (strncmp(message->verb, "PRIVMSG", 7) == 0 && message->source) {
-                        pch = (char*) memchr(message->source, '!', strlen(message->source));
-                        if (!pch) break;
-
-                        /* Split nick and host */
-                        source = message->source;
-                        source[pch-source] = '\0';
-                        nick = source;
-                        host = source+(pch-source+1);
-
-                        target = message->params[0];
-
-                        if (strcmp(nick, target) == 0) break;
-
-                        /*
-                         * Check if the target starts with '#' (0x23), '&' (0x26).
-                         *
-                         * If target doesn't start with these characters, it's
-                         * assumed to be a private message and relay them to sender.
-                         */
-                        switch (target[0]) {
-                            case '#':
-                            case '&':
-                                break;
-                            default:
-                                target = nick;
-                                break;
-                        }
-
-                        ESP_LOGI(TAG, "%s (%s) in %s sent: \"%s\"",
-                                nick, host, message->params[0], message->params[1]);
-                        irc_sendraw(network, "PRIVMSG %s :%s (%s) sent: %s",
-                                target, nick, host, message->params[1]);
-                    }
-                }
-                break;
             default:
                 ESP_LOGD(TAG, "Unknown IRC Event");
                 break;
@@ -129,6 +88,46 @@ static void event_handler(void* arg, esp_event_base_t event_base,
     }
 }
 
+static void privmsg_handler(void* arg, esp_event_base_t event_base,
+                                int32_t event_id, void* event_data)
+{
+    irc_message_t* message = (irc_message_t*) event_data;
+    irc_view_t nick, host, reply;
+    char *target;
+
+    if (!message->source || message->params_count < 2) return;
+
+    /* Split nick and host, the source is left as is for other handlers */
+    nick = irc_source_nick(message);
+    host = irc_source_host(message);
+    if (!host.ptr) return;
+
+    target = message->params[0];
+
+    if (irc_view_equal(nick, target)) return;
+
+    /*
+     * Check if the target is a channel (it starts with one of the
+     * server's CHANTYPES, '#' or '&' on most networks).
+     *
+     * If it isn't, it's assumed to be a private message and relay
+     * them to sender.
+     */
+    if (irc_is_channel(network, target)) {
+        reply.ptr = target;
+        reply.len = strlen(target);
+    } else {
+        reply = nick;
+    }
+
+    ESP_LOGI(TAG, "%.*s (%.*s) in %s sent: \"%s\"",
+            (int) nick.len, nick.ptr, (int) host.len, host.ptr,
+            message->params[0], message->params[1]);
+    irc_sendraw(network, "PRIVMSG %.*s :%.*s (%.*s) sent: %s",
+            (int) reply.len, reply.ptr, (int) nick.len, nick.ptr,
+            (int) host.len, host.ptr, message->params[1]);
+}
+
 void app_main(void)
 {
     esp_err_t ret;
@@ -195,7 +194,14 @@ void app_main(void)
         return;
     }
 
-    ESP_ERROR_CHECK(irc_event_handler_register(network, &event_handler, NULL));
+    ESP_ERROR_CHECK(irc_event_handler_register_id(network, IRC_EVENT_DISCONNECTED,
+                                                  &event_handler, NULL));
+    ESP_ERROR_CHECK(irc_event_handler_register_id(network, IRC_EVENT_CONNECTING,
+                                                  &event_handler, NULL));
+    ESP_ERROR_CHECK(irc_event_handler_register_id(network, IRC_EVENT_CONNECTED,
+                                                  &event_handler, NULL));
+    ESP_ERROR_CHECK(irc_message_handler_register(network, IRC_VERB_PRIVMSG,
+                                                 &privmsg_handler, NULL));
 
     while (!connected) {
         ESP_LOGI(TAG, "Waiting for internet connection");
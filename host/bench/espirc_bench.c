@@ -0,0 +1,203 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * Copyright (c) 2024 Danct12
+ */
+
+/*
+ * Host benchmark of the receive path: corpora of server traffic are fed
+ * through the framer the way irc_receive() does, one TCP segment at a time,
+ * and every line is tokenized with irc_parse_message().
+ *
+ * Build and run from the repository root:
+ *   cmake -S . -B build && cmake --build build && ./build/host/espirc_bench
+ *
+ * Options:
+ *   -r rounds    times each corpus is replayed (default 200)
+ *   -s bytes     segment size handed to the framer (default 1460)
+ *   -b bytes     receive buffer size (default IRC_LINE_TAGGED_MAX)
+ *   files...     corpora to use instead of the ones in host/corpus
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "espirc.h"
+#include "espirc_framer.h"
+#include "espirc_mem.h"
+#include "espirc_parser.h"
+
+#include "esp_log.h"
+
+static const char *default_corpora[] = {
+    ESPIRC_CORPUS_DIR "/names.txt",
+    ESPIRC_CORPUS_DIR "/tags.txt",
+    ESPIRC_CORPUS_DIR "/privmsg.txt",
+};
+
+/*
+ * Every heap allocation made by the library (and the shim) goes through
+ * these, the executable is linked with --wrap for malloc and friends.
+ */
+static uint64_t allocs;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+    __atomic_fetch_add(&allocs, 1, __ATOMIC_RELAXED);
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size)
+{
+    __atomic_fetch_add(&allocs, 1, __ATOMIC_RELAXED);
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    __atomic_fetch_add(&allocs, 1, __ATOMIC_RELAXED);
+    return __real_realloc(ptr, size);
+}
+
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char *load(const char *path, size_t *size)
+{
+    FILE *f = fopen(path, "rb");
+    char *data;
+    long len;
+
+    if (!f)
+        return NULL;
+
+    fseek(f, 0, SEEK_END);
+    len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    data = malloc(len);
+    if (data && fread(data, 1, len, f) != (size_t) len) {
+        free(data);
+        data = NULL;
+    }
+
+    fclose(f);
+    *size = len;
+
+    return data;
+}
+
+static int bench(const char *path, int rounds, size_t segment, size_t rbuf)
+{
+    espirc_framer_t framer;
+    irc_message_t message;
+    uint64_t lines = 0, errors = 0, allocs_start;
+    uint32_t used, peak;
+    size_t size, off, len, space_len;
+    double start, elapsed;
+    char *data, *space, *line;
+    const char *name;
+
+    data = load(path, &size);
+    if (!data) {
+        fprintf(stderr, "Can't read %s\n", path);
+        return -1;
+    }
+
+    if (espirc_framer_init(&framer, rbuf) != ESP_OK) {
+        free(data);
+        return -1;
+    }
+
+    allocs_start = __atomic_load_n(&allocs, __ATOMIC_RELAXED);
+    start = now_sec();
+
+    for (int i = 0; i < rounds; i++) {
+        for (off = 0; off < size; off += len) {
+            space = espirc_framer_space(&framer, &space_len);
+            len = size - off;
+            if (len > segment) len = segment;
+            if (len > space_len) len = space_len;
+
+            memcpy(space, data + off, len);
+            espirc_framer_commit(&framer, len);
+
+            while ((line = espirc_framer_next(&framer, &space_len))) {
+                if (irc_parse_message(line, space_len, &message) != ESP_OK)
+                    errors++;
+                lines++;
+            }
+        }
+    }
+
+    elapsed = now_sec() - start;
+    allocs_start = __atomic_load_n(&allocs, __ATOMIC_RELAXED) - allocs_start;
+    espirc_mem_stats(&used, &peak);
+
+    name = strrchr(path, '/');
+    name = name ? name + 1 : path;
+
+    printf("%-14s %10.0f %8.1f %8.1f %10.4f %10" PRIu32 " %7" PRIu64 "\n", name,
+        lines / elapsed, (double) size * rounds / elapsed / 1e6, elapsed * 1e9 / lines,
+        (double) allocs_start / lines, peak, errors);
+
+    espirc_framer_deinit(&framer);
+    free(data);
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    size_t segment = 1460, rbuf = IRC_LINE_TAGGED_MAX;
+    int rounds = 200, opt, ret = 0;
+    struct rusage usage;
+
+    while ((opt = getopt(argc, argv, "r:s:b:")) != -1) {
+        switch (opt) {
+            case 'r': rounds = atoi(optarg); break;
+            case 's': segment = strtoul(optarg, NULL, 0); break;
+            case 'b': rbuf = strtoul(optarg, NULL, 0); break;
+            default:
+                fprintf(stderr, "Usage: %s [-r rounds] [-s segment] [-b rbuf] [corpus...]\n",
+                    argv[0]);
+                return 1;
+        }
+    }
+
+    if (rounds <= 0 || !segment || !rbuf)
+        return 1;
+
+    /* The framer warns about overlong lines, which isn't news here */
+    esp_log_level_set("*", ESP_LOG_ERROR);
+
+    printf("%d rounds, %zu byte segments, %zu byte receive buffer\n\n", rounds, segment, rbuf);
+    printf("%-14s %10s %8s %8s %10s %10s %7s\n", "corpus", "lines/s", "MB/s", "ns/line",
+        "allocs/ln", "heap peak", "errors");
+
+    if (optind < argc) {
+        for (int i = optind; i < argc; i++)
+            ret |= bench(argv[i], rounds, segment, rbuf);
+    } else {
+        for (size_t i = 0; i < sizeof(default_corpora) / sizeof(default_corpora[0]); i++)
+            ret |= bench(default_corpora[i], rounds, segment, rbuf);
+    }
+
+    getrusage(RUSAGE_SELF, &usage);
+    printf("\nmax RSS: %ld KiB\n", usage.ru_maxrss);
+
+    return ret ? 1 : 0;
+}
@@ -0,0 +1,511 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * Copyright (c) 2024 Danct12
+ */
+
+/*
+ * End-to-end load test: runs an espirc client against the mock server on
+ * localhost and checks that every line of the burst arrives exactly once
+ * and intact, however the server splits its writes.
+ *
+ * Reports PING -> PONG round trip percentiles (the PONGs go out on the
+ * urgent lane while the client is busy receiving), the sustained receive
+ * throughput and the number of lost and merged/mangled lines. Exits with 1
+ * if anything went missing, so it can double as a regression check:
+ *
+ *   espirc_loadtest -f 7             fragment writes at random boundaries
+ *   espirc_loadtest -e 5000          ERROR mid-burst, the client reconnects
+ *   espirc_loadtest -k               433 on registration, the client gives up
+ *   espirc_loadtest -d 5000          the link goes dead mid-burst, the client
+ *                                    notices from the silence and reconnects
+ *
+ * Options:
+ *   -n messages   messages in the burst (default 100000)
+ *   -r rate       messages per second, 0 for unlimited (default 0)
+ *   -p payload    longest payload in bytes (default 200)
+ *   -f bytes      split server writes into random chunks of up to this size
+ *   -i ms         PING interval (default 20)
+ *   -e count      send ERROR after this many messages on the first connection
+ *   -d count      go silent after this many messages on the first connection
+ *   -k            answer the first registration with 433
+ *   -u users      other members in the channel, tracked by the client
+ *   -j channels   join this many more channels, packed into as few JOINs as fit
+ *   -l bytes      send a text this long to the channel at the end, split by the client
+ *   -a            dispatch asynchronously
+ *   -g            run the client on an engine, with a non-blocking socket
+ *   -t seconds    give up after this long (default 60)
+ *   -w file       record the traffic to file, for espirc_replay
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "espirc.h"
+#include "mock_ircd.h"
+
+static const char* TAG = "loadtest";
+
+typedef struct {
+    mock_ircd_config_t config;
+    SemaphoreHandle_t done;
+
+    uint32_t connects;
+    uint32_t disconnects;
+
+    /* The connection being received, reset on every IRC_EVENT_CONNECTED */
+    uint32_t next_seq;
+    uint64_t received;
+    uint64_t bytes;
+    int64_t first_at;
+    int64_t last_at;
+
+    /* Totals over every connection */
+    uint64_t lost;
+    uint64_t mangled;
+    uint64_t reordered;
+    bool finished;
+} loadtest_t;
+
+static int cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+static uint32_t percentile(const uint32_t *samples, size_t count, int pct)
+{
+    if (!count)
+        return 0;
+
+    return samples[(count - 1) * pct / 100];
+}
+
+static void event_handler(void *arg, esp_event_base_t event_base, int32_t event_id,
+                            void *event_data)
+{
+    loadtest_t *test = arg;
+
+    switch (event_id) {
+        case IRC_EVENT_CONNECTED:
+            test->connects++;
+            test->next_seq = 0;
+            test->received = 0;
+            test->bytes = 0;
+            test->first_at = 0;
+            break;
+        case IRC_EVENT_DISCONNECTED:
+            test->disconnects++;
+
+            /* A 433 ends the run, the client doesn't retry */
+            if (test->config.nick_in_use)
+                xSemaphoreGive(test->done);
+            break;
+        default:
+            break;
+    }
+}
+
+static void privmsg_handler(void *arg, esp_event_base_t event_base, int32_t event_id,
+                            void *event_data)
+{
+    loadtest_t *test = arg;
+    irc_message_t *msg = event_data;
+    char expected[1024], *payload;
+    unsigned long seq;
+    size_t len;
+
+    if (msg->params_count != 2)
+        return;
+
+    seq = strtoul(msg->params[1], &payload, 10);
+    if (payload == msg->params[1] || *payload != ' ') {
+        test->mangled++;
+        return;
+    }
+
+    len = mock_ircd_payload(&test->config, seq, expected);
+    if (strlen(payload + 1) != len || memcmp(payload + 1, expected, len)) {
+        test->mangled++;
+        return;
+    }
+
+    if (!test->first_at)
+        test->first_at = esp_timer_get_time();
+
+    if (seq > test->next_seq)
+        test->lost += seq - test->next_seq;
+    else if (seq < test->next_seq)
+        test->reordered++;
+
+    test->next_seq = seq + 1;
+    test->received++;
+    test->bytes += strlen(msg->params[1]);
+}
+
+static void notice_handler(void *arg, esp_event_base_t event_base, int32_t event_id,
+                            void *event_data)
+{
+    loadtest_t *test = arg;
+    irc_message_t *msg = event_data;
+
+    if (msg->params_count != 2 || strcmp(msg->params[1], "END"))
+        return;
+
+    test->last_at = esp_timer_get_time();
+
+    /* Whatever didn't arrive by the end of the burst is lost */
+    if (test->next_seq < test->config.messages)
+        test->lost += test->config.messages - test->next_seq;
+
+    test->finished = true;
+    xSemaphoreGive(test->done);
+}
+
+/*
+ * Check the tracked channel against what the server sent: us, @bench and the
+ * users that are left after the churn before the END notice. The 005 of the
+ * mock server only allows '#' channels.
+ */
+static bool check_state(irc_handle_t client, const mock_ircd_config_t *config)
+{
+    irc_channel_info_t info;
+    irc_isupport_t isupport;
+    char modes[8];
+    esp_err_t err;
+
+    if (irc_get_isupport(client, &isupport) != ESP_OK || isupport.nicklen != 30 ||
+            isupport.targmax[IRC_TARGMAX_PRIVMSG] != 4 || isupport.targmax[IRC_TARGMAX_JOIN] ||
+            !irc_is_channel(client, "#load") || irc_is_channel(client, "&load") ||
+            !irc_name_equal(client, "Load[Test]", "load{test}"))
+        return false;
+
+    /* Built without ESPIRC_STATE, there's nothing more to check */
+    err = irc_state_channel(client, "#LOAD", &info);
+    if (err == ESP_ERR_NOT_SUPPORTED)
+        return true;
+
+    if (err != ESP_OK || !info.synced)
+        return false;
+
+    if (!config->users)
+        return info.members == 2;
+
+    return info.members == config->users - 3 + 2 &&
+        irc_state_member(client, "#load", "u0", NULL, 0) == ESP_ERR_NOT_FOUND &&
+        irc_state_member(client, "#load", "u1", NULL, 0) == ESP_ERR_NOT_FOUND &&
+        irc_state_member(client, "#load", "RENAMED", modes, sizeof(modes)) == ESP_OK &&
+        !strcmp(modes, "v") &&
+        irc_state_member(client, "#load", "u2", NULL, 0) == ESP_ERR_NOT_FOUND &&
+        irc_state_member(client, "#load", "u3", NULL, 0) == ESP_ERR_NOT_FOUND &&
+        irc_state_member(client, "#load", "u4", modes, sizeof(modes)) == ESP_OK &&
+        !strcmp(modes, "o") &&
+        (config->users <= 10 ||
+            (irc_state_member(client, "#load", "U10", modes, sizeof(modes)) == ESP_OK &&
+            !strcmp(modes, "o")));
+}
+
+/*
+ * Words of mixed length and script, with line breaks now and then and a
+ * word longer than a line, which has to be cut between characters
+ */
+static char *make_text(size_t len)
+{
+    static const char *const words[] = {
+        "sensor", "23.5", "naïve", "日本語のテキスト", "ok", "😀", "température", "x",
+        "relay", "Ωmega", "log:", "—",
+    };
+    char *text = malloc(len + 1);
+    size_t n = 0, w = 0, word;
+
+    if (!text)
+        return NULL;
+
+    while (n < len) {
+        if (w % 97 == 96) {
+            /* "é" over and over, 700 bytes without a space */
+            for (int i = 0; i < 350 && n + 2 <= len; i++, n += 2)
+                memcpy(text + n, "é", 2);
+        } else {
+            word = strlen(words[w % 12]);
+            if (n + word > len)
+                break;
+
+            memcpy(text + n, words[w % 12], word);
+            n += word;
+        }
+
+        if (n < len)
+            text[n++] = w % 31 == 30 ? '\n' : ' ';
+        w++;
+    }
+
+    /* Pad with spaces rather than a partial character */
+    memset(text + n, ' ', len - n);
+    text[len] = '\0';
+
+    return text;
+}
+
+/* Everything but the whitespace must have arrived, in one piece and in order */
+static bool check_text(const char *text, size_t len, const mock_ircd_stats_t *stats)
+{
+    size_t n = 0;
+
+    if (stats->relay_max > 512 || stats->utf8_broken)
+        return false;
+
+    for (size_t i = 0; i < len; i++) {
+        if (text[i] == ' ' || text[i] == '\n')
+            continue;
+
+        if (n >= stats->text_len || stats->text[n++] != text[i])
+            return false;
+    }
+
+    return n == stats->text_len;
+}
+
+int main(int argc, char **argv)
+{
+    loadtest_t test = {
+        .config = {
+            .messages = 100000,
+            .payload = 200,
+            .ping_interval_ms = 20,
+            .seed = 1,
+        },
+    };
+    irc_config_t config = {
+        .host = "127.0.0.1",
+        .nick = "loadtest",
+        .user = "loadtest",
+        .realname = "espirc load test",
+        .channel = "#load",
+    };
+    mock_ircd_stats_t server_stats;
+    bool tracked;
+    irc_stats_t stats;
+    mock_ircd_t *server;
+    irc_engine_handle_t engine = NULL;
+    irc_handle_t client;
+    double elapsed;
+    const char *capture = NULL;
+    int opt, timeout = 60;
+    uint32_t channels = 0;
+    char **names = NULL;
+    size_t text_len = 0;
+    char *text = NULL;
+    bool text_ok = true;
+    bool ok;
+
+    while ((opt = getopt(argc, argv, "n:r:p:f:i:e:d:ku:j:l:agt:w:")) != -1) {
+        switch (opt) {
+            case 'n': test.config.messages = strtoul(optarg, NULL, 0); break;
+            case 'r': test.config.rate = strtoul(optarg, NULL, 0); break;
+            case 'p': test.config.payload = strtoul(optarg, NULL, 0); break;
+            case 'f': test.config.fragment_max = strtoul(optarg, NULL, 0); break;
+            case 'i': test.config.ping_interval_ms = strtoul(optarg, NULL, 0); break;
+            case 'e': test.config.error_after = strtoul(optarg, NULL, 0); break;
+            case 'd': test.config.stall_after = strtoul(optarg, NULL, 0); break;
+            case 'k': test.config.nick_in_use = true; break;
+            case 'u': test.config.users = strtoul(optarg, NULL, 0); break;
+            case 'j': channels = strtoul(optarg, NULL, 0); break;
+            case 'l': text_len = strtoul(optarg, NULL, 0); break;
+            case 'a': config.dispatch_async = true; break;
+            case 'g':
+                engine = irc_engine_create((irc_engine_config_t) { 0 });
+                if (!engine)
+                    return 1;
+
+                config.engine = engine;
+                break;
+            case 't': timeout = atoi(optarg); break;
+            case 'w': capture = optarg; break;
+            default:
+                fprintf(stderr, "See the top of espirc_loadtest.c for the options\n");
+                return 1;
+        }
+    }
+
+    /* Lines are at most 510 bytes, with room for the prefix and sequence number */
+    if (!test.config.messages || test.config.payload > 420) {
+        fprintf(stderr, "Need at least one message and a payload of at most 420 bytes\n");
+        return 1;
+    }
+
+    if (test.config.users && test.config.users < 5) {
+        fprintf(stderr, "Need at least 5 users\n");
+        return 1;
+    }
+
+    esp_log_level_set("*", ESP_LOG_WARN);
+
+    test.done = xSemaphoreCreateBinary();
+
+    server = mock_ircd_start(&test.config);
+    if (!server) {
+        fprintf(stderr, "Failed to start the mock server\n");
+        return 1;
+    }
+
+    config.port = mock_ircd_port(server);
+    config.reconnect = test.config.error_after || test.config.stall_after;
+    config.reconnect_min_ms = 100;
+
+    /* Measure the lag a few times a second, and don't wait long on a dead link */
+    config.ping_interval_ms = 100;
+    config.ping_timeout_ms = 1000;
+
+    config.state_track = true;
+    config.state_mem_max = 1024 * 1024;
+
+    if (channels) {
+        names = calloc(channels, sizeof(*names) + 16);
+        for (uint32_t i = 0; names && i < channels; i++) {
+            names[i] = (char *) (names + channels) + i * 16;
+            snprintf(names[i], 16, "#c%" PRIu32, i);
+        }
+
+        config.channels = (const char* const*) names;
+        config.channels_count = names ? channels : 0;
+
+        /* Or the JOINs past the flood burst would go out after a short test ends */
+        config.flood_disable = true;
+    }
+
+    if (text_len) {
+        text = make_text(text_len);
+        config.flood_disable = true;
+
+        /* All of it is queued at once, with a command and target per line */
+        config.sbuf_size = 2048 + text_len * 2;
+    }
+
+    client = irc_create(config);
+    if (!client) {
+        irc_engine_destroy(engine);
+        mock_ircd_free(server);
+        return 1;
+    }
+
+    irc_event_handler_register(client, event_handler, &test);
+    irc_message_handler_register(client, IRC_VERB_PRIVMSG, privmsg_handler, &test);
+    irc_message_handler_register(client, IRC_VERB_NOTICE, notice_handler, &test);
+
+    if (capture)
+        ESP_ERROR_CHECK(irc_capture_start(client, &(irc_capture_config_t) { .path = capture }));
+
+    ESP_ERROR_CHECK(irc_connect(client));
+
+    if (xSemaphoreTake(test.done, pdMS_TO_TICKS(timeout * 1000)) != pdTRUE)
+        ESP_LOGE(TAG, "Timed out after %d s", timeout);
+
+    if (text) {
+        if (irc_send_long(client, IRC_TARGMAX_PRIVMSG, "#load", text, text_len) != ESP_OK)
+            text_ok = false;
+
+        /* Let it reach the server before the QUIT, which jumps the queue */
+        vTaskDelay(pdMS_TO_TICKS(300));
+    }
+
+    irc_get_stats(client, &stats);
+    tracked = check_state(client, &test.config);
+
+    if (irc_disconnect(client) == ESP_OK) {
+        /* Give the IRC task time to close the connection and exit */
+        vTaskDelay(pdMS_TO_TICKS(200));
+    }
+
+    irc_capture_stop(client);
+    mock_ircd_stop(server);
+    mock_ircd_stats(server, &server_stats);
+    qsort(server_stats.rtt, server_stats.rtt_count, sizeof(uint32_t), cmp_u32);
+
+    elapsed = (test.last_at - test.first_at) / 1e6;
+
+    printf("connections     %" PRIu32 " (%" PRIu32 " reconnects)\n", server_stats.connections,
+        stats.reconnects);
+    printf("server writes   %" PRIu64 " (%" PRIu64 " bytes)\n", server_stats.writes,
+        server_stats.bytes_sent);
+
+    if (test.finished && elapsed > 0) {
+        printf("received        %" PRIu64 " lines in %.3f s\n", test.received, elapsed);
+        printf("throughput      %.0f lines/s, %.1f MB/s of payload\n", test.received / elapsed,
+            test.bytes / elapsed / 1e6);
+    }
+
+    printf("lost            %" PRIu64 "\n", test.lost);
+    printf("merged/mangled  %" PRIu64 "\n", test.mangled);
+    printf("reordered       %" PRIu64 "\n", test.reordered);
+    printf("parse errors    %" PRIu32 "\n", stats.parse_errors);
+    printf("events dropped  %" PRIu32 "\n", stats.events_dropped);
+    printf("rbuf peak       %" PRIu32 " bytes\n", stats.rbuf_peak);
+    printf("PING -> PONG    %zu samples, p50 %" PRIu32 " us, p90 %" PRIu32 " us, p99 %" PRIu32
+        " us, max %" PRIu32 " us\n", server_stats.rtt_count,
+        percentile(server_stats.rtt, server_stats.rtt_count, 50),
+        percentile(server_stats.rtt, server_stats.rtt_count, 90),
+        percentile(server_stats.rtt, server_stats.rtt_count, 99),
+        percentile(server_stats.rtt, server_stats.rtt_count, 100));
+    printf("client lag      last %" PRIu32 " us, smoothed %" PRIu32 " us, jitter %" PRIu32
+        " us\n", stats.lag_us, stats.lag_srtt_us, stats.lag_jitter_us);
+    printf("dead links      %" PRIu32 "\n", stats.links_dead);
+    printf("joins           %" PRIu32 " channels in %" PRIu32 " lines\n",
+        server_stats.channels_joined, server_stats.join_lines);
+    if (text) {
+        text_ok = text_ok && check_text(text, text_len, &server_stats);
+        printf("long text       %zu bytes in %" PRIu32 " lines, longest relayed %" PRIu32
+            " bytes, %" PRIu32 " cut in a character%s\n", text_len, server_stats.text_lines,
+            server_stats.relay_max, server_stats.utf8_broken, text_ok ? "" : ", MISMATCH");
+    }
+
+    printf("state           %" PRIu32 " bytes, %" PRIu32 " members dropped%s\n",
+        stats.state_used, stats.state_dropped,
+        test.config.nick_in_use ? "" : tracked ? ", consistent" : ", INCONSISTENT");
+
+    if (test.config.nick_in_use) {
+        ok = test.disconnects && !test.connects;
+    } else {
+        ok = test.finished && !test.lost && !test.mangled && !test.reordered &&
+            !stats.parse_errors && !stats.events_dropped && tracked && text_ok;
+
+        /* The burst is cut short on the first connection, then sent again in full */
+        if (test.config.error_after)
+            ok = ok && test.connects == 2 && stats.reconnects >= 1;
+
+        /* Likewise, once the client gave up on the silent connection */
+        if (test.config.stall_after)
+            ok = ok && test.connects == 2 && stats.links_dead == 1;
+
+        /*
+         * Every connection joins #load and the extra channels, but a connection
+         * that's cut short may be gone before the server reads all the JOINs
+         */
+        if (test.config.error_after || test.config.stall_after)
+            ok = ok && server_stats.channels_joined >= 1 + channels;
+        else
+            ok = ok && server_stats.channels_joined == (1 + channels) * server_stats.connections;
+    }
+
+    printf("%s\n", ok ? "PASS" : "FAIL");
+
+    irc_destroy(client);
+    irc_engine_destroy(engine);
+    mock_ircd_free(server);
+    vSemaphoreDelete(test.done);
+    free(names);
+    free(text);
+
+    return ok ? 0 : 1;
+}
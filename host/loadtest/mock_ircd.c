@@ -0,0 +1,638 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * Copyright (c) 2024 Danct12
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mock_ircd.h"
+
+#define MOCK_SERVER_NAME "mock.server"
+
+/* Generation stops while this much output is pending */
+#define MOCK_OUT_HIGH (16 * 1024)
+#define MOCK_OUT_SIZE (MOCK_OUT_HIGH + 2048)
+#define MOCK_IN_SIZE 4096
+
+struct mock_ircd {
+    mock_ircd_config_t config;
+    int listen_fd;
+    int stop_fd[2];
+    uint16_t port;
+    pthread_t thread;
+    unsigned int seed;
+
+    pthread_mutex_t lock;
+    mock_ircd_stats_t stats;
+    size_t rtt_size;
+    size_t text_size;
+};
+
+typedef struct {
+    int fd;
+    char in[MOCK_IN_SIZE];
+    size_t in_len;
+    char out[MOCK_OUT_SIZE];
+    size_t out_len;
+    uint64_t written;
+
+    bool got_nick;
+    bool got_user;
+    bool registered;
+    bool joined;
+    bool named;
+    uint32_t names_next;
+    bool done;
+    bool closing;
+    bool stalled;
+    char nick[64];
+    char channel[64];
+
+    uint32_t seq;
+    int64_t start;
+
+    /* The PING in flight, timed from when its last byte was written */
+    uint32_t ping_token;
+    uint64_t ping_end;
+    int64_t ping_sent_at;
+    bool ping_outstanding;
+    int64_t next_ping;
+} mock_conn_t;
+
+static int64_t mock_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+size_t mock_ircd_payload(const mock_ircd_config_t *config, uint32_t seq, char *buf)
+{
+    size_t len = config->payload;
+
+    /* Vary the length a little so that merged lines can't line up */
+    if (len > 16)
+        len -= seq % 17;
+
+    for (size_t i = 0; i < len; i++)
+        buf[i] = 'a' + (seq + i) % 26;
+
+    buf[len] = '\0';
+    return len;
+}
+
+static void mock_append(mock_conn_t *conn, const char *fmt, ...)
+{
+    va_list ap;
+    int len;
+
+    va_start(ap, fmt);
+    len = vsnprintf(conn->out + conn->out_len, MOCK_OUT_SIZE - conn->out_len - 2, fmt, ap);
+    va_end(ap);
+
+    if (len < 0 || (size_t) len >= MOCK_OUT_SIZE - conn->out_len - 2)
+        return;
+
+    conn->out_len += len;
+    memcpy(conn->out + conn->out_len, "\r\n", 2);
+    conn->out_len += 2;
+}
+
+static void mock_register(mock_ircd_t *server, mock_conn_t *conn, int64_t now)
+{
+    if (server->config.nick_in_use && server->stats.connections == 1) {
+        mock_append(conn, ":" MOCK_SERVER_NAME " 433 * %s :Nickname is already in use",
+            conn->nick);
+        conn->got_nick = false;
+        return;
+    }
+
+    mock_append(conn, ":" MOCK_SERVER_NAME " 001 %s :Welcome to the mock network %s!%s@127.0.0.1",
+        conn->nick, conn->nick, conn->nick);
+    mock_append(conn, ":" MOCK_SERVER_NAME " 002 %s :Your host is " MOCK_SERVER_NAME, conn->nick);
+    mock_append(conn, ":" MOCK_SERVER_NAME " 003 %s :This server was created today", conn->nick);
+    mock_append(conn, ":" MOCK_SERVER_NAME " 004 %s " MOCK_SERVER_NAME " mock-1.0 io ov",
+        conn->nick);
+    mock_append(conn, ":" MOCK_SERVER_NAME " 005 %s CASEMAPPING=rfc1459 CHANTYPES=# "
+        "PREFIX=(ov)@+ CHANMODES=beI,k,l,imnpst NICKLEN=30 TARGMAX=PRIVMSG:4,NOTICE:4,JOIN: "
+        ":are supported by this server", conn->nick);
+    mock_append(conn, ":" MOCK_SERVER_NAME " 376 %s :End of /MOTD command.", conn->nick);
+
+    conn->registered = true;
+    conn->next_ping = now + server->config.ping_interval_ms * 1000LL;
+}
+
+/* The next NAMES reply listing the other members, about 400 bytes of them */
+static void mock_names(mock_ircd_t *server, mock_conn_t *conn)
+{
+    char names[448];
+    size_t len = 0;
+
+    while (conn->names_next < server->config.users && len <= 400) {
+        len += snprintf(names + len, sizeof(names) - len, "%s%su%" PRIu32, len ? " " : "",
+            conn->names_next % 10 == 0 ? "@" : conn->names_next % 10 == 1 ? "+" : "",
+            conn->names_next);
+        conn->names_next++;
+    }
+
+    mock_append(conn, ":" MOCK_SERVER_NAME " 353 %s = %s :%s", conn->nick, conn->channel,
+        names);
+}
+
+/* Membership changes for the client to follow, see mock_ircd.h */
+static void mock_churn(mock_ircd_t *server, mock_conn_t *conn)
+{
+    if (server->config.users < 5)
+        return;
+
+    mock_append(conn, ":u0!u@mock QUIT :Gone");
+    mock_append(conn, ":u1!u@mock NICK :renamed");
+    mock_append(conn, ":u2!u@mock PART %s", conn->channel);
+    mock_append(conn, ":bench!bench@" MOCK_SERVER_NAME " KICK %s u3 :Bye", conn->channel);
+    mock_append(conn, ":bench!bench@" MOCK_SERVER_NAME " MODE %s +lo 10 u4", conn->channel);
+}
+
+/* The last parameter of a line, trailing or not */
+static const char *mock_last_param(const char *line)
+{
+    const char *p = strstr(line, " :");
+
+    if (p)
+        return p + 2;
+
+    p = strrchr(line, ' ');
+    return p ? p + 1 : "";
+}
+
+/*
+ * "JOIN <channel>[,<channel>...]", the burst goes to the first channel
+ * joined. The others are only acknowledged.
+ */
+static void mock_join(mock_ircd_t *server, mock_conn_t *conn, const char *channels)
+{
+    char channel[64];
+    size_t len;
+
+    server->stats.join_lines++;
+
+    while (*channels && *channels != ' ') {
+        len = strcspn(channels, ", ");
+        snprintf(channel, sizeof(channel), "%.*s", (int) len, channels);
+        channels += len + (channels[len] == ',');
+
+        server->stats.channels_joined++;
+        mock_append(conn, ":%s!%s@127.0.0.1 JOIN %s", conn->nick, conn->nick, channel);
+
+        if (conn->joined)
+            continue;
+
+        snprintf(conn->channel, sizeof(conn->channel), "%s", channel);
+        mock_append(conn, ":" MOCK_SERVER_NAME " 353 %s = %s :%s @bench", conn->nick,
+            conn->channel, conn->nick);
+
+        /* The other members and 366 follow as the output drains */
+        conn->joined = true;
+        conn->names_next = 0;
+    }
+}
+
+/* Whether text ends inside a UTF-8 character */
+static bool mock_utf8_cut(const uint8_t *text, size_t len)
+{
+    size_t i = len - 1, want;
+
+    while (i > 0 && (text[i] & 0xc0) == 0x80)
+        i--;
+
+    if (text[i] < 0x80)
+        want = 1;
+    else if ((text[i] & 0xe0) == 0xc0)
+        want = 2;
+    else if ((text[i] & 0xf0) == 0xe0)
+        want = 3;
+    else
+        want = 4;
+
+    return len - i != want;
+}
+
+/* "PRIVMSG <target> :<text>", relayed as ":<nick>!<nick>@127.0.0.1 <line>\r\n" */
+static void mock_privmsg(mock_ircd_t *server, mock_conn_t *conn, const char *line)
+{
+    const char *text = strstr(line, " :");
+    uint32_t relayed;
+    size_t len;
+
+    if (!text)
+        return;
+
+    text += 2;
+    len = strlen(text);
+    relayed = 1 + strlen(conn->nick) * 2 + strlen("!@127.0.0.1 ") + strlen(line) + 2;
+
+    pthread_mutex_lock(&server->lock);
+
+    server->stats.text_lines++;
+    if (relayed > server->stats.relay_max)
+        server->stats.relay_max = relayed;
+
+    if (len && (((uint8_t) text[0] & 0xc0) == 0x80 || mock_utf8_cut((const uint8_t *) text, len)))
+        server->stats.utf8_broken++;
+
+    if (server->stats.text_len + len > server->text_size) {
+        size_t size = MAX(server->text_size * 2, server->stats.text_len + len);
+        char *buf = realloc(server->stats.text, size);
+
+        if (buf) {
+            server->stats.text = buf;
+            server->text_size = size;
+        }
+    }
+
+    for (size_t i = 0; i < len && server->stats.text_len < server->text_size; i++) {
+        if (text[i] != ' ')
+            server->stats.text[server->stats.text_len++] = text[i];
+    }
+
+    pthread_mutex_unlock(&server->lock);
+}
+
+static void mock_handle_line(mock_ircd_t *server, mock_conn_t *conn, char *line, int64_t now)
+{
+    char arg[64];
+
+    if (!strncmp(line, "CAP LS", 6)) {
+        mock_append(conn, ":" MOCK_SERVER_NAME " CAP * LS :");
+    } else if (!strncmp(line, "CAP REQ ", 8)) {
+        mock_append(conn, ":" MOCK_SERVER_NAME " CAP * NAK :%s", mock_last_param(line));
+    } else if (sscanf(line, "NICK %63s", arg) == 1) {
+        snprintf(conn->nick, sizeof(conn->nick), "%s", arg[0] == ':' ? arg + 1 : arg);
+        conn->got_nick = true;
+    } else if (!strncmp(line, "USER ", 5)) {
+        conn->got_user = true;
+    } else if (!strncmp(line, "PING", 4)) {
+        mock_append(conn, ":" MOCK_SERVER_NAME " PONG " MOCK_SERVER_NAME " :%s",
+            mock_last_param(line));
+    } else if (!strncmp(line, "PONG", 4)) {
+        if (conn->ping_outstanding && strtoul(mock_last_param(line), NULL, 10) == conn->ping_token) {
+            pthread_mutex_lock(&server->lock);
+            if (server->stats.rtt_count == server->rtt_size) {
+                size_t size = server->rtt_size ? server->rtt_size * 2 : 1024;
+                uint32_t *rtt = realloc(server->stats.rtt, size * sizeof(*rtt));
+
+                if (rtt) {
+                    server->stats.rtt = rtt;
+                    server->rtt_size = size;
+                }
+            }
+            if (server->stats.rtt_count < server->rtt_size && conn->ping_sent_at)
+                server->stats.rtt[server->stats.rtt_count++] = now - conn->ping_sent_at;
+            pthread_mutex_unlock(&server->lock);
+
+            conn->ping_outstanding = false;
+            conn->next_ping = now + server->config.ping_interval_ms * 1000LL;
+        }
+    } else if (!strncmp(line, "JOIN ", 5) && conn->registered) {
+        mock_join(server, conn, line + 5);
+    } else if (!strncmp(line, "PRIVMSG ", 8) && conn->registered) {
+        mock_privmsg(server, conn, line);
+    } else if (!strncmp(line, "QUIT", 4)) {
+        mock_append(conn, "ERROR :Closing Link: %s (Quit)", conn->nick);
+        conn->closing = true;
+    }
+
+    if (conn->got_nick && conn->got_user && !conn->registered)
+        mock_register(server, conn, now);
+}
+
+/* Queue the messages that are due, as long as there's room */
+static void mock_generate(mock_ircd_t *server, mock_conn_t *conn, int64_t now)
+{
+    const mock_ircd_config_t *config = &server->config;
+    char payload[1024];
+    uint64_t due = UINT64_MAX;
+    uint32_t queued = 0;
+
+    if (!conn->named) {
+        while (conn->names_next < config->users && conn->out_len < MOCK_OUT_HIGH)
+            mock_names(server, conn);
+
+        if (conn->names_next < config->users)
+            return;
+
+        mock_append(conn, ":" MOCK_SERVER_NAME " 366 %s %s :End of /NAMES list.", conn->nick,
+            conn->channel);
+        conn->named = true;
+        conn->start = now;
+    }
+
+    if (config->rate)
+        due = (now - conn->start) * config->rate / 1000000 + 1;
+
+    while (conn->seq < config->messages && conn->seq < due && conn->out_len < MOCK_OUT_HIGH) {
+        mock_ircd_payload(config, conn->seq, payload);
+        mock_append(conn, ":bench!bench@" MOCK_SERVER_NAME " PRIVMSG %s :%" PRIu32 " %s",
+            conn->channel, conn->seq, payload);
+        conn->seq++;
+        queued++;
+
+        if (config->error_after && conn->seq == config->error_after &&
+                server->stats.connections == 1) {
+            mock_append(conn, "ERROR :Closing Link: %s (Injected error)", conn->nick);
+            conn->closing = true;
+            break;
+        }
+
+        if (config->stall_after && conn->seq == config->stall_after &&
+                server->stats.connections == 1) {
+            conn->stalled = true;
+            break;
+        }
+    }
+
+    if (conn->seq == config->messages && !conn->closing && !conn->stalled) {
+        mock_churn(server, conn);
+        mock_append(conn, ":" MOCK_SERVER_NAME " NOTICE %s :END", conn->channel);
+        conn->done = true;
+    }
+
+    pthread_mutex_lock(&server->lock);
+    server->stats.messages_sent += queued;
+    pthread_mutex_unlock(&server->lock);
+}
+
+static bool mock_flush(mock_ircd_t *server, mock_conn_t *conn, int64_t now)
+{
+    size_t len = conn->out_len;
+    ssize_t ret;
+
+    if (server->config.fragment_max)
+        len = 1 + rand_r(&server->seed) % server->config.fragment_max;
+    if (len > conn->out_len)
+        len = conn->out_len;
+
+    ret = send(conn->fd, conn->out, len, MSG_NOSIGNAL);
+    if (ret < 0)
+        return errno == EAGAIN || errno == EWOULDBLOCK;
+
+    memmove(conn->out, conn->out + ret, conn->out_len - ret);
+    conn->out_len -= ret;
+    conn->written += ret;
+
+    if (conn->ping_outstanding && !conn->ping_sent_at && conn->written >= conn->ping_end)
+        conn->ping_sent_at = now;
+
+    pthread_mutex_lock(&server->lock);
+    server->stats.bytes_sent += ret;
+    server->stats.writes++;
+    pthread_mutex_unlock(&server->lock);
+
+    return true;
+}
+
+static bool mock_receive(mock_ircd_t *server, mock_conn_t *conn, int64_t now)
+{
+    char *line, *eol;
+    ssize_t ret;
+
+    ret = recv(conn->fd, conn->in + conn->in_len, MOCK_IN_SIZE - conn->in_len - 1, 0);
+    if (ret <= 0)
+        return ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+
+    conn->in_len += ret;
+    conn->in[conn->in_len] = '\0';
+
+    for (line = conn->in; (eol = strchr(line, '\n')); line = eol + 1) {
+        *eol = '\0';
+        if (eol > line && eol[-1] == '\r')
+            eol[-1] = '\0';
+
+        /* A dead link, whatever the client sends is lost */
+        if (!conn->stalled)
+            mock_handle_line(server, conn, line, now);
+    }
+
+    conn->in_len -= line - conn->in;
+    memmove(conn->in, line, conn->in_len);
+
+    /* A client sending garbage without line breaks */
+    if (conn->in_len == MOCK_IN_SIZE - 1)
+        conn->in_len = 0;
+
+    return true;
+}
+
+static void mock_serve(mock_ircd_t *server, int fd)
+{
+    const mock_ircd_config_t *config = &server->config;
+    mock_conn_t *conn;
+    struct pollfd fds[2];
+    int64_t now, timeout;
+    int one = 1;
+
+    conn = calloc(1, sizeof(*conn));
+    if (!conn) {
+        close(fd);
+        return;
+    }
+
+    conn->fd = fd;
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    for (;;) {
+        now = mock_now();
+        timeout = 100000;
+
+        if (conn->joined && !conn->done && !conn->closing && !conn->stalled) {
+            mock_generate(server, conn, now);
+
+            if (config->rate && conn->out_len < MOCK_OUT_HIGH && !conn->done)
+                timeout = 1000000 / config->rate;
+        }
+
+        if (config->ping_interval_ms && conn->registered && !conn->closing && !conn->stalled) {
+            if (!conn->ping_outstanding && now >= conn->next_ping) {
+                conn->ping_token++;
+                mock_append(conn, "PING :%" PRIu32, conn->ping_token);
+                conn->ping_end = conn->written + conn->out_len;
+                conn->ping_sent_at = 0;
+                conn->ping_outstanding = true;
+
+                pthread_mutex_lock(&server->lock);
+                server->stats.pings_sent++;
+                pthread_mutex_unlock(&server->lock);
+            } else if (!conn->ping_outstanding && conn->next_ping - now < timeout) {
+                timeout = conn->next_ping - now;
+            }
+        }
+
+        if (conn->closing && !conn->out_len)
+            break;
+
+        fds[0].fd = fd;
+        fds[0].events = POLLIN | (conn->out_len && !conn->stalled ? POLLOUT : 0);
+        fds[1].fd = server->stop_fd[0];
+        fds[1].events = POLLIN;
+
+        if (poll(fds, 2, (timeout + 999) / 1000) < 0 && errno != EINTR)
+            break;
+
+        if (fds[1].revents)
+            break;
+
+        now = mock_now();
+
+        if ((fds[0].revents & (POLLIN | POLLHUP | POLLERR)) && !mock_receive(server, conn, now))
+            break;
+
+        if ((fds[0].revents & POLLOUT) && !mock_flush(server, conn, now))
+            break;
+    }
+
+    shutdown(fd, SHUT_RDWR);
+    close(fd);
+    free(conn);
+}
+
+static void *mock_ircd_task(void *arg)
+{
+    mock_ircd_t *server = arg;
+    struct pollfd fds[2];
+    int fd;
+
+    for (;;) {
+        fds[0].fd = server->listen_fd;
+        fds[0].events = POLLIN;
+        fds[1].fd = server->stop_fd[0];
+        fds[1].events = POLLIN;
+
+        if (poll(fds, 2, -1) < 0 && errno != EINTR)
+            break;
+
+        if (fds[1].revents)
+            break;
+
+        if (!(fds[0].revents & POLLIN))
+            continue;
+
+        fd = accept(server->listen_fd, NULL, NULL);
+        if (fd < 0)
+            continue;
+
+        pthread_mutex_lock(&server->lock);
+        server->stats.connections++;
+        pthread_mutex_unlock(&server->lock);
+
+        /* One client at a time */
+        mock_serve(server, fd);
+    }
+
+    return NULL;
+}
+
+mock_ircd_t *mock_ircd_start(const mock_ircd_config_t *config)
+{
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(config->port),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    socklen_t addr_len = sizeof(addr);
+    mock_ircd_t *server;
+    int one = 1;
+
+    if (config->payload >= 1024)
+        return NULL;
+
+    server = calloc(1, sizeof(*server));
+    if (!server)
+        return NULL;
+
+    server->config = *config;
+    server->seed = config->seed;
+    server->stop_fd[0] = server->stop_fd[1] = -1;
+    pthread_mutex_init(&server->lock, NULL);
+
+    server->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (server->listen_fd < 0)
+        goto fail;
+
+    setsockopt(server->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    if (bind(server->listen_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+            listen(server->listen_fd, 4) < 0 ||
+            getsockname(server->listen_fd, (struct sockaddr *) &addr, &addr_len) < 0)
+        goto fail;
+
+    server->port = ntohs(addr.sin_port);
+
+    if (pipe(server->stop_fd) < 0)
+        goto fail;
+
+    if (pthread_create(&server->thread, NULL, mock_ircd_task, server))
+        goto fail;
+
+    return server;
+
+fail:
+    if (server->listen_fd >= 0)
+        close(server->listen_fd);
+    if (server->stop_fd[0] >= 0) {
+        close(server->stop_fd[0]);
+        close(server->stop_fd[1]);
+    }
+    pthread_mutex_destroy(&server->lock);
+    free(server);
+    return NULL;
+}
+
+uint16_t mock_ircd_port(mock_ircd_t *server)
+{
+    return server->port;
+}
+
+void mock_ircd_stop(mock_ircd_t *server)
+{
+    if (server->listen_fd < 0)
+        return;
+
+    write(server->stop_fd[1], "", 1);
+    pthread_join(server->thread, NULL);
+
+    close(server->listen_fd);
+    close(server->stop_fd[0]);
+    close(server->stop_fd[1]);
+    server->listen_fd = -1;
+}
+
+void mock_ircd_stats(mock_ircd_t *server, mock_ircd_stats_t *stats)
+{
+    pthread_mutex_lock(&server->lock);
+    *stats = server->stats;
+    pthread_mutex_unlock(&server->lock);
+}
+
+void mock_ircd_free(mock_ircd_t *server)
+{
+    mock_ircd_stop(server);
+    pthread_mutex_destroy(&server->lock);
+    free(server->stats.rtt);
+    free(server->stats.text);
+    free(server);
+}
@@ -0,0 +1,75 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * Copyright (c) 2024 Danct12
+ */
+
+#ifndef __ESPIRC_MOCK_IRCD_H__
+#define __ESPIRC_MOCK_IRCD_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A local stand-in for an IRC server, just enough for registration, PING and
+ * JOIN. Once a client has joined a channel, the server sends it a burst of
+ * numbered PRIVMSGs to the channel followed by "NOTICE <channel> :END".
+ * Further channels, in the same JOIN or later ones, are only acknowledged.
+ *
+ * PRIVMSGs from the client are checked as if relayed to others: the longest
+ * relayed line, pieces cut inside a UTF-8 character, and the text with its
+ * whitespace removed, to compare with what the client meant to send.
+ *
+ * Message <seq> reads "<seq> <payload>", where the payload is
+ * mock_ircd_payload(seq) so that clients can tell lost, merged or mangled
+ * lines apart.
+ *
+ * With users, the channel has that many other members u0, u1, ... (every
+ * tenth an operator, every tenth after that voiced). Before the END notice
+ * u0 quits, u1 becomes "renamed", u2 parts, u3 is kicked and u4 opped, which
+ * leaves users - 3 of them for a client tracking the channel.
+ */
+typedef struct {
+    uint16_t port;              /* 0 picks a free port */
+    uint32_t messages;          /* PRIVMSGs sent per connection */
+    uint32_t rate;              /* Messages per second, 0 for as fast as possible */
+    uint32_t payload;           /* Longest payload, in bytes */
+    uint32_t fragment_max;      /* Split writes at random boundaries up to this size */
+    uint32_t ping_interval_ms;  /* PING the client this often, 0 to never */
+    uint32_t error_after;       /* Send ERROR after this many messages, on the first connection */
+    uint32_t stall_after;       /* Go silent after this many messages, on the first connection */
+    bool nick_in_use;           /* Answer the first registration with 433 */
+    uint32_t users;             /* Other members of the channel, at least 5 if any */
+    uint32_t seed;
+} mock_ircd_config_t;
+
+typedef struct {
+    uint32_t connections;
+    uint64_t messages_sent;
+    uint64_t bytes_sent;
+    uint64_t writes;
+    uint32_t pings_sent;
+    uint32_t join_lines;
+    uint32_t channels_joined;
+    uint32_t text_lines;
+    uint32_t relay_max;         /* Longest PRIVMSG as relayed, incl. our prefix and CRLF */
+    uint32_t utf8_broken;
+    size_t text_len;
+    char *text;
+    size_t rtt_count;           /* PING -> PONG round trips, in microseconds */
+    uint32_t *rtt;
+} mock_ircd_stats_t;
+
+typedef struct mock_ircd mock_ircd_t;
+
+mock_ircd_t *mock_ircd_start(const mock_ircd_config_t *config);
+uint16_t mock_ircd_port(mock_ircd_t *server);
+void mock_ircd_stop(mock_ircd_t *server);
+
+/* The round trip samples and text stay valid until mock_ircd_free() */
+void mock_ircd_stats(mock_ircd_t *server, mock_ircd_stats_t *stats);
+void mock_ircd_free(mock_ircd_t *server);
+
+/* Writes the payload of message seq into buf (at least config.payload + 1 bytes) */
+size_t mock_ircd_payload(const mock_ircd_config_t *config, uint32_t seq, char *buf);
+#endif
@@ -0,0 +1,76 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * Copyright (c) 2024 Danct12
+ */
+
+/*
+ * Standalone mock IRC server, for pointing other clients (or an ESP board on
+ * the same network) at it. See mock_ircd.h for what it does.
+ *
+ * Usage: mock_ircd [-P port] [-n messages] [-r rate] [-p payload]
+ *                  [-f fragment_max] [-i ping_ms] [-e error_after] [-d stall_after] [-k]
+ */
+
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "mock_ircd.h"
+
+int main(int argc, char **argv)
+{
+    mock_ircd_config_t config = {
+        .port = 6667,
+        .messages = 10000,
+        .payload = 200,
+        .ping_interval_ms = 1000,
+        .seed = 1,
+    };
+    mock_ircd_stats_t stats;
+    mock_ircd_t *server;
+    sigset_t set;
+    int opt, sig;
+
+    while ((opt = getopt(argc, argv, "P:n:r:p:f:i:e:d:k")) != -1) {
+        switch (opt) {
+            case 'P': config.port = atoi(optarg); break;
+            case 'n': config.messages = strtoul(optarg, NULL, 0); break;
+            case 'r': config.rate = strtoul(optarg, NULL, 0); break;
+            case 'p': config.payload = strtoul(optarg, NULL, 0); break;
+            case 'f': config.fragment_max = strtoul(optarg, NULL, 0); break;
+            case 'i': config.ping_interval_ms = strtoul(optarg, NULL, 0); break;
+            case 'e': config.error_after = strtoul(optarg, NULL, 0); break;
+            case 'd': config.stall_after = strtoul(optarg, NULL, 0); break;
+            case 'k': config.nick_in_use = true; break;
+            default:
+                fprintf(stderr, "Usage: %s [-P port] [-n messages] [-r rate] [-p payload] "
+                    "[-f fragment_max] [-i ping_ms] [-e error_after] [-d stall_after] [-k]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    sigemptyset(&set);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    server = mock_ircd_start(&config);
+    if (!server) {
+        fprintf(stderr, "Failed to start the server\n");
+        return 1;
+    }
+
+    printf("Listening on 127.0.0.1:%u\n", mock_ircd_port(server));
+    sigwait(&set, &sig);
+
+    mock_ircd_stop(server);
+    mock_ircd_stats(server, &stats);
+    printf("%" PRIu32 " connections, %" PRIu64 " messages, %" PRIu64 " bytes in %" PRIu64
+        " writes, %zu/%" PRIu32 " PINGs answered\n", stats.connections, stats.messages_sent,
+        stats.bytes_sent, stats.writes, stats.rtt_count, stats.pings_sent);
+    mock_ircd_free(server);
+
+    return 0;
+}
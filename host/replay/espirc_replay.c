@@ -0,0 +1,147 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * Copyright (c) 2024 Danct12
+ */
+
+/*
+ * Replays a capture (irc_capture_start() on a board, or espirc_loadtest -w)
+ * through the client and reports how long processing it took, so the exact
+ * traffic behind a performance problem can be profiled on the host:
+ *
+ *   espirc_replay -s 0 capture.bin          as fast as possible
+ *   espirc_replay -s 1 capture.bin          at the original pace
+ *
+ * Options:
+ *   -s speed      1 for the original pace, N for N times faster, 0 for no
+ *                 delays at all (default 0)
+ *   -a            dispatch asynchronously
+ *   -t seconds    give up after this long (default 600)
+ *
+ * Every connection in the capture is replayed in turn. The latency
+ * histograms are logged as well when built with ESPIRC_TRACE.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/param.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "espirc.h"
+
+typedef struct {
+    SemaphoreHandle_t done;
+    uint32_t connects;
+    uint64_t messages;
+} replay_t;
+
+static void event_handler(void *arg, esp_event_base_t event_base, int32_t event_id,
+                            void *event_data)
+{
+    replay_t *replay = arg;
+
+    switch (event_id) {
+        case IRC_EVENT_CONNECTED:
+            replay->connects++;
+            break;
+        case IRC_EVENT_DISCONNECTED:
+            xSemaphoreGive(replay->done);
+            break;
+        case IRC_EVENT_NEW_MESSAGE:
+            replay->messages++;
+            break;
+        default:
+            break;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    replay_t replay = { 0 };
+    irc_config_t config = {
+        .host = "replay",
+        .nick = "replay",
+        .user = "replay",
+        .realname = "espirc replay",
+    };
+    irc_replay_config_t replay_config = { 0 };
+    int opt, timeout = 600;
+    irc_handle_t client;
+    irc_stats_t stats;
+    int64_t start, deadline;
+    double elapsed;
+
+    while ((opt = getopt(argc, argv, "s:at:")) != -1) {
+        switch (opt) {
+            case 's': replay_config.speed = strtoul(optarg, NULL, 0); break;
+            case 'a': config.dispatch_async = true; break;
+            case 't': timeout = atoi(optarg); break;
+            default:
+                fprintf(stderr, "See the top of espirc_replay.c for the options\n");
+                return 1;
+        }
+    }
+
+    if (optind != argc - 1) {
+        fprintf(stderr, "Usage: %s [-s speed] [-a] [-t seconds] capture\n", argv[0]);
+        return 1;
+    }
+
+    esp_log_level_set("*", ESP_LOG_WARN);
+
+    replay.done = xSemaphoreCreateBinary();
+
+    client = irc_create(config);
+    if (!client)
+        return 1;
+
+    replay_config.path = argv[optind];
+    if (irc_replay_set(client, &replay_config) != ESP_OK) {
+        irc_destroy(client);
+        return 1;
+    }
+
+    irc_event_handler_register(client, event_handler, &replay);
+
+    start = esp_timer_get_time();
+    deadline = start + timeout * 1000000LL;
+
+    /* One connection of the recording per irc_connect(), until it runs out */
+    while (irc_connect(client) == ESP_OK) {
+        if (xSemaphoreTake(replay.done, pdMS_TO_TICKS(MAX(deadline - esp_timer_get_time(), 0) / 1000)) != pdTRUE) {
+            fprintf(stderr, "Timed out after %d s\n", timeout);
+            irc_disconnect(client);
+            break;
+        }
+
+        /* Let the IRC task exit before connecting again */
+        vTaskDelay(pdMS_TO_TICKS(1));
+    }
+
+    elapsed = (esp_timer_get_time() - start) / 1e6;
+    irc_get_stats(client, &stats);
+
+    printf("connections     %" PRIu32 "\n", replay.connects);
+    printf("received        %" PRIu32 " bytes, %" PRIu32 " lines in %.3f s\n",
+        stats.bytes_received, stats.lines_received, elapsed);
+    printf("throughput      %.0f lines/s, %.1f MB/s\n", stats.lines_received / elapsed,
+        stats.bytes_received / elapsed / 1e6);
+    printf("messages        %" PRIu64 " dispatched, %" PRIu32 " dropped\n", replay.messages,
+        stats.events_dropped);
+    printf("parse errors    %" PRIu32 "\n", stats.parse_errors);
+    printf("rbuf peak       %" PRIu32 " bytes\n", stats.rbuf_peak);
+
+    irc_trace_dump(client);
+
+    irc_destroy(client);
+    vSemaphoreDelete(replay.done);
+
+    return 0;
+}
@@ -0,0 +1,304 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * Copyright (c) 2024 Danct12
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "esp_err.h"
+#include "esp_event.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+struct espirc_host_event_handler {
+    struct espirc_host_event_handler *next;
+    esp_event_base_t base;
+    int32_t id;
+    esp_event_handler_t handler;
+    void *arg;
+    bool instance;
+};
+
+struct espirc_host_event_post {
+    esp_event_base_t base;
+    int32_t id;
+    long long data[];
+};
+
+struct espirc_host_event_loop {
+    QueueHandle_t queue;
+    pthread_mutex_t lock;
+    struct espirc_host_event_handler *handlers;
+
+    /* Loops with a dedicated task only */
+    SemaphoreHandle_t done;
+};
+
+static bool espirc_host_event_matches(struct espirc_host_event_handler *handler,
+                                        esp_event_base_t base, int32_t id)
+{
+    return (handler->base == ESP_EVENT_ANY_BASE || handler->base == base) &&
+        (handler->id == ESP_EVENT_ANY_ID || handler->id == id);
+}
+
+static void espirc_host_event_dispatch(esp_event_loop_handle_t loop,
+                                        struct espirc_host_event_post *post)
+{
+    struct espirc_host_event_handler *handler, *next;
+
+    /* Recursive, so handlers may unregister themselves */
+    pthread_mutex_lock(&loop->lock);
+    for (handler = loop->handlers; handler; handler = next) {
+        next = handler->next;
+        if (espirc_host_event_matches(handler, post->base, post->id))
+            handler->handler(handler->arg, post->base, post->id, post->data);
+    }
+    pthread_mutex_unlock(&loop->lock);
+
+    free(post);
+}
+
+/* A NULL post stops the loop task */
+static void espirc_host_event_task(void *arg)
+{
+    esp_event_loop_handle_t loop = arg;
+    struct espirc_host_event_post *post;
+
+    while (xQueueReceive(loop->queue, &post, portMAX_DELAY) == pdTRUE && post)
+        espirc_host_event_dispatch(loop, post);
+
+    xSemaphoreGive(loop->done);
+    vTaskDelete(NULL);
+}
+
+esp_err_t esp_event_loop_create(const esp_event_loop_args_t *event_loop_args,
+                                esp_event_loop_handle_t *event_loop)
+{
+    esp_event_loop_handle_t loop;
+    pthread_mutexattr_t attr;
+
+    if (!event_loop_args || !event_loop || event_loop_args->queue_size <= 0)
+        return ESP_ERR_INVALID_ARG;
+
+    loop = calloc(1, sizeof(*loop));
+    if (!loop)
+        return ESP_ERR_NO_MEM;
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&loop->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    loop->queue = xQueueCreate(event_loop_args->queue_size, sizeof(struct espirc_host_event_post *));
+    if (!loop->queue)
+        goto fail;
+
+    if (event_loop_args->task_name) {
+        loop->done = xSemaphoreCreateBinary();
+        if (!loop->done)
+            goto fail;
+
+        if (xTaskCreate(espirc_host_event_task, event_loop_args->task_name,
+                event_loop_args->task_stack_size, loop, event_loop_args->task_priority,
+                NULL) != pdPASS)
+            goto fail;
+    }
+
+    *event_loop = loop;
+    return ESP_OK;
+
+fail:
+    if (loop->done)
+        vSemaphoreDelete(loop->done);
+    if (loop->queue)
+        vQueueDelete(loop->queue);
+    pthread_mutex_destroy(&loop->lock);
+    free(loop);
+    return ESP_FAIL;
+}
+
+esp_err_t esp_event_loop_delete(esp_event_loop_handle_t loop)
+{
+    struct espirc_host_event_handler *handler, *next;
+    struct espirc_host_event_post *post = NULL;
+
+    if (!loop)
+        return ESP_ERR_INVALID_ARG;
+
+    if (loop->done) {
+        xQueueSend(loop->queue, &post, portMAX_DELAY);
+        xSemaphoreTake(loop->done, portMAX_DELAY);
+        vSemaphoreDelete(loop->done);
+    }
+
+    /* Events that were never dispatched */
+    while (xQueueReceive(loop->queue, &post, 0) == pdTRUE)
+        free(post);
+
+    for (handler = loop->handlers; handler; handler = next) {
+        next = handler->next;
+        free(handler);
+    }
+
+    vQueueDelete(loop->queue);
+    pthread_mutex_destroy(&loop->lock);
+    free(loop);
+
+    return ESP_OK;
+}
+
+esp_err_t esp_event_loop_run(esp_event_loop_handle_t loop, TickType_t ticks_to_run)
+{
+    struct espirc_host_event_post *post;
+    struct timespec start, now;
+    TickType_t elapsed, wait = ticks_to_run;
+
+    if (!loop)
+        return ESP_ERR_INVALID_ARG;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while (xQueueReceive(loop->queue, &post, wait) == pdTRUE) {
+        espirc_host_event_dispatch(loop, post);
+
+        if (ticks_to_run == portMAX_DELAY || !ticks_to_run)
+            continue;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        elapsed = (now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000;
+        if (elapsed >= ticks_to_run)
+            break;
+
+        wait = ticks_to_run - elapsed;
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t esp_event_post_to(esp_event_loop_handle_t loop, esp_event_base_t event_base,
+                            int32_t event_id, const void *event_data, size_t event_data_size,
+                            TickType_t ticks_to_wait)
+{
+    struct espirc_host_event_post *post;
+
+    if (!loop || !event_base)
+        return ESP_ERR_INVALID_ARG;
+
+    post = malloc(sizeof(*post) + event_data_size);
+    if (!post)
+        return ESP_ERR_NO_MEM;
+
+    post->base = event_base;
+    post->id = event_id;
+    if (event_data_size)
+        memcpy(post->data, event_data, event_data_size);
+
+    if (xQueueSend(loop->queue, &post, ticks_to_wait) != pdTRUE) {
+        free(post);
+        return ESP_ERR_TIMEOUT;
+    }
+
+    return ESP_OK;
+}
+
+static esp_err_t espirc_host_event_register(esp_event_loop_handle_t loop,
+                                            esp_event_base_t base, int32_t id,
+                                            esp_event_handler_t handler, void *arg,
+                                            bool instance, esp_event_handler_instance_t *out)
+{
+    struct espirc_host_event_handler *entry, **link;
+
+    if (!loop || !handler || (base == ESP_EVENT_ANY_BASE && id != ESP_EVENT_ANY_ID))
+        return ESP_ERR_INVALID_ARG;
+
+    entry = calloc(1, sizeof(*entry));
+    if (!entry)
+        return ESP_ERR_NO_MEM;
+
+    entry->base = base;
+    entry->id = id;
+    entry->handler = handler;
+    entry->arg = arg;
+    entry->instance = instance;
+
+    /* Handlers run in the order they were registered */
+    pthread_mutex_lock(&loop->lock);
+    for (link = &loop->handlers; *link; link = &(*link)->next);
+    *link = entry;
+    pthread_mutex_unlock(&loop->lock);
+
+    if (out)
+        *out = entry;
+
+    return ESP_OK;
+}
+
+esp_err_t esp_event_handler_register_with(esp_event_loop_handle_t event_loop,
+                                        esp_event_base_t event_base, int32_t event_id,
+                                        esp_event_handler_t event_handler,
+                                        void *event_handler_arg)
+{
+    return espirc_host_event_register(event_loop, event_base, event_id, event_handler,
+        event_handler_arg, false, NULL);
+}
+
+esp_err_t esp_event_handler_instance_register_with(esp_event_loop_handle_t event_loop,
+                                                esp_event_base_t event_base, int32_t event_id,
+                                                esp_event_handler_t event_handler,
+                                                void *event_handler_arg,
+                                                esp_event_handler_instance_t *instance)
+{
+    return espirc_host_event_register(event_loop, event_base, event_id, event_handler,
+        event_handler_arg, true, instance);
+}
+
+esp_err_t esp_event_handler_unregister_with(esp_event_loop_handle_t event_loop,
+                                            esp_event_base_t event_base, int32_t event_id,
+                                            esp_event_handler_t event_handler)
+{
+    struct espirc_host_event_handler *entry, **link;
+
+    if (!event_loop || !event_handler)
+        return ESP_ERR_INVALID_ARG;
+
+    pthread_mutex_lock(&event_loop->lock);
+    for (link = &event_loop->handlers; (entry = *link); link = &entry->next) {
+        if (!entry->instance && entry->base == event_base && entry->id == event_id &&
+                entry->handler == event_handler) {
+            *link = entry->next;
+            free(entry);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&event_loop->lock);
+
+    return ESP_OK;
+}
+
+esp_err_t esp_event_handler_instance_unregister_with(esp_event_loop_handle_t event_loop,
+                                                    esp_event_base_t event_base,
+                                                    int32_t event_id,
+                                                    esp_event_handler_instance_t instance)
+{
+    struct espirc_host_event_handler *entry, **link;
+
+    if (!event_loop || !instance)
+        return ESP_ERR_INVALID_ARG;
+
+    pthread_mutex_lock(&event_loop->lock);
+    for (link = &event_loop->handlers; (entry = *link); link = &entry->next) {
+        if (entry == instance) {
+            *link = entry->next;
+            free(entry);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&event_loop->lock);
+
+    return ESP_OK;
+}
@@ -0,0 +1,126 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * Copyright (c) 2024 Danct12
+ */
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/random.h>
+#include <time.h>
+
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+#include "esp_vfs_eventfd.h"
+#include "mbedtls/base64.h"
+#include "mbedtls/platform_util.h"
+
+static esp_log_level_t log_level = ESP_LOG_INFO;
+
+const char *esp_err_to_name(esp_err_t code)
+{
+    switch (code) {
+        case ESP_OK: return "ESP_OK";
+        case ESP_FAIL: return "ESP_FAIL";
+        case ESP_ERR_NO_MEM: return "ESP_ERR_NO_MEM";
+        case ESP_ERR_INVALID_ARG: return "ESP_ERR_INVALID_ARG";
+        case ESP_ERR_INVALID_STATE: return "ESP_ERR_INVALID_STATE";
+        case ESP_ERR_INVALID_SIZE: return "ESP_ERR_INVALID_SIZE";
+        case ESP_ERR_NOT_FOUND: return "ESP_ERR_NOT_FOUND";
+        case ESP_ERR_NOT_SUPPORTED: return "ESP_ERR_NOT_SUPPORTED";
+        case ESP_ERR_TIMEOUT: return "ESP_ERR_TIMEOUT";
+        case ESP_ERR_INVALID_RESPONSE: return "ESP_ERR_INVALID_RESPONSE";
+        case ESP_ERR_INVALID_CRC: return "ESP_ERR_INVALID_CRC";
+        case ESP_ERR_INVALID_VERSION: return "ESP_ERR_INVALID_VERSION";
+        case ESP_ERR_INVALID_MAC: return "ESP_ERR_INVALID_MAC";
+        case ESP_ERR_NOT_FINISHED: return "ESP_ERR_NOT_FINISHED";
+        case ESP_ERR_NOT_ALLOWED: return "ESP_ERR_NOT_ALLOWED";
+    }
+
+    return "UNKNOWN ERROR";
+}
+
+void esp_log_level_set(const char *tag, esp_log_level_t level)
+{
+    if (!strcmp(tag, "*"))
+        log_level = level;
+}
+
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...)
+{
+    static const char letters[] = "NEWIDV";
+    va_list ap;
+
+    if (level > log_level)
+        return;
+
+    va_start(ap, format);
+    fprintf(stderr, "%c (%lld) %s: ", letters[level], (long long) esp_timer_get_time() / 1000,
+        tag);
+    vfprintf(stderr, format, ap);
+    fputc('\n', stderr);
+    va_end(ap);
+}
+
+int64_t esp_timer_get_time(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+uint32_t esp_random(void)
+{
+    uint32_t value = 0;
+
+    getrandom(&value, sizeof(value), 0);
+
+    return value;
+}
+
+esp_err_t esp_vfs_eventfd_register(const esp_vfs_eventfd_config_t *config)
+{
+    return config ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+int mbedtls_base64_encode(unsigned char *dst, size_t dlen, size_t *olen,
+                        const unsigned char *src, size_t slen)
+{
+    static const char alphabet[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    size_t i, n = 0;
+    uint32_t v;
+
+    *olen = (slen + 2) / 3 * 4 + 1;
+    if (dlen < *olen)
+        return MBEDTLS_ERR_BASE64_BUFFER_TOO_SMALL;
+
+    for (i = 0; i < slen; i += 3) {
+        v = src[i] << 16;
+        if (i + 1 < slen) v |= src[i + 1] << 8;
+        if (i + 2 < slen) v |= src[i + 2];
+
+        dst[n++] = alphabet[(v >> 18) & 63];
+        dst[n++] = alphabet[(v >> 12) & 63];
+        dst[n++] = i + 1 < slen ? alphabet[(v >> 6) & 63] : '=';
+        dst[n++] = i + 2 < slen ? alphabet[v & 63] : '=';
+    }
+
+    dst[n] = '\0';
+    *olen = n;
+
+    return 0;
+}
+
+void mbedtls_platform_zeroize(void *buf, size_t len)
+{
+    volatile unsigned char *p = buf;
+
+    while (len--)
+        *p++ = 0;
+}
@@ -0,0 +1,328 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * Copyright (c) 2024 Danct12
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#include "shim_priv.h"
+
+struct espirc_host_task {
+    pthread_t thread;
+    TaskFunction_t task_code;
+    void *arg;
+};
+
+struct QueueDefinition {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint8_t *items;
+    UBaseType_t item_size;
+    UBaseType_t length;
+    UBaseType_t count;
+    UBaseType_t head;
+
+    /* Recursive mutexes only */
+    bool recursive;
+    pthread_t owner;
+    UBaseType_t depth;
+};
+
+static __thread struct espirc_host_task *current_task;
+
+void espirc_host_cond_init(pthread_cond_t *cond)
+{
+    pthread_condattr_t attr;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+bool espirc_host_cond_wait(pthread_cond_t *cond, pthread_mutex_t *lock,
+                            const struct timespec *start, TickType_t ticks)
+{
+    struct timespec deadline = *start;
+
+    if (ticks == portMAX_DELAY) {
+        pthread_cond_wait(cond, lock);
+        return true;
+    }
+
+    deadline.tv_sec += ticks / 1000;
+    deadline.tv_nsec += (ticks % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    return pthread_cond_timedwait(cond, lock, &deadline) == 0;
+}
+
+/*
+ * Tasks
+ */
+
+static void *espirc_host_task_run(void *arg)
+{
+    struct espirc_host_task *task = arg;
+
+    current_task = task;
+    task->task_code(task->arg);
+
+    /* Returning from a task is an error in FreeRTOS, treat it as a delete */
+    vTaskDelete(NULL);
+    return NULL;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t task_code, const char *name, uint32_t stack_depth,
+                        void *arg, UBaseType_t priority, TaskHandle_t *handle)
+{
+    struct espirc_host_task *task;
+    pthread_attr_t attr;
+    int ret;
+
+    task = calloc(1, sizeof(*task));
+    if (!task)
+        return pdFAIL;
+
+    task->task_code = task_code;
+    task->arg = arg;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    ret = pthread_create(&task->thread, &attr, espirc_host_task_run, task);
+    pthread_attr_destroy(&attr);
+
+    if (ret) {
+        free(task);
+        return pdFAIL;
+    }
+
+    if (handle)
+        *handle = task;
+
+    return pdPASS;
+}
+
+/* Only tasks deleting themselves are supported */
+void vTaskDelete(TaskHandle_t task)
+{
+    if (task && task != current_task)
+        abort();
+
+    free(current_task);
+    current_task = NULL;
+    pthread_exit(NULL);
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    struct timespec ts = {
+        .tv_sec = ticks / 1000,
+        .tv_nsec = (ticks % 1000) * 1000000L,
+    };
+
+    while (nanosleep(&ts, &ts));
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task)
+{
+    return 0;
+}
+
+/*
+ * Queues and semaphores
+ */
+
+static QueueHandle_t espirc_host_queue_create(UBaseType_t length, UBaseType_t item_size)
+{
+    QueueHandle_t queue;
+
+    queue = calloc(1, sizeof(*queue));
+    if (!queue)
+        return NULL;
+
+    if (item_size) {
+        queue->items = malloc((size_t) length * item_size);
+        if (!queue->items) {
+            free(queue);
+            return NULL;
+        }
+    }
+
+    pthread_mutex_init(&queue->lock, NULL);
+    espirc_host_cond_init(&queue->cond);
+    queue->item_size = item_size;
+    queue->length = length;
+
+    return queue;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+    if (!length)
+        return NULL;
+
+    return espirc_host_queue_create(length, item_size);
+}
+
+void vQueueDelete(QueueHandle_t queue)
+{
+    pthread_cond_destroy(&queue->cond);
+    pthread_mutex_destroy(&queue->lock);
+    free(queue->items);
+    free(queue);
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks)
+{
+    struct timespec start;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pthread_mutex_lock(&queue->lock);
+
+    while (queue->count == queue->length) {
+        if (!ticks || !espirc_host_cond_wait(&queue->cond, &queue->lock, &start, ticks)) {
+            if (queue->count == queue->length) {
+                pthread_mutex_unlock(&queue->lock);
+                return pdFAIL;
+            }
+        }
+    }
+
+    /* Semaphores are queues of empty items and pass no item */
+    if (queue->item_size && item)
+        memcpy(queue->items + (size_t) ((queue->head + queue->count) % queue->length) *
+            queue->item_size, item, queue->item_size);
+
+    queue->count++;
+
+    pthread_cond_broadcast(&queue->cond);
+    pthread_mutex_unlock(&queue->lock);
+
+    return pdPASS;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks)
+{
+    struct timespec start;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pthread_mutex_lock(&queue->lock);
+
+    while (!queue->count) {
+        if (!ticks || !espirc_host_cond_wait(&queue->cond, &queue->lock, &start, ticks)) {
+            if (!queue->count) {
+                pthread_mutex_unlock(&queue->lock);
+                return pdFAIL;
+            }
+        }
+    }
+
+    if (queue->item_size && item)
+        memcpy(item, queue->items + (size_t) queue->head * queue->item_size,
+            queue->item_size);
+
+    queue->head = (queue->head + 1) % queue->length;
+    queue->count--;
+
+    pthread_cond_broadcast(&queue->cond);
+    pthread_mutex_unlock(&queue->lock);
+
+    return pdPASS;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+    UBaseType_t count;
+
+    pthread_mutex_lock(&queue->lock);
+    count = queue->count;
+    pthread_mutex_unlock(&queue->lock);
+
+    return count;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+    return espirc_host_queue_create(1, 0);
+}
+
+/* A mutex is a binary semaphore that starts out given */
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    SemaphoreHandle_t sem = espirc_host_queue_create(1, 0);
+
+    if (sem)
+        sem->count = 1;
+
+    return sem;
+}
+
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex(void)
+{
+    SemaphoreHandle_t sem = xSemaphoreCreateMutex();
+
+    if (sem)
+        sem->recursive = true;
+
+    return sem;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks)
+{
+    return xQueueReceive(sem, NULL, ticks);
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem)
+{
+    return xQueueSend(sem, NULL, 0);
+}
+
+BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t sem, TickType_t ticks)
+{
+    pthread_mutex_lock(&sem->lock);
+    if (sem->depth && pthread_equal(sem->owner, pthread_self())) {
+        sem->depth++;
+        pthread_mutex_unlock(&sem->lock);
+        return pdPASS;
+    }
+    pthread_mutex_unlock(&sem->lock);
+
+    if (xQueueReceive(sem, NULL, ticks) != pdPASS)
+        return pdFAIL;
+
+    pthread_mutex_lock(&sem->lock);
+    sem->owner = pthread_self();
+    sem->depth = 1;
+    pthread_mutex_unlock(&sem->lock);
+
+    return pdPASS;
+}
+
+BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t sem)
+{
+    pthread_mutex_lock(&sem->lock);
+    if (!sem->depth || !pthread_equal(sem->owner, pthread_self())) {
+        pthread_mutex_unlock(&sem->lock);
+        return pdFAIL;
+    }
+
+    if (--sem->depth) {
+        pthread_mutex_unlock(&sem->lock);
+        return pdPASS;
+    }
+    pthread_mutex_unlock(&sem->lock);
+
+    return xQueueSend(sem, NULL, 0);
+}
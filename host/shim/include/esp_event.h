@@ -0,0 +1,63 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * Copyright (c) 2024 Danct12
+ */
+
+#ifndef __ESPIRC_HOST_ESP_EVENT_H__
+#define __ESPIRC_HOST_ESP_EVENT_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+/*
+ * Host stand-in for esp_event user loops. Events are copied into a queue
+ * and dispatched either by esp_event_loop_run() or by the loop's own thread.
+ */
+typedef const char *esp_event_base_t;
+typedef struct espirc_host_event_loop *esp_event_loop_handle_t;
+typedef void *esp_event_handler_instance_t;
+typedef void (*esp_event_handler_t)(void *event_handler_arg, esp_event_base_t event_base,
+                                    int32_t event_id, void *event_data);
+
+#define ESP_EVENT_ANY_BASE NULL
+#define ESP_EVENT_ANY_ID -1
+
+#define ESP_EVENT_DECLARE_BASE(id) extern esp_event_base_t const id
+#define ESP_EVENT_DEFINE_BASE(id) esp_event_base_t const id = #id
+
+typedef struct {
+    int32_t queue_size;
+    const char *task_name;
+    UBaseType_t task_priority;
+    uint32_t task_stack_size;
+    BaseType_t task_core_id;
+} esp_event_loop_args_t;
+
+esp_err_t esp_event_loop_create(const esp_event_loop_args_t *event_loop_args,
+                                esp_event_loop_handle_t *event_loop);
+esp_err_t esp_event_loop_delete(esp_event_loop_handle_t event_loop);
+esp_err_t esp_event_loop_run(esp_event_loop_handle_t event_loop, TickType_t ticks_to_run);
+esp_err_t esp_event_post_to(esp_event_loop_handle_t event_loop, esp_event_base_t event_base,
+                            int32_t event_id, const void *event_data, size_t event_data_size,
+                            TickType_t ticks_to_wait);
+esp_err_t esp_event_handler_register_with(esp_event_loop_handle_t event_loop,
+                                        esp_event_base_t event_base, int32_t event_id,
+                                        esp_event_handler_t event_handler,
+                                        void *event_handler_arg);
+esp_err_t esp_event_handler_unregister_with(esp_event_loop_handle_t event_loop,
+                                            esp_event_base_t event_base, int32_t event_id,
+                                            esp_event_handler_t event_handler);
+esp_err_t esp_event_handler_instance_register_with(esp_event_loop_handle_t event_loop,
+                                                esp_event_base_t event_base, int32_t event_id,
+                                                esp_event_handler_t event_handler,
+                                                void *event_handler_arg,
+                                                esp_event_handler_instance_t *instance);
+esp_err_t esp_event_handler_instance_unregister_with(esp_event_loop_handle_t event_loop,
+                                                    esp_event_base_t event_base,
+                                                    int32_t event_id,
+                                                    esp_event_handler_instance_t instance);
+#endif
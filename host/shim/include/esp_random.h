@@ -0,0 +1,12 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * Copyright (c) 2024 Danct12
+ */
+
+#ifndef __ESPIRC_HOST_ESP_RANDOM_H__
+#define __ESPIRC_HOST_ESP_RANDOM_H__
+
+#include <stdint.h>
+
+uint32_t esp_random(void);
+#endif
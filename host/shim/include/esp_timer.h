@@ -0,0 +1,13 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * Copyright (c) 2024 Danct12
+ */
+
+#ifndef __ESPIRC_HOST_ESP_TIMER_H__
+#define __ESPIRC_HOST_ESP_TIMER_H__
+
+#include <stdint.h>
+
+/* Microseconds on the monotonic clock */
+int64_t esp_timer_get_time(void);
+#endif
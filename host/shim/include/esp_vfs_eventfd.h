@@ -0,0 +1,22 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * Copyright (c) 2024 Danct12
+ */
+
+#ifndef __ESPIRC_HOST_ESP_VFS_EVENTFD_H__
+#define __ESPIRC_HOST_ESP_VFS_EVENTFD_H__
+
+#include <stddef.h>
+#include <sys/eventfd.h>
+
+#include "esp_err.h"
+
+/* Linux has eventfd() built in, registering the VFS is a no-op */
+typedef struct {
+    size_t max_fds;
+} esp_vfs_eventfd_config_t;
+
+#define ESP_VFS_EVENTD_CONFIG_DEFAULT() (esp_vfs_eventfd_config_t) { .max_fds = 5 }
+
+esp_err_t esp_vfs_eventfd_register(const esp_vfs_eventfd_config_t *config);
+#endif
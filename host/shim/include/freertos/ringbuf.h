@@ -0,0 +1,42 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * Copyright (c) 2024 Danct12
+ */
+
+#ifndef __ESPIRC_HOST_RINGBUF_H__
+#define __ESPIRC_HOST_RINGBUF_H__
+
+#include "freertos/FreeRTOS.h"
+
+/*
+ * Only no-split ring buffers are provided. Items are kept in their own heap
+ * blocks, but are accounted for like IDF does (an 8 byte header plus the
+ * item rounded up to 32 bits) so the same amount of data fits.
+ */
+typedef struct espirc_host_ringbuf *RingbufHandle_t;
+
+typedef enum {
+    RINGBUF_TYPE_NOSPLIT = 0,
+    RINGBUF_TYPE_ALLOWSPLIT,
+    RINGBUF_TYPE_BYTEBUF,
+} RingbufferType_t;
+
+typedef struct {
+    void *reserved[16];
+} StaticRingbuffer_t;
+
+RingbufHandle_t xRingbufferCreate(size_t size, RingbufferType_t type);
+RingbufHandle_t xRingbufferCreateStatic(size_t size, RingbufferType_t type,
+                                        uint8_t *storage, StaticRingbuffer_t *buffer);
+void vRingbufferDelete(RingbufHandle_t ringbuf);
+BaseType_t xRingbufferSendAcquire(RingbufHandle_t ringbuf, void **item, size_t size,
+                                    TickType_t ticks);
+BaseType_t xRingbufferSendComplete(RingbufHandle_t ringbuf, void *item);
+BaseType_t xRingbufferSend(RingbufHandle_t ringbuf, const void *item, size_t size,
+                            TickType_t ticks);
+void *xRingbufferReceive(RingbufHandle_t ringbuf, size_t *size, TickType_t ticks);
+void vRingbufferReturnItem(RingbufHandle_t ringbuf, void *item);
+size_t xRingbufferGetCurFreeSize(RingbufHandle_t ringbuf);
+void vRingbufferGetInfo(RingbufHandle_t ringbuf, UBaseType_t *free, UBaseType_t *read,
+                        UBaseType_t *write, UBaseType_t *acquire, UBaseType_t *waiting);
+#endif
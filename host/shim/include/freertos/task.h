@@ -0,0 +1,22 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * Copyright (c) 2024 Danct12
+ */
+
+#ifndef __ESPIRC_HOST_TASK_H__
+#define __ESPIRC_HOST_TASK_H__
+
+#include "freertos/FreeRTOS.h"
+
+typedef struct espirc_host_task *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+/* The stack depth and priority are ignored, threads get the default stack */
+BaseType_t xTaskCreate(TaskFunction_t task_code, const char *name, uint32_t stack_depth,
+                        void *arg, UBaseType_t priority, TaskHandle_t *task);
+void vTaskDelete(TaskHandle_t task);
+void vTaskDelay(TickType_t ticks);
+
+/* Thread stacks aren't watermarked on the host, this always returns 0 */
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task);
+#endif
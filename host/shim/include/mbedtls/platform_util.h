@@ -0,0 +1,12 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * Copyright (c) 2024 Danct12
+ */
+
+#ifndef __ESPIRC_HOST_MBEDTLS_PLATFORM_UTIL_H__
+#define __ESPIRC_HOST_MBEDTLS_PLATFORM_UTIL_H__
+
+#include <stddef.h>
+
+void mbedtls_platform_zeroize(void *buf, size_t len);
+#endif
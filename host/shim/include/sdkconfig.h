@@ -0,0 +1,9 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * Copyright (c) 2024 Danct12
+ */
+
+/*
+ * Host builds have no menuconfig. Options are passed as compile definitions
+ * by host/CMakeLists.txt instead.
+ */
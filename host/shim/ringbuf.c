@@ -0,0 +1,249 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * Copyright (c) 2024 Danct12
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/ringbuf.h"
+
+#include "shim_priv.h"
+
+/* Per item overhead of a no-split ring buffer in IDF */
+#define RINGBUF_HEADER_SIZE 8
+
+#define RINGBUF_ITEM_COST(size) (RINGBUF_HEADER_SIZE + (((size) + 3) & ~(size_t) 3))
+
+typedef enum {
+    RINGBUF_ITEM_ACQUIRED,
+    RINGBUF_ITEM_WRITTEN,
+    RINGBUF_ITEM_READ,
+} espirc_host_ringbuf_state_t;
+
+struct espirc_host_ringbuf_item {
+    struct espirc_host_ringbuf_item *next;
+    espirc_host_ringbuf_state_t state;
+    size_t size;
+    long long data[];
+};
+
+/*
+ * Items are linked in the order they were acquired, which is also the order
+ * they are received in.
+ */
+struct espirc_host_ringbuf {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    size_t size;
+    size_t used;
+    struct espirc_host_ringbuf_item *head;
+    struct espirc_host_ringbuf_item **tail;
+};
+
+static struct espirc_host_ringbuf_item *espirc_host_ringbuf_item(void *data)
+{
+    return (struct espirc_host_ringbuf_item *)
+        ((char *) data - offsetof(struct espirc_host_ringbuf_item, data));
+}
+
+RingbufHandle_t xRingbufferCreate(size_t size, RingbufferType_t type)
+{
+    RingbufHandle_t ringbuf;
+
+    if (type != RINGBUF_TYPE_NOSPLIT || size < RINGBUF_HEADER_SIZE * 2)
+        return NULL;
+
+    ringbuf = calloc(1, sizeof(*ringbuf));
+    if (!ringbuf)
+        return NULL;
+
+    pthread_mutex_init(&ringbuf->lock, NULL);
+    espirc_host_cond_init(&ringbuf->cond);
+    ringbuf->size = size & ~(size_t) 3;
+    ringbuf->tail = &ringbuf->head;
+
+    return ringbuf;
+}
+
+/* The storage is only used for its size, see freertos/ringbuf.h */
+RingbufHandle_t xRingbufferCreateStatic(size_t size, RingbufferType_t type,
+                                        uint8_t *storage, StaticRingbuffer_t *buffer)
+{
+    if (!storage || !buffer)
+        return NULL;
+
+    return xRingbufferCreate(size, type);
+}
+
+void vRingbufferDelete(RingbufHandle_t ringbuf)
+{
+    struct espirc_host_ringbuf_item *item, *next;
+
+    for (item = ringbuf->head; item; item = next) {
+        next = item->next;
+        free(item);
+    }
+
+    pthread_cond_destroy(&ringbuf->cond);
+    pthread_mutex_destroy(&ringbuf->lock);
+    free(ringbuf);
+}
+
+BaseType_t xRingbufferSendAcquire(RingbufHandle_t ringbuf, void **data, size_t size,
+                                    TickType_t ticks)
+{
+    struct espirc_host_ringbuf_item *item;
+    size_t cost = RINGBUF_ITEM_COST(size);
+    struct timespec start;
+
+    /* IDF caps no-split items at half the buffer */
+    if (cost > ringbuf->size / 2)
+        return pdFALSE;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pthread_mutex_lock(&ringbuf->lock);
+
+    while (ringbuf->used + cost > ringbuf->size) {
+        if (!ticks || !espirc_host_cond_wait(&ringbuf->cond, &ringbuf->lock, &start, ticks)) {
+            if (ringbuf->used + cost > ringbuf->size) {
+                pthread_mutex_unlock(&ringbuf->lock);
+                return pdFALSE;
+            }
+        }
+    }
+
+    item = malloc(sizeof(*item) + size);
+    if (!item) {
+        pthread_mutex_unlock(&ringbuf->lock);
+        return pdFALSE;
+    }
+
+    item->next = NULL;
+    item->state = RINGBUF_ITEM_ACQUIRED;
+    item->size = size;
+
+    *ringbuf->tail = item;
+    ringbuf->tail = &item->next;
+    ringbuf->used += cost;
+
+    pthread_mutex_unlock(&ringbuf->lock);
+
+    *data = item->data;
+    return pdTRUE;
+}
+
+BaseType_t xRingbufferSendComplete(RingbufHandle_t ringbuf, void *data)
+{
+    pthread_mutex_lock(&ringbuf->lock);
+    espirc_host_ringbuf_item(data)->state = RINGBUF_ITEM_WRITTEN;
+    pthread_cond_broadcast(&ringbuf->cond);
+    pthread_mutex_unlock(&ringbuf->lock);
+
+    return pdTRUE;
+}
+
+BaseType_t xRingbufferSend(RingbufHandle_t ringbuf, const void *data, size_t size,
+                            TickType_t ticks)
+{
+    void *item;
+
+    if (xRingbufferSendAcquire(ringbuf, &item, size, ticks) != pdTRUE)
+        return pdFALSE;
+
+    memcpy(item, data, size);
+
+    return xRingbufferSendComplete(ringbuf, item);
+}
+
+/* The next item to receive, NULL if it hasn't been written yet */
+static struct espirc_host_ringbuf_item *espirc_host_ringbuf_next(RingbufHandle_t ringbuf)
+{
+    struct espirc_host_ringbuf_item *item;
+
+    for (item = ringbuf->head; item && item->state == RINGBUF_ITEM_READ; item = item->next);
+
+    return item && item->state == RINGBUF_ITEM_WRITTEN ? item : NULL;
+}
+
+void *xRingbufferReceive(RingbufHandle_t ringbuf, size_t *size, TickType_t ticks)
+{
+    struct espirc_host_ringbuf_item *item;
+    struct timespec start;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pthread_mutex_lock(&ringbuf->lock);
+
+    while (!(item = espirc_host_ringbuf_next(ringbuf))) {
+        if (!ticks || !espirc_host_cond_wait(&ringbuf->cond, &ringbuf->lock, &start, ticks)) {
+            item = espirc_host_ringbuf_next(ringbuf);
+            if (!item) {
+                pthread_mutex_unlock(&ringbuf->lock);
+                return NULL;
+            }
+            break;
+        }
+    }
+
+    item->state = RINGBUF_ITEM_READ;
+    *size = item->size;
+
+    pthread_mutex_unlock(&ringbuf->lock);
+
+    return item->data;
+}
+
+void vRingbufferReturnItem(RingbufHandle_t ringbuf, void *data)
+{
+    struct espirc_host_ringbuf_item *item = espirc_host_ringbuf_item(data), **link;
+
+    pthread_mutex_lock(&ringbuf->lock);
+
+    for (link = &ringbuf->head; *link != item; link = &(*link)->next);
+
+    *link = item->next;
+    if (ringbuf->tail == &item->next)
+        ringbuf->tail = link;
+
+    ringbuf->used -= RINGBUF_ITEM_COST(item->size);
+    free(item);
+
+    pthread_cond_broadcast(&ringbuf->cond);
+    pthread_mutex_unlock(&ringbuf->lock);
+}
+
+size_t xRingbufferGetCurFreeSize(RingbufHandle_t ringbuf)
+{
+    size_t free_size;
+
+    pthread_mutex_lock(&ringbuf->lock);
+    free_size = ringbuf->size - ringbuf->used;
+    free_size = free_size > RINGBUF_HEADER_SIZE ? free_size - RINGBUF_HEADER_SIZE : 0;
+    pthread_mutex_unlock(&ringbuf->lock);
+
+    return free_size;
+}
+
+/* Only the number of items waiting to be received is reported */
+void vRingbufferGetInfo(RingbufHandle_t ringbuf, UBaseType_t *free_offset, UBaseType_t *read,
+                        UBaseType_t *write, UBaseType_t *acquire, UBaseType_t *waiting)
+{
+    struct espirc_host_ringbuf_item *item;
+    UBaseType_t count = 0;
+
+    pthread_mutex_lock(&ringbuf->lock);
+    for (item = ringbuf->head; item; item = item->next) {
+        if (item->state == RINGBUF_ITEM_WRITTEN)
+            count++;
+    }
+    pthread_mutex_unlock(&ringbuf->lock);
+
+    if (free_offset) *free_offset = 0;
+    if (read) *read = 0;
+    if (write) *write = 0;
+    if (acquire) *acquire = 0;
+    if (waiting) *waiting = count;
+}
@@ -0,0 +1,23 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * Copyright (c) 2024 Danct12
+ */
+
+#ifndef __ESPIRC_HOST_SHIM_PRIV_H__
+#define __ESPIRC_HOST_SHIM_PRIV_H__
+
+#include <pthread.h>
+#include <stdbool.h>
+
+#include "freertos/FreeRTOS.h"
+
+/* Condition variables of the shim all wait on CLOCK_MONOTONIC */
+void espirc_host_cond_init(pthread_cond_t *cond);
+
+/*
+ * Wait on cond for up to ticks, measured from start (a CLOCK_MONOTONIC
+ * timespec). Returns false once the time is up.
+ */
+bool espirc_host_cond_wait(pthread_cond_t *cond, pthread_mutex_t *lock,
+                            const struct timespec *start, TickType_t ticks);
+#endif
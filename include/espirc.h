@@ -33,14 +33,151 @@ typedef enum {
     IRC_EVENT_NEW_MESSAGE,
 } irc_event_t;
 
+ESP_EVENT_DECLARE_BASE(IRC_MESSAGE_EVENTS);
+
+/*
+ * Verb IDs, also used as the event IDs of IRC_MESSAGE_EVENTS.
+ *
+ * Numerics map to their own value, e.g. RPL_TOPIC (332) is IRC_NUMERIC(332).
+ * Commands are numbered after the numerics.
+ */
+#define IRC_NUMERIC(n) ((irc_verb_t) (n))
+
+typedef enum {
+    IRC_VERB_ANY = ESP_EVENT_ANY_ID,
+    IRC_VERB_UNKNOWN = 0,
+
+    /* Numerics */
+    IRC_RPL_WELCOME = 1,
+    IRC_RPL_ISUPPORT = 5,
+    IRC_RPL_NAMREPLY = 353,
+    IRC_RPL_ENDOFNAMES = 366,
+    IRC_RPL_ENDOFMOTD = 376,
+    IRC_RPL_HOSTHIDDEN = 396,
+    IRC_ERR_NOMOTD = 422,
+    IRC_ERR_NICKNAMEINUSE = 433,
+    IRC_RPL_LOGGEDIN = 900,
+    IRC_ERR_NICKLOCKED = 902,
+    IRC_RPL_SASLSUCCESS = 903,
+    IRC_ERR_SASLFAIL = 904,
+    IRC_ERR_SASLTOOLONG = 905,
+    IRC_ERR_SASLABORTED = 906,
+    IRC_ERR_SASLALREADY = 907,
+    IRC_RPL_SASLMECHS = 908,
+    IRC_NUMERIC_MAX = 999,
+
+    /* Commands */
+    IRC_VERB_ACCOUNT,
+    IRC_VERB_AUTHENTICATE,
+    IRC_VERB_AWAY,
+    IRC_VERB_BATCH,
+    IRC_VERB_CAP,
+    IRC_VERB_CHGHOST,
+    IRC_VERB_ERROR,
+    IRC_VERB_INVITE,
+    IRC_VERB_JOIN,
+    IRC_VERB_KICK,
+    IRC_VERB_KILL,
+    IRC_VERB_MODE,
+    IRC_VERB_NICK,
+    IRC_VERB_NOTICE,
+    IRC_VERB_PART,
+    IRC_VERB_PING,
+    IRC_VERB_PONG,
+    IRC_VERB_PRIVMSG,
+    IRC_VERB_QUIT,
+    IRC_VERB_SETNAME,
+    IRC_VERB_TAGMSG,
+    IRC_VERB_TOPIC,
+    IRC_VERB_WALLOPS,
+    IRC_VERB_MAX
+} irc_verb_t;
+
+/* RFC 1459 allows at most 15 parameters in a message */
+#define IRC_MESSAGE_PARAMS_MAX 15
+
+/*
+ * Longest line allowed with IRCv3 message tags: 8191 bytes of tags on top of
+ * the 512 bytes of a regular line. rbuf_size must be at least this large to
+ * receive every tagged line, longer lines are dropped.
+ */
+#define IRC_LINE_TAGGED_MAX 8703
+
+struct irc_message_slot;
+
+/*
+ * Parsed IRC message.
+ *
+ * All strings point into the receive buffer of the IRC task (or a message
+ * slot in asynchronous dispatch mode) and are only valid for the duration of
+ * the event handler, unless the message is kept with irc_message_ref().
+ */
 typedef struct {
+    char *tags;
     char *source;
+    uint16_t source_user;   /* Offset of the user in source, 0 if none */
+    uint16_t source_host;   /* Offset of the host in source, 0 if none */
     char *verb;
-    char **params;
+    irc_verb_t verb_id;
+    char *params[IRC_MESSAGE_PARAMS_MAX];
     int params_count;
     int colon;
+    char *line;             /* The tokenized line all fields point into, if any */
+    size_t line_len;
+    struct irc_message_slot *slot;
 } irc_message_t;
 
+/* A piece of a string, not NUL terminated. ptr is NULL if it's missing. */
+typedef struct {
+    const char *ptr;
+    size_t len;
+} irc_view_t;
+
+/*
+ * Flat message
+ *
+ * A message packed into one contiguous blob: a small table of offsets
+ * followed by the raw line, tokenized into NUL terminated strings by the
+ * parser. It holds no pointers, so it can be queued, stored or handed to
+ * another core with a single memcpy of irc_flat_size() bytes. Use the
+ * irc_flat_*() accessors to read it.
+ */
+#define IRC_FLAT_NONE 0xFFFF
+
+typedef struct {
+    uint16_t size;
+    uint16_t tags;
+    uint16_t source;
+    uint16_t source_user;
+    uint16_t source_host;
+    uint16_t verb;
+    int16_t verb_id;
+    uint8_t params_count;
+    uint8_t colon;
+    uint16_t params[IRC_MESSAGE_PARAMS_MAX];
+    char data[];
+} irc_flat_message_t;
+
+typedef enum {
+    IRC_SASL_NONE,
+    IRC_SASL_PLAIN,
+    IRC_SASL_EXTERNAL,
+} irc_sasl_mechanism_t;
+
+/*
+ * IRC Engine
+ *
+ * Services any number of clients from a single task with select(). A client
+ * joins an engine through irc_config_t.engine, irc_connect() then hands the
+ * connection over to the engine instead of starting an IRC task of its own.
+ */
+typedef struct irc_engine* irc_engine_handle_t;
+
+typedef struct {
+    size_t task_stack_size;
+    uint8_t task_priority;
+} irc_engine_config_t;
+
 typedef struct {
     /* IRC Config */
     const char* host;
@@ -49,15 +186,105 @@ typedef struct {
     const char* nick;
     uint16_t port;
 
-    /* Additional Config */
+    /*
+     * Additional Config
+     *
+     * channel is joined as is once registered, so it may carry a key
+     * ("#chan key"). The channels_count channels in channels are joined
+     * along with it, packed into as few JOIN lines as the server allows,
+     * once the MOTD is over. Those with a key get a JOIN of their own. The
+     * default sbuf_size grows to fit them.
+     */
     const char* realname;
     const char* channel;
+    const char* const* channels;
+    size_t channels_count;
+
+    /*
+     * Connection
+     *
+     * Every resolved address is tried, alternating between IPv6 and IPv4. A
+     * new attempt is started every connect_stagger_ms (default 250) while the
+     * previous ones are still pending and the first one to connect is used.
+     * connect_timeout_ms (default 10000) bounds the TCP connect,
+     * handshake_timeout_ms (default 15000) the TLS handshake and registration.
+     */
+    uint32_t connect_timeout_ms;
+    uint32_t connect_stagger_ms;
+    uint32_t handshake_timeout_ms;
+
+    /*
+     * Reconnect
+     *
+     * When enabled, a dropped connection is retried after a randomized delay
+     * starting at reconnect_min_ms (default 1000) and doubling up to
+     * reconnect_max_ms (default 60000) while attempts keep failing. Resolved
+     * addresses are reused, and TLS sessions are resumed when
+     * CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS is enabled.
+     */
+    bool reconnect;
+    uint32_t reconnect_min_ms;
+    uint32_t reconnect_max_ms;
+
+    /*
+     * Keepalive
+     *
+     * Once registered, the client sends a PING every ping_interval_ms
+     * (default 10000) to measure the lag to the server, see irc_stats_t. A
+     * link that stays silent for ping_timeout_ms (default 30000) is taken
+     * as dead and closed, and reconnected if enabled, instead of waiting
+     * for TCP to give up.
+     */
+    bool keepalive_disable;
+    uint32_t ping_interval_ms;
+    uint32_t ping_timeout_ms;
+
+    /* State Tracking (CONFIG_ESPIRC_STATE), see irc_state_channel() */
+    bool state_track;
+    size_t state_mem_max;
+
+    /*
+     * IRCv3
+     *
+     * caps is a space separated list of capabilities to request, those the
+     * server doesn't offer are skipped. When sasl_mechanism is set, SASL is
+     * requested as well and used to log in before registration completes:
+     * PLAIN with sasl_user (default: nick) and sasl_pass, EXTERNAL with the
+     * client certificate in tls_cfg.
+     */
+    const char* caps;
+    irc_sasl_mechanism_t sasl_mechanism;
+    const char* sasl_user;
+    const char* sasl_pass;
 
     /* IRC Task */
+    irc_engine_handle_t engine;
     int sbuf_size;
+    size_t rbuf_size;
+    size_t wbuf_size;
     size_t task_stack_size;
     uint8_t task_priority;
 
+    /*
+     * Message Dispatch
+     *
+     * By default handlers run on the IRC task. In asynchronous mode messages
+     * are copied into one of dispatch_pool_size slots (default 4) and handled
+     * on a dedicated task, or on dispatch_loop if supplied, while the IRC task
+     * keeps reading from the socket.
+     */
+    bool dispatch_async;
+    esp_event_loop_handle_t dispatch_loop;
+    uint8_t dispatch_pool_size;
+    int32_t dispatch_queue_size;
+    size_t dispatch_task_stack_size;
+    uint8_t dispatch_task_priority;
+
+    /* Flood Control */
+    uint32_t flood_interval_ms;
+    uint8_t flood_burst;
+    bool flood_disable;
+
     /* TLS Support */
 #ifdef CONFIG_ESPIRC_SUPPORT_TLS
     esp_tls_cfg_t tls_cfg;
@@ -65,26 +292,51 @@ typedef struct {
 #endif
 } irc_config_t;
 
-struct irc {
-    bool running;
-    char rbuf[513];
-    char sbuf[512];
+typedef struct {
+    uint32_t urgent_depth;
+    uint32_t bulk_depth;
+    uint32_t dropped;
+    uint32_t delayed;
+} irc_sendq_stats_t;
 
-    irc_config_t config;
+/*
+ * Runtime statistics
+ *
+ * Counters run from irc_create() and wrap around. heap_used and heap_peak
+ * cover the buffers of every client (and engine), task_stack_free is the
+ * lowest amount of free stack seen on the IRC task or engine, in bytes.
+ */
+typedef struct {
+    /* Traffic */
+    uint32_t bytes_received;
+    uint32_t bytes_sent;
+    uint32_t lines_received;
+    uint32_t lines_sent;
+    uint32_t parse_errors;
 
-    /* IRC Socket */
-    int socket;
+    /* Dispatch */
+    uint32_t events_dropped;
+    uint32_t event_queue_peak;
 
-#ifdef CONFIG_ESPIRC_SUPPORT_TLS
-    esp_tls_t *tls_ptr;
-#endif
+    /* Connection */
+    uint32_t reconnects;
+    uint32_t links_dead;
 
-    /* IRC Task */
-    irc_state_t state;
-    irc_message_t message;
-    TaskHandle_t task_handle;
-    esp_event_loop_handle_t event_handle;
-};
+    /* Lag of the last PING, smoothed over the connection and its jitter */
+    uint32_t lag_us;
+    uint32_t lag_srtt_us;
+    uint32_t lag_jitter_us;
+
+    /* Resources */
+    uint32_t rbuf_peak;
+    uint32_t task_stack_free;
+    uint32_t heap_used;
+    uint32_t heap_peak;
+
+    /* State tracking: bytes in use and members left out for lack of memory */
+    uint32_t state_used;
+    uint32_t state_dropped;
+} irc_stats_t;
 
 typedef struct irc* irc_handle_t;
 
@@ -93,13 +345,254 @@ irc_handle_t irc_create(irc_config_t config);
 esp_err_t irc_destroy(irc_handle_t client);
 esp_err_t irc_event_handler_register(irc_handle_t client, esp_event_handler_t event_handler,
                                     void *event_handler_arg);
+esp_err_t irc_event_handler_register_id(irc_handle_t client, irc_event_t event_id,
+                                    esp_event_handler_t event_handler, void *event_handler_arg);
 esp_err_t irc_event_handler_unregister(irc_handle_t client);
 
-/* IRC Connection */
+/*
+ * Message Handler
+ *
+ * The handler only runs for messages with the given verb (or every message
+ * with IRC_VERB_ANY), event_data points to the irc_message_t. Messages are
+ * not posted at all unless a handler is interested in them.
+ */
+esp_err_t irc_message_handler_register(irc_handle_t client, irc_verb_t verb,
+                                    esp_event_handler_t handler, void *handler_arg);
+esp_err_t irc_message_handler_unregister(irc_handle_t client, irc_verb_t verb,
+                                    esp_event_handler_t handler);
+
+/*
+ * Message Ownership (asynchronous dispatch only)
+ *
+ * irc_message_ref() keeps the message alive after the handler returns and
+ * returns a pointer that stays valid until irc_message_unref().
+ */
+irc_message_t *irc_message_ref(const irc_message_t *message);
+void irc_message_unref(const irc_message_t *message);
+
+/*
+ * Message Tags
+ *
+ * tags holds the raw IRCv3 tags of the message (without the leading '@').
+ * Values are only unescaped when looked up with irc_message_tag().
+ */
+esp_err_t irc_message_tag(const irc_message_t *message, const char *key, char *value, size_t size);
+
+/*
+ * Message Source
+ *
+ * Views of the nick, user and host of a "nick!user@host" source, for a server
+ * source the nick view holds the server name. The message is left untouched,
+ * use "%.*s" with (int) view.len, view.ptr to print a view.
+ *
+ * Comparisons without case follow RFC 1459 casemapping.
+ */
+irc_view_t irc_source_nick(const irc_message_t *message);
+irc_view_t irc_source_user(const irc_message_t *message);
+irc_view_t irc_source_host(const irc_message_t *message);
+bool irc_source_match(const irc_message_t *message, const char *mask);
+bool irc_view_equal(irc_view_t view, const char *str);
+bool irc_view_equal_nocase(irc_view_t view, const char *str);
+
+/* Flat Message */
+size_t irc_message_flat_size(const irc_message_t *message);
+esp_err_t irc_message_flatten(const irc_message_t *message, irc_flat_message_t *flat, size_t size);
+esp_err_t irc_flat_to_message(const irc_flat_message_t *flat, irc_message_t *message);
+size_t irc_flat_size(const irc_flat_message_t *flat);
+const char *irc_flat_tags(const irc_flat_message_t *flat);
+const char *irc_flat_source(const irc_flat_message_t *flat);
+const char *irc_flat_verb(const irc_flat_message_t *flat);
+irc_verb_t irc_flat_verb_id(const irc_flat_message_t *flat);
+int irc_flat_params_count(const irc_flat_message_t *flat);
+const char *irc_flat_param(const irc_flat_message_t *flat, int index);
+
+/* IRC Engine */
+irc_engine_handle_t irc_engine_create(irc_engine_config_t config);
+esp_err_t irc_engine_destroy(irc_engine_handle_t engine);
+
+/*
+ * IRC Connection
+ *
+ * irc_connect() resolves the host and returns, IRC_EVENT_CONNECTED is posted
+ * once registered or IRC_EVENT_DISCONNECTED if the connection fails.
+ */
 esp_err_t irc_connect(irc_handle_t client);
 esp_err_t irc_disconnect(irc_handle_t client);
 
-/* IRC Send */
+/*
+ * IRC Send
+ *
+ * Lines are queued and written out by the IRC task, so this can be called
+ * from any task and never blocks on the socket. ESP_ERR_NO_MEM is returned
+ * when the send queue (sbuf_size bytes) is full.
+ *
+ * To avoid getting killed for flooding, queued lines go out in bursts of at
+ * most flood_burst lines (default 5), then one every flood_interval_ms
+ * (default 2000).
+ *
+ * Lines that are ready at the same time are coalesced into a single write of
+ * up to wbuf_size bytes (default 1024).
+ */
 esp_err_t irc_sendraw(irc_handle_t client, char* fmt, ...);
+esp_err_t irc_get_sendq_stats(irc_handle_t client, irc_sendq_stats_t *stats);
+esp_err_t irc_get_stats(irc_handle_t client, irc_stats_t *stats);
+
+/*
+ * Latency Tracing (CONFIG_ESPIRC_TRACE)
+ *
+ * Logs log2 histograms of the time spent in recv, framing, parsing, posting
+ * events and running handlers. Returns ESP_ERR_NOT_SUPPORTED when tracing
+ * is compiled out.
+ */
+esp_err_t irc_trace_dump(irc_handle_t client);
+esp_err_t irc_trace_reset(irc_handle_t client);
+
+/*
+ * Traffic Capture (CONFIG_ESPIRC_CAPTURE)
+ *
+ * Records the raw bytes received and sent with their timing, either to a
+ * file (e.g. on SPIFFS or FATFS) or to a RAM ring of ram_size bytes which
+ * keeps the most recent traffic and is written out with irc_capture_save().
+ * The ring is kept after irc_capture_stop() until the next capture starts.
+ */
+typedef struct {
+    const char *path;
+    size_t ram_size;
+} irc_capture_config_t;
+
+esp_err_t irc_capture_start(irc_handle_t client, const irc_capture_config_t *config);
+esp_err_t irc_capture_stop(irc_handle_t client);
+esp_err_t irc_capture_save(irc_handle_t client, const char *path);
+
+/*
+ * Replay a capture from a file or from memory in place of the server, must
+ * be set before irc_connect(). Every connection in the recording is played
+ * back by a connect or reconnect, with the original timing divided by speed
+ * (1 for the original pace, 0 for as fast as possible). Whatever the client
+ * sends is dropped. A ring that starts in the middle of a connection lacks
+ * the registration, the client then stays in IRC_STATE_CONNECTING.
+ */
+typedef struct {
+    const char *path;
+    const void *data;
+    size_t size;
+    uint32_t speed;
+} irc_replay_config_t;
+
+esp_err_t irc_replay_set(irc_handle_t client, const irc_replay_config_t *config);
+
+/*
+ * State Tracking (CONFIG_ESPIRC_STATE)
+ *
+ * With state_track, the client follows JOIN, PART, KICK, QUIT, NICK, MODE and
+ * NAMES to know the channels it's in, their members and their membership
+ * modes (e.g. "o" for an operator). This happens before handlers get the
+ * message. Each nick is stored once however many channels it's in, names are
+ * looked up without case (the server's CASEMAPPING) in hash tables.
+ *
+ * state_mem_max (default 32768) caps the bytes used. Members that don't fit
+ * are left out, their channel is then no longer reported as synced.
+ *
+ * The walk callbacks get each channel with our modes in it, or each member
+ * with its modes, and return false to stop. They run with the state locked
+ * and must not call into the client. ESP_ERR_INVALID_STATE is returned when
+ * state_track is off.
+ */
+typedef struct {
+    uint32_t members;
+    bool synced;        /* The member list is complete */
+} irc_channel_info_t;
+
+typedef bool (*irc_state_walk_t)(const char *name, const char *modes, void *arg);
+
+esp_err_t irc_state_channel(irc_handle_t client, const char *channel, irc_channel_info_t *info);
+esp_err_t irc_state_member(irc_handle_t client, const char *channel, const char *nick,
+                            char *modes, size_t size);
+esp_err_t irc_state_channels(irc_handle_t client, irc_state_walk_t walk, void *arg);
+esp_err_t irc_state_members(irc_handle_t client, const char *channel, irc_state_walk_t walk,
+                            void *arg);
+
+/*
+ * Server Features (RPL_ISUPPORT)
+ *
+ * What the server announced in 005 right after the welcome: how it compares
+ * names, which prefixes start a channel, the membership modes, and the limits
+ * on lines, nicks and targets. Until then (and for tokens it leaves out) the
+ * RFC 1459 defaults apply. It's reset on every connect.
+ *
+ * irc_name_equal() compares nicks or channels with the server's casemapping,
+ * irc_is_channel() tells a channel from a nick by its first character.
+ */
+#define IRC_ISUPPORT_CHANTYPES_MAX 8
+#define IRC_ISUPPORT_PREFIX_MAX 8
+
+typedef enum {
+    IRC_CASEMAPPING_RFC1459,
+    IRC_CASEMAPPING_STRICT_RFC1459,
+    IRC_CASEMAPPING_ASCII,
+} irc_casemapping_t;
+
+/* Commands that take a list of targets */
+typedef enum {
+    IRC_TARGMAX_PRIVMSG,
+    IRC_TARGMAX_NOTICE,
+    IRC_TARGMAX_JOIN,
+    IRC_TARGMAX_PART,
+    IRC_TARGMAX_KICK,
+    IRC_TARGMAX_WHOIS,
+    IRC_TARGMAX_MAX
+} irc_targmax_t;
+
+typedef struct {
+    irc_casemapping_t casemapping;
+    uint16_t linelen;       /* Longest line incl. CRLF (512) */
+    uint8_t nicklen;        /* 0 when not announced */
+    uint8_t modes;          /* Modes with a parameter per MODE (3) */
+    char chantypes[IRC_ISUPPORT_CHANTYPES_MAX + 1];    /* "#&" */
+    char prefix_modes[IRC_ISUPPORT_PREFIX_MAX + 1];    /* "ov", highest rank first */
+    char prefix_chars[IRC_ISUPPORT_PREFIX_MAX + 1];    /* "@+" */
+    uint16_t targmax[IRC_TARGMAX_MAX];                 /* Targets per command, 0 for no limit */
+} irc_isupport_t;
+
+esp_err_t irc_get_isupport(irc_handle_t client, irc_isupport_t *isupport);
+bool irc_is_channel(irc_handle_t client, const char *name);
+bool irc_name_equal(irc_handle_t client, const char *a, const char *b);
+
+/*
+ * Send to many targets
+ *
+ * Sends JOIN or PART for count channels, or PRIVMSG or NOTICE with text to
+ * count targets, with as many targets per line as LINELEN and TARGMAX of
+ * the server allow (see irc_isupport_t). This takes a fraction of the lines,
+ * and of the flood control budget, that a line per target would.
+ *
+ * text is NULL for JOIN, and optional for PART (the reason). Targets can't
+ * be empty or contain spaces or commas, and text can't contain line breaks
+ * (see irc_send_long() for that). ESP_ERR_INVALID_ARG is returned for those,
+ * and when a target and text don't fit on a line together, before anything
+ * is queued. ESP_ERR_NO_MEM is returned if the send queue fills up,
+ * the lines queued before that are sent.
+ */
+esp_err_t irc_send_multi(irc_handle_t client, irc_targmax_t command, const char* const* targets,
+                            size_t count, const char* text);
+
+/*
+ * Send long text
+ *
+ * Sends len bytes of text to target as PRIVMSG or NOTICE, in as many lines
+ * as it takes. Each line is cut at the last space that fits, or inside a
+ * word too long for a line at a UTF-8 character boundary, and line breaks
+ * in text start a new line. The room per line leaves space for our
+ * "nick!user@host" as the server relays it, as learned from the welcome,
+ * our JOINs and host changes, or assumed to be as long as it can get until
+ * then.
+ *
+ * The lines are queued together, nothing from other tasks goes in between,
+ * so they are written at once as far as wbuf_size and flood control allow.
+ * ESP_ERR_NO_MEM is returned if the send queue fills up, the lines queued
+ * before that are sent.
+ */
+esp_err_t irc_send_long(irc_handle_t client, irc_targmax_t command, const char* target,
+                        const char* text, size_t len);
 
 #endif
@@ -4,20 +4,32 @@
  */
 
 #include <stdio.h>
+#include <inttypes.h>
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
+#include <sys/param.h>
+#include <sys/select.h>
 
 #include "sdkconfig.h"
 
 #include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 #include "freertos/task.h"
 
 #include "esp_err.h"
 #include "esp_log.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+#include "esp_vfs_eventfd.h"
 
 #include "espirc.h"
+#include "espirc_mem.h"
+#include "espirc_priv.h"
+#include "espirc_engine.h"
 #include "espirc_socket.h"
+#include "espirc_parser.h"
+#include "espirc_sendq.h"
 
 #ifdef CONFIG_ESPIRC_SUPPORT_TLS
 #include "esp_tls.h"
@@ -26,15 +38,36 @@
 static const char* TAG = "espirc";
 
 ESP_EVENT_DEFINE_BASE(IRC_EVENTS);
+ESP_EVENT_DEFINE_BASE(IRC_MESSAGE_EVENTS);
+
+/* Posted after a message in asynchronous mode to release its slot */
+static esp_event_base_t const IRC_RELEASE_EVENTS = "IRC_RELEASE_EVENTS";
+
+/* How long the IRC task waits for a message slot before dropping the message */
+#define IRC_DISPATCH_WAIT_MS 1000
 
 esp_err_t irc_event_handler_register(irc_handle_t client, esp_event_handler_t event_handler,
                                     void *event_handler_arg)
 {
+    return irc_event_handler_register_id(client, IRC_EVENT_ANY, event_handler, event_handler_arg);
+}
+
+esp_err_t irc_event_handler_register_id(irc_handle_t client, irc_event_t event_id,
+                                    esp_event_handler_t event_handler, void *event_handler_arg)
+{
+    esp_err_t err;
+
     if (!client)
         return ESP_ERR_INVALID_ARG;
 
-    return esp_event_handler_instance_register_with(client->event_handle, IRC_EVENTS,
-            IRC_EVENT_ANY, event_handler, event_handler_arg, NULL);
+    err = esp_event_handler_instance_register_with(client->event_handle, IRC_EVENTS,
+            event_id, event_handler, event_handler_arg, NULL);
+
+    /* IRC_EVENT_NEW_MESSAGE is only posted once someone listens to it */
+    if (err == ESP_OK && (event_id == IRC_EVENT_ANY || event_id == IRC_EVENT_NEW_MESSAGE))
+        client->message_event = true;
+
+    return err;
 }
 
 esp_err_t irc_event_handler_unregister(irc_handle_t client)
@@ -46,6 +79,41 @@ esp_err_t irc_event_handler_unregister(irc_handle_t client)
             IRC_EVENT_ANY, NULL);
 }
 
+esp_err_t irc_message_handler_register(irc_handle_t client, irc_verb_t verb,
+                                    esp_event_handler_t handler, void *handler_arg)
+{
+    esp_err_t err;
+
+    if (!client || verb < IRC_VERB_ANY || verb >= IRC_VERB_MAX)
+        return ESP_ERR_INVALID_ARG;
+
+    err = esp_event_handler_register_with(client->event_handle, IRC_MESSAGE_EVENTS, verb,
+            handler, handler_arg);
+    if (err != ESP_OK)
+        return err;
+
+    /*
+     * Only ever set: a stale bit merely costs a post that reaches no
+     * handler, while counting handlers per verb would cost a lot of RAM.
+     */
+    if (verb == IRC_VERB_ANY)
+        client->verb_any = true;
+    else
+        client->verb_handlers[verb / 32] |= 1UL << (verb % 32);
+
+    return ESP_OK;
+}
+
+esp_err_t irc_message_handler_unregister(irc_handle_t client, irc_verb_t verb,
+                                    esp_event_handler_t handler)
+{
+    if (!client || verb < IRC_VERB_ANY || verb >= IRC_VERB_MAX)
+        return ESP_ERR_INVALID_ARG;
+
+    return esp_event_handler_unregister_with(client->event_handle, IRC_MESSAGE_EVENTS, verb,
+            handler);
+}
+
 static esp_err_t irc_event_post(irc_handle_t client, int32_t event_id, const void *event_data,
                                     size_t event_data_size)
 {
@@ -54,11 +122,19 @@ static esp_err_t irc_event_post(irc_handle_t client, int32_t event_id, const voi
     if (!client || !client->event_handle)
         return ESP_ERR_INVALID_ARG;
 
+    IRC_TRACE_BEGIN(post_start);
     err = esp_event_post_to(client->event_handle, IRC_EVENTS, event_id, event_data,
         event_data_size, portMAX_DELAY);
-
-    /* Notify event loop */
-    esp_event_loop_run(client->event_handle, 0);
+    if (err != ESP_OK)
+        IRC_STAT_ADD(client, events_dropped, 1);
+    IRC_TRACE_END(client, IRC_TRACE_DISPATCH, post_start);
+
+    /* Notify event loop, unless it's run by another task */
+    if (!client->config.dispatch_async) {
+        IRC_TRACE_BEGIN(run_start);
+        esp_event_loop_run(client->event_handle, 0);
+        IRC_TRACE_END(client, IRC_TRACE_HANDLER, run_start);
+    }
 
     return err;
 }
@@ -90,179 +166,522 @@ static esp_err_t irc_state_set(irc_handle_t client, irc_state_t state)
     return err;
 }
 
+static void irc_release_handler(void* arg, esp_event_base_t event_base,
+                                int32_t event_id, void* event_data)
+{
+    struct irc_message_slot *slot = *(struct irc_message_slot **) event_data;
 
-static irc_message_t* irc_parse_message(char *message) {
-    irc_message_t* msgstruct;
-    char *token;
-    void *alloc_prev;
-    int i = 0;
+    /* In asynchronous mode, this covers the time queued plus the handlers */
+    IRC_TRACE_END((irc_handle_t) arg, IRC_TRACE_HANDLER, slot->posted);
 
-    msgstruct = malloc(sizeof(irc_message_t));
-    if (!msgstruct) return NULL;
+    espirc_pool_put(slot);
+}
 
-    msgstruct->verb = NULL;
-    msgstruct->source = NULL;
-    msgstruct->params = NULL;
-    msgstruct->colon = 0;
+/* Hand a message to the handlers interested in it */
+static void irc_dispatch(irc_handle_t client, irc_message_t *msg, const char *line, size_t len)
+{
+    struct irc_message_slot *slot = NULL;
+    irc_verb_t verb = msg->verb_id;
+    bool verb_event;
 
-    if (message[0] == ':') {
-        token = strtok(message+1, " ");
-        if (token) msgstruct->source = token;
+    verb_event = client->verb_any || (client->verb_handlers[verb / 32] & (1UL << (verb % 32)));
+    if (!client->message_event && !verb_event)
+        return;
+
+    /*
+     * In asynchronous mode the message is moved into a slot of its own, the
+     * release event is handled after every handler of the message has run.
+     */
+    if (client->config.dispatch_async) {
+        slot = espirc_pool_get(&client->pool, msg, line, len, pdMS_TO_TICKS(IRC_DISPATCH_WAIT_MS));
+        if (!slot) {
+            ESP_LOGW(TAG, "No free message slot, dropping message");
+            IRC_STAT_ADD(client, events_dropped, 1);
+            return;
+        }
+
+        msg = &slot->message;
     }
 
-    if (!msgstruct->source) token = strtok(message, " ");
-    else token = strtok(NULL, " ");
+    IRC_TRACE_BEGIN(post_start);
 
-    msgstruct->verb = token;
+    if (client->message_event && esp_event_post_to(client->event_handle, IRC_EVENTS,
+            IRC_EVENT_NEW_MESSAGE, msg, sizeof(irc_message_t), portMAX_DELAY) != ESP_OK)
+        IRC_STAT_ADD(client, events_dropped, 1);
 
-    while (token != NULL) {
-        token = strtok(NULL, " ");
-        if (!token) break;
+    if (verb_event && esp_event_post_to(client->event_handle, IRC_MESSAGE_EVENTS, verb, msg,
+            sizeof(irc_message_t), portMAX_DELAY) != ESP_OK)
+        IRC_STAT_ADD(client, events_dropped, 1);
 
-        alloc_prev = msgstruct->params;
-        msgstruct->params = realloc(msgstruct->params, (i + 1) * sizeof(char*));
-        if (!msgstruct->params) {
-            free(alloc_prev);
-            goto msgstruct_alloc_fail;
-        }
+    IRC_TRACE_END(client, IRC_TRACE_DISPATCH, post_start);
 
-        if (token[0] == ':') {
-            msgstruct->colon = 1;
-
-            msgstruct->params[i] = malloc((strlen(token)+1)*sizeof(char*));
-            if (!msgstruct->params[i])
-                goto msgstruct_alloc_fail_params;
-
-            strcpy(msgstruct->params[i], token+1);
-            token = strtok(NULL, "");
-            if (!token) goto trailing_end;
-
-            alloc_prev = msgstruct->params[i];
-            msgstruct->params[i] = realloc(msgstruct->params[i],
-                    strlen(msgstruct->params[i]) + strlen(token) + 2);
-            if (!msgstruct->params[i]) {
-                free(alloc_prev);
-                goto msgstruct_alloc_fail_params;
-            }
-
-            strcat(msgstruct->params[i], " ");
-            strcat(msgstruct->params[i], token);
-        } else {
-            msgstruct->params[i] = token;
-        }
-trailing_end:
-        i++;
+    if (client->config.dispatch_async) {
+#ifdef CONFIG_ESPIRC_TRACE
+        slot->posted = post_start;
+#endif
+        esp_event_post_to(client->event_handle, IRC_RELEASE_EVENTS, 0, &slot,
+            sizeof(slot), portMAX_DELAY);
+    } else {
+        IRC_TRACE_BEGIN(run_start);
+        esp_event_loop_run(client->event_handle, 0);
+        IRC_TRACE_END(client, IRC_TRACE_HANDLER, run_start);
     }
+}
 
-    msgstruct->params_count = i;
+/* Create the eventfd used to wake up select() */
+int irc_wake_fd_create(void)
+{
+    esp_vfs_eventfd_config_t eventfd_config = ESP_VFS_EVENTD_CONFIG_DEFAULT();
+    esp_err_t err;
+    int fd;
 
-    return msgstruct;
+    /* The eventfd VFS may already have been registered by the application */
+    err = esp_vfs_eventfd_register(&eventfd_config);
+    if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) {
+        ESP_LOGE(TAG, "Failed to register eventfd (%s)", esp_err_to_name(err));
+        return -1;
+    }
 
-msgstruct_alloc_fail:
-    free(msgstruct);
-    return NULL;
+    fd = eventfd(0, 0);
+    if (fd < 0)
+        ESP_LOGE(TAG, "Failed to create eventfd (%d)", errno);
 
-msgstruct_alloc_fail_params:
-    free(msgstruct->params);
-    goto msgstruct_alloc_fail;
+    return fd;
 }
 
-static void irc_parse_free(irc_message_t* message)
+/* Wake up the IRC task, e.g. when there's something new to send */
+void irc_wake(irc_handle_t client)
 {
-    if (message->colon == 1) free(message->params[message->params_count-1]);
-    free(message->params);
-    free(message);
+    uint64_t count = 1;
+
+    write(client->wake_fd, &count, sizeof(count));
 }
 
-static void irc_task(void* args) {
-    irc_handle_t client = (irc_handle_t) args;
-    irc_message_t *msg;
-    char *rbufcpy = NULL, *rbufcpy_prev = NULL, *split, *splitptr;
-    int rbuf_count = 0, offset = 0;
-    int sl;
+static esp_err_t irc_vsend(irc_handle_t client, irc_sendq_lane_t lane, const char *fmt, va_list ap)
+{
+    esp_err_t err;
 
-    ESP_LOGD(TAG, "Task started.");
-    ESP_LOGD(TAG, "Socket: %d", client->socket);
+    if (client->state < IRC_STATE_CONNECTING)
+        return ESP_ERR_INVALID_STATE;
 
-    client->running = true;
+    err = espirc_sendq_vpush(&client->sendq, lane, fmt, ap);
+    if (err == ESP_ERR_NO_MEM)
+        ESP_LOGW(TAG, "Send queue is full");
+    else if (err == ESP_OK)
+        irc_wake(client);
 
-    /*
-     * Continously receive data from the server until the client is disconnected
-     * from the network.
-     */
-    while (client->state >= IRC_STATE_CONNECTING &&
-            (sl = espirc_socket_recv(client, client->rbuf, sizeof(client->rbuf)-1))) {
-        if (sl < 0) {
-            ESP_LOGE(TAG, "Read socket failed (%d)", errno);
-            break;
-        }
+    return err;
+}
+
+esp_err_t irc_send(irc_handle_t client, irc_sendq_lane_t lane, const char *fmt, ...)
+{
+    esp_err_t err;
+    va_list ap;
 
-        if (sl == 0) continue;
+    va_start(ap, fmt);
+    err = irc_vsend(client, lane, fmt, ap);
+    va_end(ap);
 
-        rbuf_count += sl;
+    return err;
+}
 
-        ESP_LOGD(TAG, "Bytes received: %d - Count: %d", sl, rbuf_count);
-        rbufcpy = realloc(rbufcpy_prev = rbufcpy, 1 + rbuf_count * sizeof(char));
-        if (!rbufcpy) {
-            ESP_LOGE(TAG, "Failed to realloc mem");
-            free(rbufcpy_prev);
-            break;
-        }
+static void irc_autojoin_batch(irc_handle_t client, const char* const* channels, size_t count)
+{
+    esp_err_t err;
 
-        ESP_LOGD(TAG, "Offset: %d", offset);
+    if (!count)
+        return;
 
-        memcpy(rbufcpy+offset, client->rbuf, sl);
-        offset += sl;
+    err = irc_send_multi(client, IRC_TARGMAX_JOIN, channels, count, NULL);
+    if (err != ESP_OK)
+        ESP_LOGE(TAG, "Failed to join %s and %d more (%s)", channels[0], (int) count - 1,
+            esp_err_to_name(err));
+}
 
-        if (client->rbuf[sl-1] != '\n') {
-            ESP_LOGD(TAG, "Not enough data");
+/*
+ * Channels without a key are joined in batches, one with a key ("#chan key")
+ * goes on a JOIN of its own, so that it can't fail the lines of the others.
+ */
+static void irc_autojoin(irc_handle_t client)
+{
+    const char* const* channels = client->config.channels;
+    size_t first = 0, i;
+
+    if (client->config.channel && strlen(client->config.channel) != 0)
+        irc_sendraw(client, "JOIN %s", client->config.channel);
+
+    for (i = 0; i < client->config.channels_count; i++) {
+        if (channels[i] && *channels[i] && !strchr(channels[i], ' '))
             continue;
-        }
 
-        rbufcpy[rbuf_count] = '\0';
+        irc_autojoin_batch(client, channels + first, i - first);
+        first = i + 1;
 
-        split = strtok_r(rbufcpy, "\r\n", &splitptr);
+        if (channels[i] && *channels[i] && irc_sendraw(client, "JOIN %s", channels[i]) != ESP_OK)
+            ESP_LOGE(TAG, "Failed to join %s", channels[i]);
+    }
+
+    irc_autojoin_batch(client, channels + first, i - first);
+}
 
-        while (split != NULL) {
-            if (!strncmp(split, "PING", 4)) {
-                split[1] = 'O';
-                irc_sendraw(client, split);
-            } else if (!strncmp(split, "ERROR", 5)) {
-                ESP_LOGE(TAG, "Server error (%s)\n", split);
+static void irc_handle_line(irc_handle_t client, char *line, size_t len)
+{
+    irc_message_t *msg = &client->message;
+    esp_err_t err;
+
+    IRC_TRACE_BEGIN(parse_start);
+    err = irc_parse_message(line, len, msg);
+    IRC_TRACE_END(client, IRC_TRACE_PARSE, parse_start);
+
+    if (err != ESP_OK) {
+        IRC_STAT_ADD(client, parse_errors, 1);
+        return;
+    }
+
+    switch (msg->verb_id) {
+        case IRC_VERB_PING:
+            irc_send(client, IRC_SENDQ_URGENT, "PONG :%s",
+                    msg->params_count ? msg->params[0] : "");
+            return;
+        case IRC_VERB_PONG:
+            espirc_keepalive_pong(client, msg);
+            break;
+        case IRC_RPL_ISUPPORT:
+            espirc_isupport_handle(client, msg);
+            break;
+        case IRC_VERB_ERROR:
+            ESP_LOGE(TAG, "Server error (%s)", msg->params_count ? msg->params[0] : "");
+
+            /* The server drops the link after ERROR, which triggers a reconnect */
+            if (!client->config.reconnect)
                 irc_disconnect(client);
+            return;
+        default:
+            break;
+    }
+
+    espirc_state_handle(client, msg);
+    espirc_split_handle(client, msg);
+
+    if (client->state == IRC_STATE_CONNECTING) {
+        if (espirc_cap_handle(client, msg))
+            return;
+
+        switch (msg->verb_id) {
+            case IRC_RPL_WELCOME:
+                client->cap_state = IRC_CAP_DONE;
+                client->backoff_ms = client->config.reconnect_min_ms;
+                irc_state_set(client, IRC_STATE_CONNECTED);
+                espirc_keepalive_start(client);
+                client->autojoin = true;
+                break;
+            case IRC_ERR_NICKNAMEINUSE:
+                /* TODO: Add a random number after the nick when 433 is raised */
+                ESP_LOGE(TAG, "Nick is already in use.");
+                irc_disconnect(client);
+                break;
+            default:
                 break;
-            } else {
-                msg = irc_parse_message(split);
-                if (!msg) continue;
-
-                if (client->state == IRC_STATE_CONNECTING) {
-                    /* RPL_WELCOME (001) */
-                    if (strncmp(msg->verb, "001", 3) == 0) {
-                        irc_state_set(client, IRC_STATE_CONNECTED);
-                        if (strlen(client->config.channel) != 0)
-                            irc_sendraw(client, "JOIN %s", client->config.channel);
-                    }
-                    /* ERR_NICKNAMEINUSE (433) */
-                    else if (strncmp(msg->verb, "433", 3) == 0) {
-                        /* TODO: Add a random number after the nick when 433 is raised */
-                        ESP_LOGE(TAG, "Nick is already in use.");
-                        irc_disconnect(client);
-                    }
-                } else {
-                    irc_event_post(client, IRC_EVENT_NEW_MESSAGE, msg, sizeof(irc_message_t));
-                }
-
-                irc_parse_free(msg);
-            }
-            split = strtok_r(NULL, "\r\n", &splitptr);
         }
-        rbuf_count = 0;
-        offset = 0;
+    } else {
+        /* By the end of the MOTD, the 005 limits for packing the JOINs are known */
+        if (client->autojoin && (msg->verb_id == IRC_RPL_ENDOFMOTD ||
+                msg->verb_id == IRC_ERR_NOMOTD)) {
+            client->autojoin = false;
+            irc_autojoin(client);
+        }
+
+        irc_dispatch(client, msg, line, len);
+    }
+}
+
+static esp_err_t irc_receive(irc_handle_t client)
+{
+    char *buf, *line;
+    size_t len;
+    int sl;
+
+    buf = espirc_framer_space(&client->framer, &len);
+
+    IRC_TRACE_BEGIN(recv_start);
+    sl = espirc_socket_recv(client, buf, len);
+    IRC_TRACE_END(client, IRC_TRACE_RECV, recv_start);
+    /* A non-blocking socket (or TLS) may turn out to have nothing after all */
+    if (sl < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return ESP_OK;
+
+    if (sl < 0) {
+        ESP_LOGE(TAG, "Read socket failed (%d)", errno);
+        return ESP_FAIL;
     }
 
-    free(rbufcpy);
+    if (sl == 0) {
+        ESP_LOGE(TAG, "Connection closed by server");
+        return ESP_FAIL;
+    }
+
+    ESP_LOGD(TAG, "Bytes received: %d", sl);
+    espirc_framer_commit(&client->framer, sl);
+    client->keepalive.last_rx = esp_timer_get_time();
+
+    IRC_STAT_ADD(client, bytes_received, sl);
+    IRC_STAT_MAX(client, rbuf_peak, client->framer.tail - client->framer.head);
+
+    while (client->state >= IRC_STATE_CONNECTING) {
+        IRC_TRACE_BEGIN(frame_start);
+        line = espirc_framer_next(&client->framer, &len);
+        IRC_TRACE_END(client, IRC_TRACE_FRAME, frame_start);
+
+        if (!line)
+            break;
+
+        IRC_STAT_ADD(client, lines_received, 1);
+        irc_handle_line(client, line, len);
+    }
+
+    return ESP_OK;
+}
+
+/*
+ * Start connecting to the server and queue the registration, so that it all
+ * goes out in a single write as soon as the connection is up. The resolved
+ * addresses are reused if there are any, otherwise the host is looked up
+ * again without holding up the IRC task (or engine).
+ *
+ * Registration goes through the urgent lane, as flood control would
+ * otherwise hold back the replies during capability negotiation.
+ */
+static esp_err_t irc_start(irc_handle_t client)
+{
+    if (espirc_socket_connect(client) != ESP_OK)
+        return ESP_FAIL;
+
+    espirc_framer_reset(&client->framer);
+    espirc_isupport_reset(client);
+    espirc_split_reset(client);
+    irc_state_set(client, IRC_STATE_CONNECTING);
+
+    espirc_cap_start(client);
+
+    /* If a password is supplied, it must be entered first before registration. */
+    if (client->config.pass && strlen(client->config.pass) != 0)
+        irc_send(client, IRC_SENDQ_URGENT, "PASS %s", client->config.pass);
+
+    irc_send(client, IRC_SENDQ_URGENT, "USER %s 0 * :%s", client->config.user,
+        client->config.realname);
+    irc_send(client, IRC_SENDQ_URGENT, "NICK %s", client->config.nick);
+
+    return ESP_OK;
+}
+
+/*
+ * Schedule the next connection attempt after a random delay between half and
+ * all of the current backoff, which doubles with every failed attempt.
+ */
+static void irc_reconnect_schedule(irc_handle_t client)
+{
+    uint32_t delay = client->backoff_ms / 2 + esp_random() % (client->backoff_ms / 2 + 1);
+
+    ESP_LOGI(TAG, "Reconnecting in %" PRIu32 " ms", delay);
+
+    client->reconnect_at = esp_timer_get_time() + delay * 1000LL;
+    client->backoff_ms = MIN(client->backoff_ms * 2, client->config.reconnect_max_ms);
+}
+
+/* Lower the select() timeout to the given time if it's sooner */
+void irc_io_wait_min(int64_t *wait, int64_t candidate)
+{
+    if (candidate < 0)
+        return;
+
+    if (*wait < 0 || candidate < *wait)
+        *wait = candidate;
+}
+
+/*
+ * Add what the client is waiting for to the select() sets. The timeout is
+ * lowered when data is buffered by TLS (it doesn't show up on the socket),
+ * when flood control holds back queued lines or to enforce the connect and
+ * registration deadlines. A socket that was too full to take a whole batch
+ * is waited on to become writable.
+ */
+void irc_io_prepare(irc_handle_t client, fd_set *rfds, fd_set *wfds, int *maxfd, int64_t *wait)
+{
+    if (client->reconnect_at >= 0) {
+        irc_io_wait_min(wait, MAX(client->reconnect_at - esp_timer_get_time(), 0));
+        return;
+    }
+
+    if (client->connect.step != IRC_CONNECT_DONE) {
+        espirc_socket_connect_prepare(client, rfds, wfds, maxfd, wait);
+        return;
+    }
+
+    espirc_socket_prepare(client, rfds, maxfd, wait);
+
+    /* The rest of a batch goes out once the socket has room again */
+    if (espirc_sendq_blocked(&client->sendq)) {
+        FD_SET(client->socket, wfds);
+        *maxfd = MAX(*maxfd, client->socket);
+    }
+
+    if (client->state == IRC_STATE_CONNECTING)
+        irc_io_wait_min(wait, MAX(client->connect.deadline - esp_timer_get_time(), 0));
+
+    espirc_keepalive_prepare(client, wait);
+
+    if (espirc_socket_pending(client) > 0)
+        irc_io_wait_min(wait, 0);
+    else if (client->send_at >= 0)
+        irc_io_wait_min(wait, MAX(client->send_at - esp_timer_get_time(), 0));
+}
+
+/* Service the client after select(), returns false once the connection is over */
+bool irc_io_service(irc_handle_t client, fd_set *rfds, fd_set *wfds)
+{
+    int64_t wait;
+    esp_err_t err;
 
-    client->running = false;
+    if (client->reconnect_at >= 0) {
+        if (client->closing)
+            return false;
+
+        if (esp_timer_get_time() < client->reconnect_at)
+            return true;
+
+        client->reconnect_at = -1;
+        IRC_STAT_ADD(client, reconnects, 1);
+        if (irc_start(client) != ESP_OK)
+            return false;
+    }
+
+    if (client->connect.step != IRC_CONNECT_DONE) {
+        err = espirc_socket_connect_service(client, rfds, wfds);
+        if (err == ESP_ERR_NOT_FINISHED)
+            return !client->closing;
+
+        if (err != ESP_OK)
+            return false;
+
+        /* Fall through to send the queued registration */
+    } else if (client->state == IRC_STATE_CONNECTING &&
+            esp_timer_get_time() >= client->connect.deadline) {
+        ESP_LOGE(TAG, "Registration timed out");
+        return false;
+    } else if (espirc_socket_readable(client, rfds) && irc_receive(client) != ESP_OK) {
+        return false;
+    }
+
+    if (espirc_keepalive_service(client) != ESP_OK)
+        return false;
+
+    if (espirc_sendq_flush(client, &wait) != ESP_OK)
+        return false;
+
+    client->send_at = wait < 0 ? -1 : esp_timer_get_time() + wait;
+
+    return client->state >= IRC_STATE_CONNECTING && !client->closing;
+}
+
+/*
+ * Close the connection. Unless irc_disconnect() was called, the client stays
+ * running and reconnects later if enabled. Returns whether it does: once
+ * IRC_EVENT_DISCONNECTED is posted, a handler may irc_connect() again, so
+ * client->running may already belong to a new task.
+ */
+bool irc_io_close(irc_handle_t client)
+{
+    bool retry = client->config.reconnect && !client->closing;
+
+    if (espirc_socket_close(client) < 0)
+        ESP_LOGE(TAG, "Failed to close socket (%d)", errno);
+
+    espirc_sendq_clear(&client->sendq);
+    espirc_state_reset(client);
+    client->send_at = -1;
+    client->reconnect_at = -1;
+    client->closing = false;
+    client->running = retry;
+
+    if (client->state != IRC_STATE_DISCONNECTED)
+        irc_state_set(client, IRC_STATE_DISCONNECTED);
+
+    if (retry)
+        irc_reconnect_schedule(client);
+
+    return retry;
+}
+
+/* select() with a timeout in microseconds (-1 to wait forever) */
+int irc_io_select(int maxfd, fd_set *rfds, fd_set *wfds, int64_t wait)
+{
+    struct timeval tv;
+    int ret, err;
+
+    if (wait >= 0) {
+        tv.tv_sec = wait / 1000000;
+        tv.tv_usec = wait % 1000000;
+    }
+
+    ret = select(maxfd + 1, rfds, wfds, NULL, wait >= 0 ? &tv : NULL);
+    if (ret < 0 && errno == EINTR) {
+        FD_ZERO(rfds);
+        FD_ZERO(wfds);
+        ret = 0;
+    }
+
+    /* The caller may need errno, logging could change it */
+    if (ret < 0) {
+        err = errno;
+        ESP_LOGE(TAG, "select failed (%d)", err);
+        errno = err;
+    }
+
+    return ret;
+}
+
+static void irc_task(void* args) {
+    irc_handle_t client = (irc_handle_t) args;
+    int64_t wait, now, stack_at = 0;
+    uint64_t count;
+    fd_set rfds, wfds;
+    int maxfd;
+
+    ESP_LOGD(TAG, "Task started.");
+
+    /*
+     * Continously receive data from the server until the client is disconnected
+     * from the network. The task is also the only writer to the socket: other
+     * tasks queue their lines and wake it up.
+     */
+    while (client->running) {
+        FD_ZERO(&rfds);
+        FD_ZERO(&wfds);
+        FD_SET(client->wake_fd, &rfds);
+        maxfd = client->wake_fd;
+        wait = -1;
+
+        irc_io_prepare(client, &rfds, &wfds, &maxfd, &wait);
+
+        if (irc_io_select(maxfd, &rfds, &wfds, wait) < 0) {
+            client->closing = true;
+            irc_io_close(client);
+            break;
+        }
+
+        if (FD_ISSET(client->wake_fd, &rfds))
+            read(client->wake_fd, &count, sizeof(count));
+
+        if (!irc_io_service(client, &rfds, &wfds) && !irc_io_close(client))
+            break;
+
+        /* Walking the stack isn't free, so only sample it once in a while */
+        now = esp_timer_get_time();
+        if (now >= stack_at) {
+            client->stats.task_stack_free = uxTaskGetStackHighWaterMark(NULL);
+            stack_at = now + IRC_STACK_SAMPLE_US;
+        }
+    }
 
     ESP_LOGD(TAG, "Task end.");
     vTaskDelete(NULL);
@@ -288,37 +707,207 @@ irc_handle_t irc_create(irc_config_t config)
     if (!config.port)
         config.port = 6667;
 
+    if (!config.connect_timeout_ms)
+        config.connect_timeout_ms = 10000;
+
+    if (!config.connect_stagger_ms)
+        config.connect_stagger_ms = 250;
+
+    if (!config.handshake_timeout_ms)
+        config.handshake_timeout_ms = 15000;
+
+    if (!config.reconnect_min_ms)
+        config.reconnect_min_ms = 1000;
+
+    if (!config.reconnect_max_ms)
+        config.reconnect_max_ms = 60000;
+
+    if (!config.ping_interval_ms)
+        config.ping_interval_ms = 10000;
+
+    if (!config.ping_timeout_ms)
+        config.ping_timeout_ms = 30000;
+
+    if (!config.state_mem_max)
+        config.state_mem_max = 32768;
+
+    /* Capabilities like server-time come with tags, which make for longer lines */
+    if (!config.rbuf_size)
+        config.rbuf_size = config.caps && *config.caps ? IRC_LINE_TAGGED_MAX : 1024;
+
+    /* With room for the JOINs of a long channel list on top */
+    if (!config.sbuf_size) {
+        config.sbuf_size = 2048;
+        for (size_t i = 0; i < config.channels_count; i++)
+            config.sbuf_size += config.channels[i] ? strlen(config.channels[i]) + 1 : 0;
+    }
+
+    if (!config.wbuf_size)
+        config.wbuf_size = 1024;
+
+    /* Must be able to hold a full RFC 1459 line (incl. CRLF) */
+    if (config.wbuf_size < 512) {
+        ESP_LOGE(TAG, "Write buffer must be at least 512 bytes");
+        return NULL;
+    }
+
+    if (config.dispatch_loop)
+        config.dispatch_async = true;
+
+    if (!config.dispatch_pool_size)
+        config.dispatch_pool_size = 4;
+
+    if (!config.dispatch_queue_size)
+        config.dispatch_queue_size = 16;
+
+    if (!config.dispatch_task_stack_size)
+        config.dispatch_task_stack_size = 3072;
+
+    if (!config.flood_interval_ms)
+        config.flood_interval_ms = 2000;
+
+    if (!config.flood_burst)
+        config.flood_burst = 5;
+
+    /* Must be able to hold a full RFC 1459 line (incl. CRLF) */
+    if (config.rbuf_size < 512) {
+        ESP_LOGE(TAG, "Receive buffer must be at least 512 bytes");
+        return NULL;
+    }
+
+    if (config.sbuf_size < 1024) {
+        ESP_LOGE(TAG, "Send queue must be at least 1024 bytes");
+        return NULL;
+    }
+
     if (!config.realname || (config.realname && strlen(config.realname) == 0))
         config.realname = config.nick;
 
+    if (!config.sasl_user || strlen(config.sasl_user) == 0)
+        config.sasl_user = config.nick;
+
+    if (config.sasl_mechanism == IRC_SASL_PLAIN && !config.sasl_pass) {
+        ESP_LOGE(TAG, "SASL PLAIN requires a password");
+        return NULL;
+    }
+
 #ifdef CONFIG_ESPIRC_SUPPORT_TLS
+    /*
+     * The socket is connected and made non-blocking by espirc, esp_tls only
+     * runs the handshake on it. The handshake deadline is enforced by the
+     * IRC task.
+     */
     if (config.tls) {
-        config.tls_cfg.addr_family = ESP_TLS_AF_UNSPEC;
-        config.tls_cfg.timeout_ms = INT32_MAX;
+        config.tls_cfg.non_block = false;
+        config.tls_cfg.timeout_ms = config.handshake_timeout_ms;
     }
 #endif
 
-    client = calloc(1, sizeof(struct irc));
+    client = espirc_calloc(1, sizeof(struct irc));
     if (!client) {
         ESP_LOGE(TAG, "Failed to allocate memory");
         return NULL;
     }
 
-    ESP_LOGD(TAG, "Allocated %d bytes", sizeof(client));
+    ESP_LOGD(TAG, "Allocated %zu bytes", sizeof(*client));
 
     client->config = config;
+    client->wake_fd = -1;
+    client->send_at = -1;
+    client->reconnect_at = -1;
+
+#ifdef CONFIG_ESPIRC_CAPTURE
+    client->capture_lock = xSemaphoreCreateMutex();
+    if (!client->capture_lock) {
+        irc_destroy(client);
+        return NULL;
+    }
+#endif
+
+    if (espirc_framer_init(&client->framer, config.rbuf_size) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to allocate receive buffer");
+        irc_destroy(client);
+        return NULL;
+    }
+
+    if (espirc_sendq_init(&client->sendq, &client->config) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to allocate send queue");
+        irc_destroy(client);
+        return NULL;
+    }
+
+    espirc_isupport_reset(client);
+    espirc_split_reset(client);
+
+    if (espirc_state_init(client) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to set up state tracking");
+        irc_destroy(client);
+        return NULL;
+    }
+
+#ifdef CONFIG_ESPIRC_SUPPORT_TLS
+    /* TLS can't scatter/gather, coalesced lines are copied here instead */
+    if (config.tls) {
+        client->wbuf = espirc_malloc(config.wbuf_size);
+        if (!client->wbuf) {
+            ESP_LOGE(TAG, "Failed to allocate write buffer");
+            irc_destroy(client);
+            return NULL;
+        }
+    }
+#endif
+
+    if (config.engine) {
+        if (espirc_engine_attach(config.engine, client) != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to attach to engine");
+            irc_destroy(client);
+            return NULL;
+        }
+    } else {
+        client->wake_fd = irc_wake_fd_create();
+        if (client->wake_fd < 0) {
+            irc_destroy(client);
+            return NULL;
+        }
+    }
 
+    /* Room for both IRC_EVENT_NEW_MESSAGE and the verb event of a message */
     esp_event_loop_args_t loop_args = {
-        .queue_size = 1,
+        .queue_size = 2,
         .task_name = NULL
     };
 
-    if (esp_event_loop_create(&loop_args, &client->event_handle) != ESP_OK) {
+    if (config.dispatch_async) {
+        loop_args.queue_size = config.dispatch_queue_size;
+        loop_args.task_name = "irc_dispatch";
+        loop_args.task_stack_size = config.dispatch_task_stack_size;
+        loop_args.task_priority = config.dispatch_task_priority;
+        loop_args.task_core_id = tskNO_AFFINITY;
+
+        if (espirc_pool_init(&client->pool, config.dispatch_pool_size,
+                config.rbuf_size) != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to allocate message pool");
+            irc_destroy(client);
+            return NULL;
+        }
+    }
+
+    if (config.dispatch_loop) {
+        client->event_handle = config.dispatch_loop;
+    } else if (esp_event_loop_create(&loop_args, &client->event_handle) != ESP_OK) {
         ESP_LOGE(TAG, "Failed to create event");
         irc_destroy(client);
         return NULL;
     }
 
+    if (config.dispatch_async &&
+            esp_event_handler_register_with(client->event_handle, IRC_RELEASE_EVENTS, 0,
+                irc_release_handler, client) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register release handler");
+        irc_destroy(client);
+        return NULL;
+    }
+
     return client;
 }
 
@@ -327,10 +916,44 @@ esp_err_t irc_destroy(irc_handle_t client)
 {
     if (!client) return ESP_FAIL;
 
-    if(client->event_handle)
+    /* Stop the engine from servicing the client before tearing it down */
+    if (client->config.engine)
+        espirc_engine_detach(client->config.engine, client);
+
+    /* A lookup still running must not wake a closed fd */
+    espirc_socket_forget(client);
+
+    if (!client->config.engine && client->wake_fd >= 0)
+        close(client->wake_fd);
+
+    if (client->config.dispatch_loop)
+        esp_event_handler_unregister_with(client->event_handle, IRC_RELEASE_EVENTS, 0,
+            irc_release_handler);
+    else if (client->event_handle)
         esp_event_loop_delete(client->event_handle);
 
-    free(client);
+    espirc_pool_deinit(&client->pool);
+
+#ifdef CONFIG_ESPIRC_SUPPORT_TLS
+#ifdef CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+    if (client->tls_session)
+        esp_tls_free_client_session(client->tls_session);
+#endif
+    espirc_free(client->wbuf);
+#endif
+
+    espirc_state_deinit(client);
+    espirc_capture_free(client);
+    espirc_replay_free(client);
+#ifdef CONFIG_ESPIRC_CAPTURE
+    if (client->capture_lock)
+        vSemaphoreDelete(client->capture_lock);
+#endif
+
+    espirc_sendq_deinit(&client->sendq);
+    espirc_framer_deinit(&client->framer);
+
+    espirc_free(client);
     return ESP_OK;
 }
 
@@ -348,70 +971,94 @@ esp_err_t irc_connect(irc_handle_t client)
 
     ESP_LOGD(TAG, "Host: %s - Port: %d - User: %s - Nick: %s", client->config.host, client->config.port, client->config.user, client->config.nick);
 
-    if (espirc_socket_connect(client) != ESP_OK)
+    /*
+     * Only the lookup happens here, the connection itself is made by the IRC
+     * task (or engine) so that it can't hang the caller. Registration is
+     * queued before the task starts.
+     */
+    client->backoff_ms = client->config.reconnect_min_ms;
+
+    if (espirc_socket_resolve(client) != ESP_OK || irc_start(client) != ESP_OK) {
+        espirc_socket_close(client);
         return ESP_FAIL;
+    }
 
-    ESP_LOGD(TAG, "Socket: %d", client->socket);
+    client->running = true;
 
-    irc_state_set(client, IRC_STATE_CONNECTING);
+    /* The engine picks up the connection once woken up */
+    if (client->config.engine) {
+        irc_wake(client);
+        return ESP_OK;
+    }
 
     if (xTaskCreate(irc_task, "irc_task", client->config.task_stack_size, client,
             client->config.task_priority, &client->task_handle) != pdTRUE) {
         ESP_LOGE(TAG, "Failed to create task");
+        client->running = false;
+        espirc_socket_close(client);
+        espirc_sendq_clear(&client->sendq);
+        irc_state_set(client, IRC_STATE_DISCONNECTED);
         return ESP_FAIL;
     }
 
-    /* If a password is supplied, it must be entered first before registration */
-    if (client->config.pass && strlen(client->config.pass) != 0)
-        irc_sendraw(client, "PASS %s", client->config.pass);
-
-    irc_sendraw(client, "USER %s 0 * :%s", client->config.user, client->config.realname);
-    irc_sendraw(client, "NICK %s", client->config.nick);
-
     return ESP_OK;
 }
 
+/*
+ * Request the IRC task to send QUIT and close the connection, this also stops
+ * reconnecting. IRC_EVENT_DISCONNECTED is posted once the socket has been
+ * closed.
+ */
 esp_err_t irc_disconnect(irc_handle_t client)
 {
-    if (client->state >= IRC_STATE_CONNECTING) {
-        irc_sendraw(client, "QUIT");
-
-        if (espirc_socket_close(client) < 0) {
-            ESP_LOGE(TAG, "Failed to close socket (%s)", esp_err_to_name(errno));
-            return ESP_FAIL;
-        }
-
-        irc_state_set(client, IRC_STATE_DISCONNECTED);
-    } else {
+    if (!client->running && client->state < IRC_STATE_CONNECTING) {
         ESP_LOGE(TAG, "Not connected to IRC");
         return ESP_FAIL;
     }
 
+    if (client->state >= IRC_STATE_CONNECTING)
+        irc_send(client, IRC_SENDQ_URGENT, "QUIT");
+
+    client->closing = true;
+    irc_wake(client);
+
     return ESP_OK;
 }
 
 esp_err_t irc_sendraw(irc_handle_t client, char* fmt, ...)
 {
-    int endofstring;
+    esp_err_t err;
     va_list ap;
+
     va_start(ap, fmt);
-    vsnprintf(client->sbuf, 512, fmt, ap);
-    endofstring = strlen(client->sbuf);
+    err = irc_vsend(client, IRC_SENDQ_BULK, fmt, ap);
     va_end(ap);
 
-    /*
-     * Don't go beyond the buffer.
-     * non-IRCv3 buffer size (according to RFC1459) is 512 bytes (incl. CRLF)
-     */
-    if (endofstring > 510)
+    return err;
+}
+
+esp_err_t irc_get_stats(irc_handle_t client, irc_stats_t *stats)
+{
+    if (!client || !stats)
         return ESP_ERR_INVALID_ARG;
 
-    ESP_LOGD(TAG, "<< %s", client->sbuf);
-    strcpy(client->sbuf+endofstring, "\r\n");
-    if (espirc_socket_write(client, client->sbuf, strlen(client->sbuf)) < 0) {
-        ESP_LOGE(TAG, "Failed to send message (%d)", errno);
+    *stats = client->stats;
+    stats->event_queue_peak = __atomic_load_n(&client->pool.peak, __ATOMIC_RELAXED);
+
+    if (client->config.engine)
+        stats->task_stack_free = espirc_engine_stack_free(client->config.engine);
+
+    espirc_mem_stats(&stats->heap_used, &stats->heap_peak);
+
+    return ESP_OK;
+}
+
+esp_err_t irc_get_sendq_stats(irc_handle_t client, irc_sendq_stats_t *stats)
+{
+    if (!client || !stats)
         return ESP_ERR_INVALID_ARG;
-    }
+
+    espirc_sendq_stats(&client->sendq, stats);
 
     return ESP_OK;
 }
@@ -0,0 +1,303 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * Copyright (c) 2024 Danct12
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+
+#include "espirc.h"
+#include "espirc_mem.h"
+#include "espirc_priv.h"
+#include "espirc_cap.h"
+
+#include "esp_err.h"
+#include "esp_log.h"
+
+#include "mbedtls/base64.h"
+#include "mbedtls/platform_util.h"
+
+static const char* TAG = "espirc_cap";
+
+/* AUTHENTICATE payloads are split into chunks of this size */
+#define IRC_SASL_CHUNK 400
+
+/* Room "AUTHENTICATE <chunk>\r\n" takes in a no-split ring buffer, with its 8 byte header */
+#define IRC_SASL_LINE_COST(len) (8 + ((13 + (len) + 2 + 3) & ~(size_t) 3))
+
+static const char *espirc_sasl_mechanism(irc_sasl_mechanism_t mechanism)
+{
+    switch (mechanism) {
+        case IRC_SASL_PLAIN:
+            return "PLAIN";
+        case IRC_SASL_EXTERNAL:
+            return "EXTERNAL";
+        default:
+            return NULL;
+    }
+}
+
+/* Find the next token of a space separated list */
+static const char *espirc_cap_next(const char *list, size_t *len)
+{
+    list += strspn(list, " ");
+    *len = strcspn(list, " ");
+
+    return *len ? list : NULL;
+}
+
+/* Whether a comma separated list (e.g. the value of "sasl=") has the word */
+static bool espirc_cap_has_value(const char *list, size_t list_len, const char *word)
+{
+    size_t word_len = strlen(word), len;
+
+    while (list_len) {
+        len = 0;
+        while (len < list_len && list[len] != ',') len++;
+
+        if (len == word_len && !memcmp(list, word, len))
+            return true;
+
+        list += MIN(len + 1, list_len);
+        list_len -= MIN(len + 1, list_len);
+    }
+
+    return false;
+}
+
+/*
+ * Start capability negotiation, if there's anything to negotiate. The server
+ * holds off registration until CAP END, so the rest of the registration can
+ * be pipelined right after.
+ */
+void espirc_cap_start(irc_handle_t client)
+{
+    client->cap_offered = 0;
+    client->sasl_offered = false;
+
+    if (!client->config.sasl_mechanism && (!client->config.caps || !*client->config.caps)) {
+        client->cap_state = IRC_CAP_DONE;
+        return;
+    }
+
+    client->cap_state = IRC_CAP_LS;
+    irc_send(client, IRC_SENDQ_URGENT, "CAP LS 302");
+}
+
+static void espirc_cap_end(irc_handle_t client)
+{
+    client->cap_state = IRC_CAP_DONE;
+    irc_send(client, IRC_SENDQ_URGENT, "CAP END");
+}
+
+/* Give up on SASL when our side of the exchange couldn't be queued */
+static void espirc_sasl_abort(irc_handle_t client, esp_err_t err)
+{
+    ESP_LOGE(TAG, "Failed to queue SASL authentication (%s), aborting", esp_err_to_name(err));
+    irc_send(client, IRC_SENDQ_URGENT, "AUTHENTICATE *");
+    espirc_cap_end(client);
+}
+
+/* Note which of the wanted capabilities are in a CAP LS reply */
+static void espirc_cap_ls(irc_handle_t client, const char *list)
+{
+    const char *cap, *wanted, *mechanism;
+    size_t len, name_len, wanted_len;
+    int i;
+
+    mechanism = espirc_sasl_mechanism(client->config.sasl_mechanism);
+
+    for (; (cap = espirc_cap_next(list, &len)); list = cap + len) {
+        /* With CAP LS 302, capabilities may come with a value */
+        for (name_len = 0; name_len < len && cap[name_len] != '='; name_len++);
+
+        if (mechanism && name_len == 4 && !memcmp(cap, "sasl", 4)) {
+            client->sasl_offered = name_len == len ||
+                espirc_cap_has_value(cap + name_len + 1, len - name_len - 1, mechanism);
+            continue;
+        }
+
+        if (!client->config.caps)
+            continue;
+
+        wanted = client->config.caps;
+        for (i = 0; i < IRC_CAP_WANTED_MAX && (wanted = espirc_cap_next(wanted, &wanted_len));
+                i++, wanted += wanted_len) {
+            if (wanted_len == name_len && !memcmp(wanted, cap, name_len))
+                client->cap_offered |= 1UL << i;
+        }
+    }
+}
+
+/*
+ * Request everything that was offered. Each capability gets its own CAP REQ
+ * so that one rejection doesn't take down the rest. The SASL exchange is
+ * started right away rather than waiting for the ACK, it only fails if the
+ * request is rejected.
+ */
+static void espirc_cap_request(irc_handle_t client)
+{
+    const char *wanted = client->config.caps;
+    esp_err_t err;
+    size_t len;
+
+    for (int i = 0; wanted && i < IRC_CAP_WANTED_MAX && (wanted = espirc_cap_next(wanted, &len));
+            i++, wanted += len) {
+        if (client->cap_offered & (1UL << i))
+            irc_send(client, IRC_SENDQ_URGENT, "CAP REQ :%.*s", (int) len, wanted);
+    }
+
+    if (!client->sasl_offered) {
+        if (client->config.sasl_mechanism)
+            ESP_LOGW(TAG, "Server doesn't support SASL %s",
+                espirc_sasl_mechanism(client->config.sasl_mechanism));
+
+        espirc_cap_end(client);
+        return;
+    }
+
+    client->cap_state = IRC_CAP_SASL;
+
+    err = irc_send(client, IRC_SENDQ_URGENT, "CAP REQ :sasl");
+    if (err == ESP_OK)
+        err = irc_send(client, IRC_SENDQ_URGENT, "AUTHENTICATE %s",
+            espirc_sasl_mechanism(client->config.sasl_mechanism));
+
+    if (err != ESP_OK)
+        espirc_sasl_abort(client, err);
+}
+
+/* Answer the server's "AUTHENTICATE +" with our credentials */
+static void espirc_sasl_respond(irc_handle_t client)
+{
+    size_t user_len, pass_len, raw_len, out_len, olen;
+    esp_err_t err = ESP_OK;
+    unsigned char *raw;
+    char *out;
+
+    /* With EXTERNAL, the client certificate of the TLS session is used */
+    if (client->config.sasl_mechanism == IRC_SASL_EXTERNAL) {
+        err = irc_send(client, IRC_SENDQ_URGENT, "AUTHENTICATE +");
+        if (err != ESP_OK)
+            espirc_sasl_abort(client, err);
+        return;
+    }
+
+    /* PLAIN: authzid NUL authcid NUL passwd, the authzid is left empty */
+    user_len = strlen(client->config.sasl_user);
+    pass_len = strlen(client->config.sasl_pass);
+    raw_len = user_len + pass_len + 2;
+    out_len = (raw_len + 2) / 3 * 4 + 1;
+
+    raw = espirc_malloc(raw_len + out_len);
+    if (!raw) {
+        ESP_LOGE(TAG, "Failed to allocate memory");
+        irc_send(client, IRC_SENDQ_URGENT, "AUTHENTICATE *");
+        return;
+    }
+
+    out = (char *) raw + raw_len;
+
+    raw[0] = '\0';
+    memcpy(raw + 1, client->config.sasl_user, user_len);
+    raw[user_len + 1] = '\0';
+    memcpy(raw + user_len + 2, client->config.sasl_pass, pass_len);
+
+    mbedtls_base64_encode((unsigned char *) out, out_len, &olen, raw, raw_len);
+
+    for (size_t off = 0; err == ESP_OK && off < olen; off += IRC_SASL_CHUNK)
+        err = irc_send(client, IRC_SENDQ_URGENT, "AUTHENTICATE %.*s",
+            (int) MIN(olen - off, IRC_SASL_CHUNK), out + off);
+
+    /* A payload ending on a full chunk needs an empty one to terminate it */
+    if (err == ESP_OK && olen % IRC_SASL_CHUNK == 0)
+        err = irc_send(client, IRC_SENDQ_URGENT, "AUTHENTICATE +");
+
+    mbedtls_platform_zeroize(raw, raw_len + out_len);
+    espirc_free(raw);
+
+    if (err != ESP_OK)
+        espirc_sasl_abort(client, err);
+}
+
+/*
+ * Room our side of a PLAIN exchange takes in the urgent lane, where it's
+ * queued all at once on top of whatever else is waiting there
+ */
+size_t espirc_cap_urgent_size(const irc_config_t *config)
+{
+    size_t olen, size = 0;
+
+    if (config->sasl_mechanism != IRC_SASL_PLAIN)
+        return 0;
+
+    olen = (strlen(config->sasl_user) + strlen(config->sasl_pass) + 2 + 2) / 3 * 4;
+
+    /* Up to and incl. the empty chunk after a payload ending on a full one */
+    for (size_t off = 0; off <= olen; off += IRC_SASL_CHUNK)
+        size += IRC_SASL_LINE_COST(MAX(MIN(olen - off, IRC_SASL_CHUNK), 1));
+
+    return size;
+}
+
+/*
+ * Handle capability negotiation and SASL replies during registration.
+ * Returns true if the message was consumed.
+ */
+bool espirc_cap_handle(irc_handle_t client, irc_message_t *msg)
+{
+    const char *trailing;
+
+    if (client->cap_state == IRC_CAP_DONE || !msg->params_count)
+        return false;
+
+    trailing = msg->params[msg->params_count - 1];
+
+    switch (msg->verb_id) {
+        case IRC_VERB_CAP:
+            if (msg->params_count < 3)
+                return true;
+
+            if (!strcmp(msg->params[1], "LS") && client->cap_state == IRC_CAP_LS) {
+                espirc_cap_ls(client, trailing);
+
+                /* "CAP * LS * :..." means more lines are coming */
+                if (msg->params_count < 4 || strcmp(msg->params[2], "*"))
+                    espirc_cap_request(client);
+            } else if (!strcmp(msg->params[1], "ACK")) {
+                ESP_LOGI(TAG, "Enabled capabilities: %s", trailing);
+            } else if (!strcmp(msg->params[1], "NAK")) {
+                ESP_LOGW(TAG, "Rejected capabilities: %s", trailing);
+
+                /* Without the capability, AUTHENTICATE won't get anywhere */
+                if (client->cap_state == IRC_CAP_SASL && !strcmp(trailing, "sasl"))
+                    espirc_cap_end(client);
+            }
+            return true;
+        case IRC_VERB_AUTHENTICATE:
+            if (client->cap_state == IRC_CAP_SASL && !strcmp(msg->params[0], "+"))
+                espirc_sasl_respond(client);
+            return true;
+        case IRC_RPL_LOGGEDIN:
+            ESP_LOGI(TAG, "Logged in (%s)", trailing);
+            return true;
+        case IRC_RPL_SASLSUCCESS:
+            espirc_cap_end(client);
+            return true;
+        case IRC_ERR_NICKLOCKED:
+        case IRC_ERR_SASLFAIL:
+        case IRC_ERR_SASLTOOLONG:
+        case IRC_ERR_SASLABORTED:
+        case IRC_ERR_SASLALREADY:
+            ESP_LOGE(TAG, "SASL authentication failed (%s)", trailing);
+            espirc_cap_end(client);
+            return true;
+        case IRC_RPL_SASLMECHS:
+            ESP_LOGW(TAG, "Available SASL mechanisms: %s", msg->params_count > 1 ?
+                msg->params[1] : trailing);
+            return true;
+        default:
+            return false;
+    }
+}
@@ -0,0 +1,26 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * Copyright (c) 2024 Danct12
+ */
+
+#ifndef __ESPIRC_CAP_H__
+#define __ESPIRC_CAP_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "espirc.h"
+
+/* Capabilities of irc_config_t.caps that can be tracked */
+#define IRC_CAP_WANTED_MAX 32
+
+typedef enum {
+    IRC_CAP_DONE,
+    IRC_CAP_LS,
+    IRC_CAP_SASL,
+} irc_cap_state_t;
+
+void espirc_cap_start(irc_handle_t client);
+bool espirc_cap_handle(irc_handle_t client, irc_message_t *message);
+size_t espirc_cap_urgent_size(const irc_config_t *config);
+#endif
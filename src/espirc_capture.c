@@ -0,0 +1,503 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * Copyright (c) 2024 Danct12
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/param.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "espirc.h"
+#include "espirc_capture.h"
+#include "espirc_mem.h"
+#include "espirc_priv.h"
+
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+static const char* TAG = "espirc_capture";
+
+#ifdef CONFIG_ESPIRC_CAPTURE
+/*
+ * Records go either straight to a file, or into a ring which drops the
+ * oldest records to make room for new ones.
+ */
+struct espirc_capture {
+    bool active;
+    FILE *file;
+    int64_t last;
+
+    uint8_t *ring;
+    size_t ring_size;
+    size_t head;
+    size_t len;
+    uint32_t dropped;
+};
+
+/*
+ * The next record is read ahead, its data is only read once it's due and
+ * goes straight into the receive buffer.
+ */
+struct espirc_replay {
+    FILE *file;
+    uint32_t speed;
+
+    bool have;
+    bool eof;
+    uint8_t type;
+    uint32_t len;
+    int64_t due;
+    int64_t last;
+};
+
+static size_t espirc_capture_varint(uint8_t *p, uint64_t value)
+{
+    size_t n = 0;
+
+    do {
+        p[n++] = (value & 0x7f) | (value > 0x7f ? 0x80 : 0);
+        value >>= 7;
+    } while (value);
+
+    return n;
+}
+
+/*
+ * RAM ring
+ */
+
+static void espirc_capture_ring_write(espirc_capture_t *cap, const void *data, size_t len)
+{
+    size_t pos = (cap->head + cap->len) % cap->ring_size;
+    size_t first = MIN(len, cap->ring_size - pos);
+
+    memcpy(cap->ring + pos, data, first);
+    memcpy(cap->ring, (const uint8_t *) data + first, len - first);
+    cap->len += len;
+}
+
+static uint64_t espirc_capture_ring_varint(espirc_capture_t *cap, size_t *off)
+{
+    uint64_t value = 0;
+    uint8_t byte;
+    int shift = 0;
+
+    do {
+        byte = cap->ring[(cap->head + (*off)++) % cap->ring_size];
+        value |= (uint64_t) (byte & 0x7f) << shift;
+        shift += 7;
+    } while (byte & 0x80 && shift < 70);
+
+    return value;
+}
+
+/* Drop the oldest record */
+static void espirc_capture_ring_evict(espirc_capture_t *cap)
+{
+    size_t off = 1;
+    uint32_t len;
+
+    espirc_capture_ring_varint(cap, &off);
+    len = espirc_capture_ring_varint(cap, &off);
+    off += len;
+
+    cap->head = (cap->head + off) % cap->ring_size;
+    cap->len -= off;
+}
+
+void espirc_capture_record(irc_handle_t client, irc_capture_type_t type,
+                            const struct iovec *iov, int iovcnt)
+{
+    uint8_t header[IRC_CAPTURE_HEADER_MAX];
+    espirc_capture_t *cap;
+    size_t header_len, len = 0;
+    int64_t now;
+
+    if (!__atomic_load_n(&client->capture, __ATOMIC_RELAXED))
+        return;
+
+    for (int i = 0; i < iovcnt; i++)
+        len += iov[i].iov_len;
+
+    xSemaphoreTake(client->capture_lock, portMAX_DELAY);
+
+    cap = client->capture;
+    if (!cap || !cap->active)
+        goto out;
+
+    now = esp_timer_get_time();
+
+    header[0] = type;
+    header_len = 1;
+    header_len += espirc_capture_varint(header + header_len, cap->last ? now - cap->last : 0);
+    header_len += espirc_capture_varint(header + header_len, len);
+
+    if (cap->file) {
+        fwrite(header, 1, header_len, cap->file);
+        for (int i = 0; i < iovcnt; i++)
+            fwrite(iov[i].iov_base, 1, iov[i].iov_len, cap->file);
+    } else {
+        if (header_len + len > cap->ring_size) {
+            cap->dropped++;
+            goto out;
+        }
+
+        while (cap->ring_size - cap->len < header_len + len)
+            espirc_capture_ring_evict(cap);
+
+        espirc_capture_ring_write(cap, header, header_len);
+        for (int i = 0; i < iovcnt; i++)
+            espirc_capture_ring_write(cap, iov[i].iov_base, iov[i].iov_len);
+    }
+
+    cap->last = now;
+
+out:
+    xSemaphoreGive(client->capture_lock);
+}
+
+/* Called with the capture lock held, or once the client is gone */
+static void espirc_capture_close(espirc_capture_t *cap)
+{
+    if (cap->file) {
+        fclose(cap->file);
+        cap->file = NULL;
+    }
+
+    cap->active = false;
+}
+
+void espirc_capture_free(irc_handle_t client)
+{
+    if (!client->capture)
+        return;
+
+    espirc_capture_close(client->capture);
+    espirc_free(client->capture->ring);
+    espirc_free(client->capture);
+    client->capture = NULL;
+}
+
+static esp_err_t espirc_capture_header(FILE *file)
+{
+    uint8_t version = IRC_CAPTURE_VERSION;
+
+    if (fwrite(IRC_CAPTURE_MAGIC, 1, 4, file) != 4 || fwrite(&version, 1, 1, file) != 1)
+        return ESP_FAIL;
+
+    return ESP_OK;
+}
+
+esp_err_t irc_capture_start(irc_handle_t client, const irc_capture_config_t *config)
+{
+    espirc_capture_t *cap;
+
+    if (!client || !config || (!config->path && !config->ram_size))
+        return ESP_ERR_INVALID_ARG;
+
+    cap = espirc_calloc(1, sizeof(*cap));
+    if (!cap)
+        return ESP_ERR_NO_MEM;
+
+    if (config->path) {
+        cap->file = fopen(config->path, "wb");
+        if (!cap->file || espirc_capture_header(cap->file) != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to open %s (%d)", config->path, errno);
+            if (cap->file)
+                fclose(cap->file);
+            espirc_free(cap);
+            return ESP_FAIL;
+        }
+    } else {
+        cap->ring = espirc_malloc(config->ram_size);
+        if (!cap->ring) {
+            espirc_free(cap);
+            return ESP_ERR_NO_MEM;
+        }
+
+        cap->ring_size = config->ram_size;
+    }
+
+    cap->active = true;
+
+    /* Replaces the previous capture, if any */
+    xSemaphoreTake(client->capture_lock, portMAX_DELAY);
+    espirc_capture_free(client);
+    __atomic_store_n(&client->capture, cap, __ATOMIC_RELAXED);
+    xSemaphoreGive(client->capture_lock);
+
+    return ESP_OK;
+}
+
+esp_err_t irc_capture_stop(irc_handle_t client)
+{
+    if (!client)
+        return ESP_ERR_INVALID_ARG;
+
+    xSemaphoreTake(client->capture_lock, portMAX_DELAY);
+    if (client->capture)
+        espirc_capture_close(client->capture);
+    xSemaphoreGive(client->capture_lock);
+
+    return ESP_OK;
+}
+
+esp_err_t irc_capture_save(irc_handle_t client, const char *path)
+{
+    espirc_capture_t *cap;
+    esp_err_t err = ESP_OK;
+    size_t first;
+    FILE *file;
+
+    if (!client || !path)
+        return ESP_ERR_INVALID_ARG;
+
+    file = fopen(path, "wb");
+    if (!file) {
+        ESP_LOGE(TAG, "Failed to open %s (%d)", path, errno);
+        return ESP_FAIL;
+    }
+
+    xSemaphoreTake(client->capture_lock, portMAX_DELAY);
+
+    cap = client->capture;
+    if (!cap || !cap->ring) {
+        err = ESP_ERR_INVALID_STATE;
+        goto out;
+    }
+
+    if (cap->dropped)
+        ESP_LOGW(TAG, "%" PRIu32 " records didn't fit the ring", cap->dropped);
+
+    first = MIN(cap->len, cap->ring_size - cap->head);
+    if (espirc_capture_header(file) != ESP_OK ||
+            fwrite(cap->ring + cap->head, 1, first, file) != first ||
+            fwrite(cap->ring, 1, cap->len - first, file) != cap->len - first)
+        err = ESP_FAIL;
+
+out:
+    xSemaphoreGive(client->capture_lock);
+
+    if (fclose(file) && err == ESP_OK)
+        err = ESP_FAIL;
+
+    return err;
+}
+
+/*
+ * Replay
+ */
+
+static bool espirc_replay_varint(FILE *file, uint64_t *value)
+{
+    int byte, shift = 0;
+
+    *value = 0;
+
+    do {
+        byte = fgetc(file);
+        if (byte == EOF || shift >= 70)
+            return false;
+
+        *value |= (uint64_t) (byte & 0x7f) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+
+    return true;
+}
+
+/* Read the header of the next record, unless it was already */
+static bool espirc_replay_next(espirc_replay_t *replay)
+{
+    uint64_t delta, len;
+    int type;
+
+    if (replay->have)
+        return true;
+
+    if (replay->eof)
+        return false;
+
+    type = fgetc(replay->file);
+    if (type == EOF || !espirc_replay_varint(replay->file, &delta) ||
+            !espirc_replay_varint(replay->file, &len) || len > UINT32_MAX) {
+        replay->eof = true;
+        return false;
+    }
+
+    replay->type = type;
+    replay->len = len;
+    replay->due = replay->last + (replay->speed ? delta / replay->speed : 0);
+    replay->last = replay->due;
+    replay->have = true;
+
+    return true;
+}
+
+/* Skip over records that don't feed the client, as they come due */
+static void espirc_replay_skip(espirc_replay_t *replay, int64_t now)
+{
+    while (espirc_replay_next(replay) && replay->due <= now &&
+            replay->type != IRC_CAPTURE_RX && replay->type != IRC_CAPTURE_CLOSE &&
+            replay->type != IRC_CAPTURE_CONNECT) {
+        fseek(replay->file, replay->len, SEEK_CUR);
+        replay->have = false;
+    }
+}
+
+esp_err_t espirc_replay_connect(irc_handle_t client)
+{
+    espirc_replay_t *replay = client->replay;
+
+    replay->last = esp_timer_get_time();
+
+    if (!espirc_replay_next(replay)) {
+        ESP_LOGI(TAG, "End of the recording");
+
+        /* Nothing left to reconnect to, stop as if irc_disconnect() was called */
+        if (client->running)
+            client->closing = true;
+        return ESP_FAIL;
+    }
+
+    /* A ring capture may start in the middle of a connection */
+    if (replay->type == IRC_CAPTURE_CONNECT)
+        replay->have = false;
+    else
+        replay->due = replay->last;
+
+    return ESP_OK;
+}
+
+ssize_t espirc_replay_pending(irc_handle_t client)
+{
+    espirc_replay_t *replay = client->replay;
+
+    espirc_replay_skip(replay, esp_timer_get_time());
+
+    /* The end of the connection reads as the server closing it */
+    if (!replay->have)
+        return 1;
+
+    if (replay->due > esp_timer_get_time())
+        return 0;
+
+    return replay->type == IRC_CAPTURE_RX ? replay->len : 1;
+}
+
+/* How long until the next record is due, negative if there's none */
+int64_t espirc_replay_wait(irc_handle_t client)
+{
+    espirc_replay_t *replay = client->replay;
+
+    if (espirc_replay_pending(client) > 0)
+        return 0;
+
+    return replay->due - esp_timer_get_time();
+}
+
+ssize_t espirc_replay_recv(irc_handle_t client, void *buf, size_t buf_len)
+{
+    espirc_replay_t *replay = client->replay;
+    size_t len;
+
+    if (espirc_replay_pending(client) <= 0) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    if (!replay->have || replay->type == IRC_CAPTURE_CONNECT)
+        return 0;
+
+    if (replay->type == IRC_CAPTURE_CLOSE) {
+        replay->have = false;
+        return 0;
+    }
+
+    len = fread(buf, 1, MIN(buf_len, replay->len), replay->file);
+    if (!len) {
+        replay->eof = true;
+        replay->have = false;
+        return 0;
+    }
+
+    replay->len -= len;
+    if (!replay->len)
+        replay->have = false;
+
+    return len;
+}
+
+void espirc_replay_free(irc_handle_t client)
+{
+    if (!client->replay)
+        return;
+
+    fclose(client->replay->file);
+    espirc_free(client->replay);
+    client->replay = NULL;
+}
+
+esp_err_t irc_replay_set(irc_handle_t client, const irc_replay_config_t *config)
+{
+    espirc_replay_t *replay;
+    char magic[5];
+
+    if (!client || !config || (!config->path && !config->data))
+        return ESP_ERR_INVALID_ARG;
+
+    if (client->running)
+        return ESP_ERR_INVALID_STATE;
+
+    replay = espirc_calloc(1, sizeof(*replay));
+    if (!replay)
+        return ESP_ERR_NO_MEM;
+
+    if (config->path)
+        replay->file = fopen(config->path, "rb");
+    else
+        replay->file = fmemopen((void *) config->data, config->size, "rb");
+
+    if (!replay->file || fread(magic, 1, 5, replay->file) != 5 ||
+            memcmp(magic, IRC_CAPTURE_MAGIC, 4) || magic[4] != IRC_CAPTURE_VERSION) {
+        ESP_LOGE(TAG, "Not a capture (version %d)", IRC_CAPTURE_VERSION);
+        if (replay->file)
+            fclose(replay->file);
+        espirc_free(replay);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    replay->speed = config->speed;
+
+    espirc_replay_free(client);
+    client->replay = replay;
+
+    return ESP_OK;
+}
+#else
+esp_err_t irc_capture_start(irc_handle_t client, const irc_capture_config_t *config)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t irc_capture_stop(irc_handle_t client)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t irc_capture_save(irc_handle_t client, const char *path)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t irc_replay_set(irc_handle_t client, const irc_replay_config_t *config)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+#endif
@@ -0,0 +1,63 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * Copyright (c) 2024 Danct12
+ */
+
+#ifndef __ESPIRC_CAPTURE_H__
+#define __ESPIRC_CAPTURE_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/select.h>
+#include <sys/uio.h>
+
+#include "sdkconfig.h"
+
+#include "espirc.h"
+
+/*
+ * Capture format
+ *
+ *   capture := "ECAP" version:u8 record*
+ *   record  := type:u8 delta:varint length:varint data[length]
+ *
+ * delta is the time since the previous record in microseconds, as a 64-bit
+ * value so that long quiet spells don't wrap. varints are LEB128, length
+ * fits in 32 bits. Connect and close records carry no data.
+ */
+#define IRC_CAPTURE_MAGIC "ECAP"
+#define IRC_CAPTURE_VERSION 1
+
+typedef enum {
+    IRC_CAPTURE_CONNECT = 'C',
+    IRC_CAPTURE_RX = 'R',
+    IRC_CAPTURE_TX = 'T',
+    IRC_CAPTURE_CLOSE = 'X',
+} irc_capture_type_t;
+
+/* Longest record header: a type, a 64-bit and a 32-bit varint */
+#define IRC_CAPTURE_HEADER_MAX (1 + 10 + 5)
+
+#ifdef CONFIG_ESPIRC_CAPTURE
+typedef struct espirc_capture espirc_capture_t;
+typedef struct espirc_replay espirc_replay_t;
+
+/* Tap, called by the socket layer */
+void espirc_capture_record(irc_handle_t client, irc_capture_type_t type,
+                            const struct iovec *iov, int iovcnt);
+void espirc_capture_free(irc_handle_t client);
+
+/* Replay backend, stands in for the socket when irc_replay_set() was used */
+esp_err_t espirc_replay_connect(irc_handle_t client);
+ssize_t espirc_replay_pending(irc_handle_t client);
+ssize_t espirc_replay_recv(irc_handle_t client, void *buf, size_t buf_len);
+int64_t espirc_replay_wait(irc_handle_t client);
+void espirc_replay_free(irc_handle_t client);
+#else
+static inline void espirc_capture_record(irc_handle_t client, irc_capture_type_t type,
+                                        const struct iovec *iov, int iovcnt) {}
+static inline void espirc_capture_free(irc_handle_t client) {}
+static inline void espirc_replay_free(irc_handle_t client) {}
+#endif
+#endif
@@ -0,0 +1,17 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * Copyright (c) 2024 Danct12
+ */
+
+#ifndef __ESPIRC_CASEMAP_H__
+#define __ESPIRC_CASEMAP_H__
+
+/* RFC 1459 casemapping: {}|~ are the lowercase forms of []\^ */
+static inline char irc_tolower(char c)
+{
+    if ((c >= 'A' && c <= 'Z') || c == '[' || c == ']' || c == '\\' || c == '^')
+        return c + 32;
+
+    return c;
+}
+#endif
@@ -0,0 +1,221 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * Copyright (c) 2024 Danct12
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/select.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+#include "espirc.h"
+#include "espirc_mem.h"
+#include "espirc_priv.h"
+#include "espirc_engine.h"
+
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+static const char* TAG = "espirc_engine";
+
+struct irc_engine {
+    irc_engine_config_t config;
+    bool running;
+
+    /* Protects the client list, held while clients are serviced */
+    SemaphoreHandle_t lock;
+    irc_handle_t clients;
+
+    int wake_fd;
+    TaskHandle_t task_handle;
+    SemaphoreHandle_t done;
+    uint32_t stack_free;
+};
+
+/* Close the clients whose descriptors went bad, returns whether there were any */
+static bool irc_engine_drop_bad(irc_engine_handle_t engine)
+{
+    irc_handle_t client;
+    bool found = false;
+
+    xSemaphoreTakeRecursive(engine->lock, portMAX_DELAY);
+    for (client = engine->clients; client; client = client->engine_next) {
+        if (client->running && !espirc_socket_valid(client)) {
+            ESP_LOGE(TAG, "Socket of %s went bad, closing", client->config.nick);
+            irc_io_close(client);
+            found = true;
+        }
+    }
+    xSemaphoreGiveRecursive(engine->lock);
+
+    return found;
+}
+
+/*
+ * Wait on the sockets of every connected client at once and service them on
+ * this single task. Handlers run while the client list is locked, so they
+ * must not create or destroy clients of the same engine.
+ */
+static void irc_engine_task(void* args)
+{
+    irc_engine_handle_t engine = (irc_engine_handle_t) args;
+    irc_handle_t client;
+    int64_t wait, now, stack_at = 0;
+    uint64_t count;
+    fd_set rfds, wfds;
+    int maxfd;
+
+    ESP_LOGD(TAG, "Task started.");
+
+    while (engine->running) {
+        FD_ZERO(&rfds);
+        FD_ZERO(&wfds);
+        FD_SET(engine->wake_fd, &rfds);
+        maxfd = engine->wake_fd;
+        wait = -1;
+
+        xSemaphoreTakeRecursive(engine->lock, portMAX_DELAY);
+        for (client = engine->clients; client; client = client->engine_next) {
+            if (client->running)
+                irc_io_prepare(client, &rfds, &wfds, &maxfd, &wait);
+        }
+        xSemaphoreGiveRecursive(engine->lock);
+
+        if (irc_io_select(maxfd, &rfds, &wfds, wait) < 0) {
+            /* A descriptor that went bad fails every select(), close its client */
+            if (errno == EBADF && irc_engine_drop_bad(engine))
+                continue;
+
+            vTaskDelay(pdMS_TO_TICKS(100));
+            continue;
+        }
+
+        if (FD_ISSET(engine->wake_fd, &rfds))
+            read(engine->wake_fd, &count, sizeof(count));
+
+        xSemaphoreTakeRecursive(engine->lock, portMAX_DELAY);
+        for (client = engine->clients; client; client = client->engine_next) {
+            if (client->running && !irc_io_service(client, &rfds, &wfds))
+                irc_io_close(client);
+        }
+        xSemaphoreGiveRecursive(engine->lock);
+
+        now = esp_timer_get_time();
+        if (now >= stack_at) {
+            engine->stack_free = uxTaskGetStackHighWaterMark(NULL);
+            stack_at = now + IRC_STACK_SAMPLE_US;
+        }
+    }
+
+    ESP_LOGD(TAG, "Task end.");
+    xSemaphoreGive(engine->done);
+    vTaskDelete(NULL);
+}
+
+irc_engine_handle_t irc_engine_create(irc_engine_config_t config)
+{
+    irc_engine_handle_t engine;
+
+    if (!config.task_stack_size)
+        config.task_stack_size = 4096;
+
+    if (!config.task_priority)
+        config.task_priority = tskIDLE_PRIORITY;
+
+    engine = espirc_calloc(1, sizeof(struct irc_engine));
+    if (!engine) {
+        ESP_LOGE(TAG, "Failed to allocate memory");
+        return NULL;
+    }
+
+    engine->config = config;
+    engine->running = true;
+
+    engine->lock = xSemaphoreCreateRecursiveMutex();
+    engine->done = xSemaphoreCreateBinary();
+    if (!engine->lock || !engine->done)
+        goto engine_failure;
+
+    engine->wake_fd = irc_wake_fd_create();
+    if (engine->wake_fd < 0)
+        goto engine_failure;
+
+    if (xTaskCreate(irc_engine_task, "irc_engine", config.task_stack_size, engine,
+            config.task_priority, &engine->task_handle) != pdTRUE) {
+        ESP_LOGE(TAG, "Failed to create task");
+        close(engine->wake_fd);
+        goto engine_failure;
+    }
+
+    return engine;
+
+engine_failure:
+    if (engine->lock)
+        vSemaphoreDelete(engine->lock);
+    if (engine->done)
+        vSemaphoreDelete(engine->done);
+    espirc_free(engine);
+    return NULL;
+}
+
+/* Every client has to be destroyed before the engine */
+esp_err_t irc_engine_destroy(irc_engine_handle_t engine)
+{
+    uint64_t count = 1;
+
+    if (!engine)
+        return ESP_ERR_INVALID_ARG;
+
+    if (engine->clients) {
+        ESP_LOGE(TAG, "Engine still has clients");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    engine->running = false;
+    write(engine->wake_fd, &count, sizeof(count));
+    xSemaphoreTake(engine->done, portMAX_DELAY);
+
+    close(engine->wake_fd);
+    vSemaphoreDelete(engine->lock);
+    vSemaphoreDelete(engine->done);
+    espirc_free(engine);
+
+    return ESP_OK;
+}
+
+uint32_t espirc_engine_stack_free(irc_engine_handle_t engine)
+{
+    return engine->stack_free;
+}
+
+esp_err_t espirc_engine_attach(irc_engine_handle_t engine, irc_handle_t client)
+{
+    xSemaphoreTakeRecursive(engine->lock, portMAX_DELAY);
+    client->wake_fd = engine->wake_fd;
+    client->engine_next = engine->clients;
+    engine->clients = client;
+    xSemaphoreGiveRecursive(engine->lock);
+
+    return ESP_OK;
+}
+
+void espirc_engine_detach(irc_engine_handle_t engine, irc_handle_t client)
+{
+    irc_handle_t *node;
+
+    xSemaphoreTakeRecursive(engine->lock, portMAX_DELAY);
+    for (node = &engine->clients; *node; node = &(*node)->engine_next) {
+        if (*node == client) {
+            *node = client->engine_next;
+            break;
+        }
+    }
+    xSemaphoreGiveRecursive(engine->lock);
+
+    client->wake_fd = -1;
+}
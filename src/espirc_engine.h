@@ -0,0 +1,15 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * Copyright (c) 2024 Danct12
+ */
+
+#ifndef __ESPIRC_ENGINE_H__
+#define __ESPIRC_ENGINE_H__
+
+#include "espirc.h"
+#include "esp_err.h"
+
+esp_err_t espirc_engine_attach(irc_engine_handle_t engine, irc_handle_t client);
+void espirc_engine_detach(irc_engine_handle_t engine, irc_handle_t client);
+uint32_t espirc_engine_stack_free(irc_engine_handle_t engine);
+#endif
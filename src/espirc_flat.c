@@ -0,0 +1,158 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * Copyright (c) 2024 Danct12
+ */
+
+#include <string.h>
+
+#include "espirc.h"
+
+#include "esp_err.h"
+
+#define FLAT_STRING(flat, offset) \
+    ((offset) == IRC_FLAT_NONE ? NULL : (flat)->data + (offset))
+
+/* Bytes needed to flatten a message */
+size_t irc_message_flat_size(const irc_message_t *message)
+{
+    size_t size = sizeof(irc_flat_message_t);
+
+    /* A parsed message takes its line as is, fields and all */
+    if (message->line)
+        return size + message->line_len + 1;
+
+    if (message->tags)
+        size += strlen(message->tags) + 1;
+
+    if (message->source)
+        size += strlen(message->source) + 1;
+
+    size += strlen(message->verb) + 1;
+
+    for (int i = 0; i < message->params_count; i++)
+        size += strlen(message->params[i]) + 1;
+
+    return size;
+}
+
+/* Offset of a field, either in the copied line or appended after the others */
+static uint16_t irc_flat_put(irc_flat_message_t *flat, const irc_message_t *message,
+                                size_t *offset, const char *str)
+{
+    size_t len;
+    uint16_t start = *offset;
+
+    if (!str)
+        return IRC_FLAT_NONE;
+
+    if (message->line)
+        return str - message->line;
+
+    len = strlen(str) + 1;
+    memcpy(flat->data + start, str, len);
+    *offset += len;
+
+    return start;
+}
+
+/*
+ * Pack a message into a buffer of at least irc_message_flat_size() bytes.
+ * The line a message was parsed from is copied at once and the fields become
+ * offsets into it, the fields of one put together by hand are copied one
+ * after another. The result doesn't reference the original message in any
+ * way.
+ */
+esp_err_t irc_message_flatten(const irc_message_t *message, irc_flat_message_t *flat, size_t size)
+{
+    size_t needed, offset = 0;
+
+    if (!message || !message->verb || !flat)
+        return ESP_ERR_INVALID_ARG;
+
+    needed = irc_message_flat_size(message);
+    if (needed > size || needed > UINT16_MAX)
+        return ESP_ERR_INVALID_SIZE;
+
+    flat->size = needed;
+    flat->verb_id = message->verb_id;
+    flat->params_count = message->params_count;
+    flat->colon = message->colon;
+    flat->source_user = message->source_user;
+    flat->source_host = message->source_host;
+
+    if (message->line)
+        memcpy(flat->data, message->line, message->line_len + 1);
+
+    flat->tags = irc_flat_put(flat, message, &offset, message->tags);
+    flat->source = irc_flat_put(flat, message, &offset, message->source);
+    flat->verb = irc_flat_put(flat, message, &offset, message->verb);
+    for (int i = 0; i < message->params_count; i++)
+        flat->params[i] = irc_flat_put(flat, message, &offset, message->params[i]);
+
+    return ESP_OK;
+}
+
+/*
+ * Fill in a message pointing into the flat message, e.g. to pass it to code
+ * that expects an irc_message_t. Nothing is copied.
+ */
+esp_err_t irc_flat_to_message(const irc_flat_message_t *flat, irc_message_t *message)
+{
+    if (!flat || !message || flat->params_count > IRC_MESSAGE_PARAMS_MAX)
+        return ESP_ERR_INVALID_ARG;
+
+    message->tags = (char *) FLAT_STRING(flat, flat->tags);
+    message->source = (char *) FLAT_STRING(flat, flat->source);
+    message->source_user = flat->source_user;
+    message->source_host = flat->source_host;
+    message->verb = (char *) FLAT_STRING(flat, flat->verb);
+    message->verb_id = flat->verb_id;
+    message->params_count = flat->params_count;
+    message->colon = flat->colon;
+    message->line = (char *) flat->data;
+    message->line_len = flat->size - sizeof(*flat) - 1;
+    message->slot = NULL;
+
+    for (int i = 0; i < flat->params_count; i++)
+        message->params[i] = (char *) FLAT_STRING(flat, flat->params[i]);
+
+    return ESP_OK;
+}
+
+size_t irc_flat_size(const irc_flat_message_t *flat)
+{
+    return flat->size;
+}
+
+const char *irc_flat_tags(const irc_flat_message_t *flat)
+{
+    return FLAT_STRING(flat, flat->tags);
+}
+
+const char *irc_flat_source(const irc_flat_message_t *flat)
+{
+    return FLAT_STRING(flat, flat->source);
+}
+
+const char *irc_flat_verb(const irc_flat_message_t *flat)
+{
+    return FLAT_STRING(flat, flat->verb);
+}
+
+irc_verb_t irc_flat_verb_id(const irc_flat_message_t *flat)
+{
+    return flat->verb_id;
+}
+
+int irc_flat_params_count(const irc_flat_message_t *flat)
+{
+    return flat->params_count;
+}
+
+const char *irc_flat_param(const irc_flat_message_t *flat, int index)
+{
+    if (index < 0 || index >= flat->params_count)
+        return NULL;
+
+    return FLAT_STRING(flat, flat->params[index]);
+}
@@ -0,0 +1,128 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * Copyright (c) 2024 Danct12
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "espirc_framer.h"
+#include "espirc_mem.h"
+#include "espirc_scan.h"
+
+#include "esp_err.h"
+#include "esp_log.h"
+
+static const char* TAG = "espirc_framer";
+
+esp_err_t espirc_framer_init(espirc_framer_t *framer, size_t size)
+{
+    if (!framer || !size)
+        return ESP_ERR_INVALID_ARG;
+
+    framer->buf = espirc_malloc(size);
+    if (!framer->buf)
+        return ESP_ERR_NO_MEM;
+
+    framer->size = size;
+    espirc_framer_reset(framer);
+
+    return ESP_OK;
+}
+
+void espirc_framer_deinit(espirc_framer_t *framer)
+{
+    espirc_free(framer->buf);
+    framer->buf = NULL;
+    framer->size = 0;
+}
+
+void espirc_framer_reset(espirc_framer_t *framer)
+{
+    framer->head = 0;
+    framer->scan = 0;
+    framer->tail = 0;
+    framer->discard = false;
+}
+
+/*
+ * Get the free space to receive into.
+ *
+ * The partial line is only moved to the front of the buffer once the space
+ * left after it gets small, so most reads get the full remaining buffer.
+ */
+char *espirc_framer_space(espirc_framer_t *framer, size_t *len)
+{
+    size_t pending = framer->tail - framer->head;
+
+    if (framer->head && framer->size - framer->tail < (framer->size - pending) / 2) {
+        memmove(framer->buf, framer->buf + framer->head, pending);
+        framer->scan -= framer->head;
+        framer->tail = pending;
+        framer->head = 0;
+    }
+
+    /*
+     * A line filling up the whole buffer can never be completed, drop it
+     * along with everything up to the next line break.
+     */
+    if (framer->tail == framer->size) {
+        ESP_LOGW(TAG, "Line exceeds %zu bytes, dropping", framer->size);
+        espirc_framer_reset(framer);
+        framer->discard = true;
+    }
+
+    *len = framer->size - framer->tail;
+    return framer->buf + framer->tail;
+}
+
+void espirc_framer_commit(espirc_framer_t *framer, size_t len)
+{
+    framer->tail += len;
+}
+
+/*
+ * Get the next complete line with the CRLF (or bare LF) stripped and replaced
+ * with a NUL byte. The line stays valid until the next espirc_framer_space().
+ */
+char *espirc_framer_next(espirc_framer_t *framer, size_t *len)
+{
+    char *line, *eol;
+
+    while ((eol = espirc_scan_char(framer->buf + framer->scan,
+            framer->buf + framer->tail, '\n'))) {
+        line = framer->buf + framer->head;
+        framer->head = framer->scan = eol - framer->buf + 1;
+
+        if (framer->discard) {
+            framer->discard = false;
+            continue;
+        }
+
+        if (eol > line && eol[-1] == '\r')
+            eol--;
+
+        /* Skip empty lines */
+        if (eol == line)
+            continue;
+
+        *eol = '\0';
+        if (len) *len = eol - line;
+
+        return line;
+    }
+
+    /*
+     * Start over from the front once everything has been consumed. Bytes of
+     * a line being dropped are not kept around either.
+     */
+    if (framer->discard || framer->head == framer->tail) {
+        framer->head = 0;
+        framer->scan = 0;
+        framer->tail = 0;
+    } else {
+        framer->scan = framer->tail;
+    }
+
+    return NULL;
+}
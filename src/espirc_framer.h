@@ -0,0 +1,38 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * Copyright (c) 2024 Danct12
+ */
+
+#ifndef __ESPIRC_FRAMER_H__
+#define __ESPIRC_FRAMER_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "esp_err.h"
+
+/*
+ * Fixed-size receive buffer that splits the incoming byte stream into lines.
+ *
+ *   buf                head          scan          tail          size
+ *    |    consumed      | partial line |   unscanned  |     free     |
+ *
+ * Data is received straight into the free space. Bytes between head and scan
+ * are known not to contain a line break, so they are never scanned twice.
+ */
+typedef struct {
+    char *buf;
+    size_t size;
+    size_t head;
+    size_t scan;
+    size_t tail;
+    bool discard;
+} espirc_framer_t;
+
+esp_err_t espirc_framer_init(espirc_framer_t *framer, size_t size);
+void espirc_framer_deinit(espirc_framer_t *framer);
+void espirc_framer_reset(espirc_framer_t *framer);
+char *espirc_framer_space(espirc_framer_t *framer, size_t *len);
+void espirc_framer_commit(espirc_framer_t *framer, size_t len);
+char *espirc_framer_next(espirc_framer_t *framer, size_t *len);
+#endif
@@ -0,0 +1,315 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * Copyright (c) 2024 Danct12
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+
+#include "espirc.h"
+#include "espirc_isupport.h"
+#include "espirc_priv.h"
+
+#include "esp_err.h"
+#include "esp_log.h"
+
+static const char* TAG = "espirc_isupport";
+
+/* RFC 1459 line, incl. CRLF */
+#define IRC_LINELEN_DEFAULT 512
+
+typedef struct {
+    const char *key;
+    const char *value;
+} irc_isupport_default_t;
+
+/* What a server that doesn't announce a token is assumed to do */
+static const irc_isupport_default_t irc_isupport_defaults[] = {
+    { "CASEMAPPING", "rfc1459" },
+    { "CHANTYPES", "#&" },
+    { "PREFIX", "(ov)@+" },
+    { "CHANMODES", "beI,k,l,imnpst" },
+    { "LINELEN", "512" },
+    { "NICKLEN", "0" },
+    { "MODES", "3" },
+    { "TARGMAX", "" },
+};
+
+static const char *const irc_targmax_names[IRC_TARGMAX_MAX] = {
+    [IRC_TARGMAX_PRIVMSG] = "PRIVMSG",
+    [IRC_TARGMAX_NOTICE] = "NOTICE",
+    [IRC_TARGMAX_JOIN] = "JOIN",
+    [IRC_TARGMAX_PART] = "PART",
+    [IRC_TARGMAX_KICK] = "KICK",
+    [IRC_TARGMAX_WHOIS] = "WHOIS",
+};
+
+/* Commands left out of TARGMAX take a single target, except JOIN and PART */
+static const uint16_t irc_targmax_defaults[IRC_TARGMAX_MAX] = {
+    [IRC_TARGMAX_PRIVMSG] = 1,
+    [IRC_TARGMAX_NOTICE] = 1,
+    [IRC_TARGMAX_JOIN] = 0,
+    [IRC_TARGMAX_PART] = 0,
+    [IRC_TARGMAX_KICK] = 1,
+    [IRC_TARGMAX_WHOIS] = 1,
+};
+
+static bool irc_isupport_key(const char *key, size_t len, const char *name)
+{
+    return strlen(name) == len && !memcmp(key, name, len);
+}
+
+static const char *irc_isupport_default(const char *key, size_t len)
+{
+    for (size_t i = 0; i < sizeof(irc_isupport_defaults) / sizeof(irc_isupport_defaults[0]); i++) {
+        if (irc_isupport_key(key, len, irc_isupport_defaults[i].key))
+            return irc_isupport_defaults[i].value;
+    }
+
+    return NULL;
+}
+
+static void irc_isupport_casemap(espirc_isupport_t *isupport, const char *value)
+{
+    irc_casemapping_t mapping;
+
+    if (!strcmp(value, "rfc1459"))
+        mapping = IRC_CASEMAPPING_RFC1459;
+    else if (!strcmp(value, "strict-rfc1459"))
+        mapping = IRC_CASEMAPPING_STRICT_RFC1459;
+    else if (!strcmp(value, "ascii") || !strcmp(value, "rfc7613"))
+        /* rfc7613 folds non-ASCII as well, which a byte table can't do */
+        mapping = IRC_CASEMAPPING_ASCII;
+    else {
+        ESP_LOGW(TAG, "Unknown casemapping %s, using rfc1459", value);
+        mapping = IRC_CASEMAPPING_RFC1459;
+    }
+
+    isupport->info.casemapping = mapping;
+
+    for (int c = 0; c < 256; c++)
+        isupport->lower[c] = c >= 'A' && c <= 'Z' ? c + 32 : c;
+
+    /* {}| are the lowercase forms of []\, and ~ of ^ for rfc1459 */
+    if (mapping != IRC_CASEMAPPING_ASCII) {
+        isupport->lower['['] = '{';
+        isupport->lower[']'] = '}';
+        isupport->lower['\\'] = '|';
+    }
+
+    if (mapping == IRC_CASEMAPPING_RFC1459)
+        isupport->lower['^'] = '~';
+}
+
+/* Copy up to max characters, and set their bits */
+static void irc_isupport_chars(char *dst, espirc_charset_t set, const char *src, size_t len,
+                                size_t max)
+{
+    size_t n = 0;
+
+    memset(set, 0, sizeof(espirc_charset_t));
+
+    for (size_t i = 0; i < len && n < max; i++) {
+        /* Membership modes are a bit each, so no duplicates */
+        if (IRC_CHARSET_HAS(set, src[i]))
+            continue;
+
+        IRC_CHARSET_ADD(set, src[i]);
+        dst[n++] = src[i];
+    }
+
+    dst[n] = '\0';
+}
+
+/* "(modes)prefixes", both the same length */
+static void irc_isupport_prefix(espirc_isupport_t *isupport, const char *value)
+{
+    const char *end = strchr(value, ')');
+    size_t len = 0;
+
+    if (*value == '(' && end && strlen(end + 1) == (size_t) (end - value - 1))
+        len = end - value - 1;
+    else if (*value)
+        ESP_LOGW(TAG, "Malformed PREFIX=%s", value);
+
+    len = MIN(len, IRC_ISUPPORT_PREFIX_MAX);
+    irc_isupport_chars(isupport->info.prefix_modes, isupport->prefix_modes, value + 1, len,
+        IRC_ISUPPORT_PREFIX_MAX);
+    irc_isupport_chars(isupport->info.prefix_chars, isupport->prefixes, end ? end + 1 : value,
+        len, IRC_ISUPPORT_PREFIX_MAX);
+}
+
+/* "A,B,C,D": lists, always a parameter, a parameter when set, never one */
+static void irc_isupport_chanmodes(espirc_isupport_t *isupport, const char *value)
+{
+    int type = 0;
+
+    memset(isupport->modes_param, 0, sizeof(isupport->modes_param));
+    memset(isupport->modes_param_set, 0, sizeof(isupport->modes_param_set));
+
+    for (const char *p = value; *p && type < 3; p++) {
+        if (*p == ',')
+            type++;
+        else if (type < 2)
+            IRC_CHARSET_ADD(isupport->modes_param, *p);
+        else
+            IRC_CHARSET_ADD(isupport->modes_param_set, *p);
+    }
+}
+
+/* "PRIVMSG:4,NOTICE:4,JOIN:", an empty limit is no limit */
+static void irc_isupport_targmax(espirc_isupport_t *isupport, const char *value)
+{
+    const char *p = value, *colon, *end;
+
+    memcpy(isupport->info.targmax, irc_targmax_defaults, sizeof(irc_targmax_defaults));
+
+    while (*p) {
+        end = strchr(p, ',');
+        if (!end)
+            end = p + strlen(p);
+
+        colon = memchr(p, ':', end - p);
+        if (colon) {
+            for (int i = 0; i < IRC_TARGMAX_MAX; i++) {
+                if (irc_isupport_key(p, colon - p, irc_targmax_names[i])) {
+                    isupport->info.targmax[i] = MIN(strtoul(colon + 1, NULL, 10), UINT16_MAX);
+                    break;
+                }
+            }
+        }
+
+        p = *end ? end + 1 : end;
+    }
+}
+
+static void irc_isupport_apply(espirc_isupport_t *isupport, const char *key, size_t key_len,
+                                const char *value)
+{
+    irc_isupport_t *info = &isupport->info;
+
+    if (irc_isupport_key(key, key_len, "CASEMAPPING")) {
+        irc_isupport_casemap(isupport, value);
+    } else if (irc_isupport_key(key, key_len, "CHANTYPES")) {
+        irc_isupport_chars(info->chantypes, isupport->chantypes, value, strlen(value),
+            IRC_ISUPPORT_CHANTYPES_MAX);
+    } else if (irc_isupport_key(key, key_len, "PREFIX")) {
+        irc_isupport_prefix(isupport, value);
+    } else if (irc_isupport_key(key, key_len, "CHANMODES")) {
+        irc_isupport_chanmodes(isupport, value);
+    } else if (irc_isupport_key(key, key_len, "LINELEN")) {
+        info->linelen = MIN(MAX(strtoul(value, NULL, 10), IRC_LINELEN_DEFAULT), UINT16_MAX);
+    } else if (irc_isupport_key(key, key_len, "NICKLEN")) {
+        info->nicklen = MIN(strtoul(value, NULL, 10), UINT8_MAX);
+    } else if (irc_isupport_key(key, key_len, "MODES")) {
+        /* No value means no limit, which is as many as fit on a line anyway */
+        info->modes = *value ? MIN(strtoul(value, NULL, 10), UINT8_MAX) : UINT8_MAX;
+    } else if (irc_isupport_key(key, key_len, "TARGMAX")) {
+        irc_isupport_targmax(isupport, value);
+    } else if (irc_isupport_key(key, key_len, "MAXTARGETS")) {
+        /* Older servers, for PRIVMSG and NOTICE only */
+        info->targmax[IRC_TARGMAX_PRIVMSG] = MIN(strtoul(value, NULL, 10), UINT16_MAX);
+        info->targmax[IRC_TARGMAX_NOTICE] = info->targmax[IRC_TARGMAX_PRIVMSG];
+    }
+}
+
+/* Lines can't be longer than the server takes, nor than a batch */
+static void irc_isupport_sendq(irc_handle_t client)
+{
+    client->sendq.line_max = MIN(client->isupport.info.linelen, client->config.wbuf_size) - 2;
+}
+
+const char *espirc_isupport_command(irc_targmax_t command)
+{
+    return irc_targmax_names[command];
+}
+
+/* Back to the defaults, before registering */
+void espirc_isupport_reset(irc_handle_t client)
+{
+    espirc_isupport_t *isupport = &client->isupport;
+    const irc_isupport_default_t *d;
+
+    for (size_t i = 0; i < sizeof(irc_isupport_defaults) / sizeof(irc_isupport_defaults[0]); i++) {
+        d = &irc_isupport_defaults[i];
+        irc_isupport_apply(isupport, d->key, strlen(d->key), d->value);
+    }
+
+    irc_isupport_sendq(client);
+}
+
+/*
+ * "<client> <token> ... :are supported by this server"
+ *
+ * A token is KEY or KEY=value, -KEY takes back an earlier one. Tokens we
+ * don't use are ignored.
+ */
+void espirc_isupport_handle(irc_handle_t client, irc_message_t *message)
+{
+    espirc_isupport_t *isupport = &client->isupport;
+    const char *token, *eq, *value;
+    size_t key_len;
+    bool negate;
+
+    for (int i = 1; i < message->params_count - message->colon; i++) {
+        token = message->params[i];
+
+        negate = *token == '-';
+        token += negate;
+
+        eq = strchr(token, '=');
+        key_len = eq ? (size_t) (eq - token) : strlen(token);
+        value = eq ? eq + 1 : "";
+
+        if (negate) {
+            value = irc_isupport_default(token, key_len);
+            if (!value)
+                continue;
+        }
+
+        irc_isupport_apply(isupport, token, key_len, value);
+    }
+
+    irc_isupport_sendq(client);
+}
+
+/*
+ * API
+ */
+
+esp_err_t irc_get_isupport(irc_handle_t client, irc_isupport_t *isupport)
+{
+    if (!client || !isupport)
+        return ESP_ERR_INVALID_ARG;
+
+    *isupport = client->isupport.info;
+
+    return ESP_OK;
+}
+
+bool irc_is_channel(irc_handle_t client, const char *name)
+{
+    if (!client || !name)
+        return false;
+
+    return espirc_isupport_is_channel(&client->isupport, name);
+}
+
+bool irc_name_equal(irc_handle_t client, const char *a, const char *b)
+{
+    const uint8_t *lower;
+
+    if (!client || !a || !b)
+        return false;
+
+    lower = client->isupport.lower;
+
+    for (; *a && *b; a++, b++) {
+        if (lower[(uint8_t) *a] != lower[(uint8_t) *b])
+            return false;
+    }
+
+    return *a == *b;
+}
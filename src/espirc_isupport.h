@@ -0,0 +1,54 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * Copyright (c) 2024 Danct12
+ */
+
+#ifndef __ESPIRC_ISUPPORT_H__
+#define __ESPIRC_ISUPPORT_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "espirc.h"
+
+/* One bit per byte value */
+typedef uint32_t espirc_charset_t[256 / 32];
+
+#define IRC_CHARSET_ADD(set, c) ((set)[(uint8_t) (c) >> 5] |= 1u << ((uint8_t) (c) & 31))
+#define IRC_CHARSET_HAS(set, c) (((set)[(uint8_t) (c) >> 5] >> ((uint8_t) (c) & 31)) & 1)
+
+/*
+ * 005 tokens of the current connection, turned into lookup tables once so
+ * messages can be checked without going through strings.
+ */
+typedef struct {
+    irc_isupport_t info;
+
+    uint8_t lower[256];             /* CASEMAPPING */
+    espirc_charset_t chantypes;     /* CHANTYPES */
+    espirc_charset_t prefixes;      /* PREFIX chars */
+    espirc_charset_t prefix_modes;  /* PREFIX modes */
+    espirc_charset_t modes_param;   /* CHANMODES A and B, always with a parameter */
+    espirc_charset_t modes_param_set; /* CHANMODES C, with a parameter when set */
+} espirc_isupport_t;
+
+void espirc_isupport_reset(irc_handle_t client);
+void espirc_isupport_handle(irc_handle_t client, irc_message_t *message);
+const char *espirc_isupport_command(irc_targmax_t command);
+
+static inline bool espirc_isupport_is_channel(const espirc_isupport_t *isupport, const char *name)
+{
+    return IRC_CHARSET_HAS(isupport->chantypes, name[0]);
+}
+
+/* Bit of a membership mode (for its mode letter or prefix char), highest rank is bit 0 */
+static inline int espirc_isupport_prefix_rank(const char *set, char c)
+{
+    for (int i = 0; set[i]; i++) {
+        if (set[i] == c)
+            return i;
+    }
+
+    return -1;
+}
+#endif
@@ -0,0 +1,131 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * Copyright (c) 2024 Danct12
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/param.h>
+
+#include "espirc.h"
+#include "espirc_keepalive.h"
+#include "espirc_priv.h"
+
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+static const char* TAG = "espirc_keepalive";
+
+#define IRC_KEEPALIVE_TOKEN_FMT "espirc-%08" PRIx32
+
+static bool espirc_keepalive_enabled(irc_handle_t client)
+{
+    return !client->config.keepalive_disable && client->state == IRC_STATE_CONNECTED;
+}
+
+/* Called once registered, lag is measured afresh on every connection */
+void espirc_keepalive_start(irc_handle_t client)
+{
+    espirc_keepalive_t *keepalive = &client->keepalive;
+    int64_t now = esp_timer_get_time();
+
+    keepalive->last_rx = now;
+    keepalive->ping_at = now + client->config.ping_interval_ms * 1000LL;
+    keepalive->ping_sent = -1;
+
+    IRC_STAT_SET(client, lag_us, 0);
+    IRC_STAT_SET(client, lag_srtt_us, 0);
+    IRC_STAT_SET(client, lag_jitter_us, 0);
+}
+
+/* Wake up for the next PING, or when the link would be considered dead */
+void espirc_keepalive_prepare(irc_handle_t client, int64_t *wait)
+{
+    espirc_keepalive_t *keepalive = &client->keepalive;
+    int64_t now = esp_timer_get_time();
+
+    if (!espirc_keepalive_enabled(client))
+        return;
+
+    irc_io_wait_min(wait, MAX(keepalive->ping_at - now, 0));
+    irc_io_wait_min(wait, MAX(keepalive->last_rx + client->config.ping_timeout_ms * 1000LL - now, 0));
+}
+
+/*
+ * Send a PING every ping_interval_ms, whether or not the previous one was
+ * answered. Returns ESP_ERR_TIMEOUT once the server has been silent for
+ * ping_timeout_ms.
+ */
+esp_err_t espirc_keepalive_service(irc_handle_t client)
+{
+    espirc_keepalive_t *keepalive = &client->keepalive;
+    int64_t now = esp_timer_get_time();
+
+    if (!espirc_keepalive_enabled(client))
+        return ESP_OK;
+
+    if (now - keepalive->last_rx >= client->config.ping_timeout_ms * 1000LL) {
+        ESP_LOGE(TAG, "Nothing from the server in %" PRIu32 " ms, the link is dead",
+            client->config.ping_timeout_ms);
+        IRC_STAT_ADD(client, links_dead, 1);
+        return ESP_ERR_TIMEOUT;
+    }
+
+    if (now < keepalive->ping_at)
+        return ESP_OK;
+
+    /* A PONG to an older token is ignored, its round trip is too long to matter */
+    keepalive->token++;
+    if (irc_send(client, IRC_SENDQ_URGENT, "PING :" IRC_KEEPALIVE_TOKEN_FMT,
+            keepalive->token) == ESP_OK)
+        keepalive->ping_sent = now;
+    else
+        keepalive->ping_sent = -1;
+
+    keepalive->ping_at = now + client->config.ping_interval_ms * 1000LL;
+
+    return ESP_OK;
+}
+
+/*
+ * Smooth the round trip of our PINGs like TCP does (RFC 6298): the average
+ * moves by 1/8 of the difference with each sample, the jitter (mean
+ * deviation) by 1/4.
+ */
+void espirc_keepalive_pong(irc_handle_t client, irc_message_t *message)
+{
+    espirc_keepalive_t *keepalive = &client->keepalive;
+    uint32_t rtt, srtt, jitter, delta;
+    char token[16];
+
+    if (keepalive->ping_sent < 0 || !message->params_count)
+        return;
+
+    snprintf(token, sizeof(token), IRC_KEEPALIVE_TOKEN_FMT, keepalive->token);
+    if (strcmp(message->params[message->params_count - 1], token))
+        return;
+
+    rtt = MIN(esp_timer_get_time() - keepalive->ping_sent, UINT32_MAX);
+    keepalive->ping_sent = -1;
+
+    srtt = client->stats.lag_srtt_us;
+    jitter = client->stats.lag_jitter_us;
+
+    if (!srtt) {
+        srtt = rtt;
+        jitter = rtt / 2;
+    } else {
+        delta = srtt > rtt ? srtt - rtt : rtt - srtt;
+        jitter = jitter - jitter / 4 + delta / 4;
+        srtt = srtt - srtt / 8 + rtt / 8;
+    }
+
+    IRC_STAT_SET(client, lag_us, rtt);
+    IRC_STAT_SET(client, lag_srtt_us, MAX(srtt, 1));
+    IRC_STAT_SET(client, lag_jitter_us, jitter);
+
+    ESP_LOGD(TAG, "Lag %" PRIu32 " us (smoothed %" PRIu32 " us, jitter %" PRIu32 " us)", rtt,
+        srtt, jitter);
+}
@@ -0,0 +1,25 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * Copyright (c) 2024 Danct12
+ */
+
+#ifndef __ESPIRC_KEEPALIVE_H__
+#define __ESPIRC_KEEPALIVE_H__
+
+#include <stdint.h>
+
+#include "espirc.h"
+#include "esp_err.h"
+
+typedef struct {
+    int64_t last_rx;    /* Last time anything arrived from the server */
+    int64_t ping_at;    /* When the next PING goes out */
+    int64_t ping_sent;  /* When the PING in flight was queued, -1 if none */
+    uint32_t token;
+} espirc_keepalive_t;
+
+void espirc_keepalive_start(irc_handle_t client);
+void espirc_keepalive_prepare(irc_handle_t client, int64_t *wait);
+esp_err_t espirc_keepalive_service(irc_handle_t client);
+void espirc_keepalive_pong(irc_handle_t client, irc_message_t *message);
+#endif
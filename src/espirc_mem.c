@@ -0,0 +1,70 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * Copyright (c) 2024 Danct12
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "espirc_mem.h"
+
+/* Keeps the size of the allocation in front of it, without losing alignment */
+typedef union {
+    size_t size;
+    long long align;
+} espirc_mem_header_t;
+
+static uint32_t heap_used;
+static uint32_t heap_peak;
+
+void *espirc_malloc(size_t size)
+{
+    espirc_mem_header_t *header;
+    uint32_t used, peak;
+
+    header = malloc(sizeof(*header) + size);
+    if (!header)
+        return NULL;
+
+    header->size = size;
+
+    used = __atomic_add_fetch(&heap_used, size, __ATOMIC_RELAXED);
+    peak = __atomic_load_n(&heap_peak, __ATOMIC_RELAXED);
+    while (used > peak && !__atomic_compare_exchange_n(&heap_peak, &peak, used, true,
+            __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    return header + 1;
+}
+
+void *espirc_calloc(size_t count, size_t size)
+{
+    void *ptr;
+
+    if (size && count > SIZE_MAX / size)
+        return NULL;
+
+    ptr = espirc_malloc(count * size);
+    if (ptr)
+        memset(ptr, 0, count * size);
+
+    return ptr;
+}
+
+void espirc_free(void *ptr)
+{
+    espirc_mem_header_t *header;
+
+    if (!ptr)
+        return;
+
+    header = (espirc_mem_header_t *) ptr - 1;
+    __atomic_sub_fetch(&heap_used, header->size, __ATOMIC_RELAXED);
+    free(header);
+}
+
+void espirc_mem_stats(uint32_t *used, uint32_t *peak)
+{
+    *used = __atomic_load_n(&heap_used, __ATOMIC_RELAXED);
+    *peak = __atomic_load_n(&heap_peak, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,21 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * Copyright (c) 2024 Danct12
+ */
+
+#ifndef __ESPIRC_MEM_H__
+#define __ESPIRC_MEM_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Heap allocations of the library go through these so that the bytes in use
+ * can be reported by irc_get_stats(). FreeRTOS objects, task stacks and event
+ * loops are allocated by IDF and not counted.
+ */
+void *espirc_malloc(size_t size);
+void *espirc_calloc(size_t count, size_t size);
+void espirc_free(void *ptr);
+void espirc_mem_stats(uint32_t *used, uint32_t *peak);
+#endif
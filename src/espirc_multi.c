@@ -0,0 +1,123 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * Copyright (c) 2024 Danct12
+ */
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "espirc.h"
+#include "espirc_isupport.h"
+#include "espirc_priv.h"
+#include "espirc_sendq.h"
+
+#include "esp_err.h"
+#include "esp_log.h"
+
+static const char* TAG = "espirc_multi";
+
+static bool irc_multi_target_valid(const char *target)
+{
+    return *target && !strpbrk(target, " ,\r\n");
+}
+
+/*
+ * "<command> <target>[,<target>...][ :<text>]"
+ *
+ * Lines are written straight into the send queue, targets are added to a
+ * line for as long as it stays within line_max and TARGMAX.
+ */
+esp_err_t irc_send_multi(irc_handle_t client, irc_targmax_t command, const char* const* targets,
+                            size_t count, const char* text)
+{
+    const char *name;
+    size_t name_len, text_len, fixed, line_max, len, first, last, n;
+    uint16_t targmax;
+    esp_err_t err;
+    char *line, *p;
+
+    if (!client || (count && !targets))
+        return ESP_ERR_INVALID_ARG;
+
+    switch (command) {
+        case IRC_TARGMAX_JOIN:
+            if (text)
+                return ESP_ERR_INVALID_ARG;
+            break;
+        case IRC_TARGMAX_PART:
+            break;
+        case IRC_TARGMAX_PRIVMSG:
+        case IRC_TARGMAX_NOTICE:
+            if (!text)
+                return ESP_ERR_INVALID_ARG;
+            break;
+        default:
+            return ESP_ERR_INVALID_ARG;
+    }
+
+    /* A line break would end the line early and send the rest as a command */
+    if (text && strpbrk(text, "\r\n"))
+        return ESP_ERR_INVALID_ARG;
+
+    if (client->state < IRC_STATE_CONNECTING)
+        return ESP_ERR_INVALID_STATE;
+
+    name = espirc_isupport_command(command);
+    name_len = strlen(name);
+    text_len = text ? strlen(text) : 0;
+
+    /* Everything but the targets: "<command> " and " :<text>" */
+    fixed = name_len + 1 + (text ? 2 + text_len : 0);
+    line_max = client->sendq.line_max;
+    targmax = client->isupport.info.targmax[command];
+
+    /* Check every target first, so nothing is sent unless all of them can be */
+    for (n = 0; n < count; n++) {
+        if (!targets[n] || !irc_multi_target_valid(targets[n]) ||
+                fixed + strlen(targets[n]) > line_max)
+            return ESP_ERR_INVALID_ARG;
+    }
+
+    for (first = 0; first < count; first = last) {
+        len = fixed + strlen(targets[first]);
+
+        for (last = first + 1; last < count && (!targmax || last - first < targmax); last++) {
+            n = 1 + strlen(targets[last]);
+            if (len + n > line_max)
+                break;
+
+            len += n;
+        }
+
+        err = espirc_sendq_reserve(&client->sendq, IRC_SENDQ_BULK, len, &line);
+        if (err != ESP_OK) {
+            ESP_LOGW(TAG, "Send queue is full, %zu of %zu targets left out", count - first,
+                count);
+            if (first)
+                irc_wake(client);
+            return err;
+        }
+
+        p = line;
+        memcpy(p, name, name_len);
+        p += name_len;
+
+        for (n = first; n < last; n++) {
+            *p++ = n == first ? ' ' : ',';
+            memcpy(p, targets[n], strlen(targets[n]));
+            p += strlen(targets[n]);
+        }
+
+        if (text) {
+            memcpy(p, " :", 2);
+            memcpy(p + 2, text, text_len);
+        }
+
+        espirc_sendq_queue(&client->sendq, IRC_SENDQ_BULK, line, len);
+    }
+
+    if (count)
+        irc_wake(client);
+
+    return ESP_OK;
+}
@@ -0,0 +1,240 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * Copyright (c) 2024 Danct12
+ */
+
+#include <string.h>
+
+#include "espirc.h"
+#include "espirc_parser.h"
+#include "espirc_scan.h"
+
+#include "esp_err.h"
+
+#define VERB_IS(name) (len == sizeof(name) - 1 && !memcmp(verb, name, len))
+
+/*
+ * Map a verb to its ID. Numerics are converted straight to their value,
+ * commands are told apart by their first letter before being compared.
+ */
+irc_verb_t irc_verb_lookup(const char *verb, size_t len)
+{
+    if (len == 3 && verb[0] >= '0' && verb[0] <= '9' &&
+            verb[1] >= '0' && verb[1] <= '9' && verb[2] >= '0' && verb[2] <= '9')
+        return IRC_NUMERIC((verb[0] - '0') * 100 + (verb[1] - '0') * 10 + (verb[2] - '0'));
+
+    switch (verb[0]) {
+        case 'A':
+            if (VERB_IS("ACCOUNT")) return IRC_VERB_ACCOUNT;
+            if (VERB_IS("AUTHENTICATE")) return IRC_VERB_AUTHENTICATE;
+            if (VERB_IS("AWAY")) return IRC_VERB_AWAY;
+            break;
+        case 'B':
+            if (VERB_IS("BATCH")) return IRC_VERB_BATCH;
+            break;
+        case 'C':
+            if (VERB_IS("CAP")) return IRC_VERB_CAP;
+            if (VERB_IS("CHGHOST")) return IRC_VERB_CHGHOST;
+            break;
+        case 'E':
+            if (VERB_IS("ERROR")) return IRC_VERB_ERROR;
+            break;
+        case 'I':
+            if (VERB_IS("INVITE")) return IRC_VERB_INVITE;
+            break;
+        case 'J':
+            if (VERB_IS("JOIN")) return IRC_VERB_JOIN;
+            break;
+        case 'K':
+            if (VERB_IS("KICK")) return IRC_VERB_KICK;
+            if (VERB_IS("KILL")) return IRC_VERB_KILL;
+            break;
+        case 'M':
+            if (VERB_IS("MODE")) return IRC_VERB_MODE;
+            break;
+        case 'N':
+            if (VERB_IS("NICK")) return IRC_VERB_NICK;
+            if (VERB_IS("NOTICE")) return IRC_VERB_NOTICE;
+            break;
+        case 'P':
+            if (VERB_IS("PART")) return IRC_VERB_PART;
+            if (VERB_IS("PING")) return IRC_VERB_PING;
+            if (VERB_IS("PONG")) return IRC_VERB_PONG;
+            if (VERB_IS("PRIVMSG")) return IRC_VERB_PRIVMSG;
+            break;
+        case 'Q':
+            if (VERB_IS("QUIT")) return IRC_VERB_QUIT;
+            break;
+        case 'S':
+            if (VERB_IS("SETNAME")) return IRC_VERB_SETNAME;
+            break;
+        case 'T':
+            if (VERB_IS("TAGMSG")) return IRC_VERB_TAGMSG;
+            if (VERB_IS("TOPIC")) return IRC_VERB_TOPIC;
+            break;
+        case 'W':
+            if (VERB_IS("WALLOPS")) return IRC_VERB_WALLOPS;
+            break;
+    }
+
+    return IRC_VERB_UNKNOWN;
+}
+
+/* End of the token at p: the next space, or the end of the line */
+static char *irc_token_end(char *p, char *end)
+{
+    char *space = espirc_scan_char(p, end, ' ');
+
+    return space ? space : end;
+}
+
+/*
+ * Tokenize a single IRC line of len bytes (NUL terminated) in place.
+ *
+ * Spaces separating the source, verb and parameters are replaced with NUL
+ * bytes and the message fields point straight into the line, so the line
+ * must outlive the message. No memory is allocated.
+ *
+ * Every byte is looked at once at most: tokens are found with a word at a
+ * time scan and the trailing parameter simply runs to the end of the line.
+ */
+esp_err_t irc_parse_message(char *line, size_t len, irc_message_t *message)
+{
+    char *p = line, *end = line + len;
+
+    message->tags = NULL;
+    message->source = NULL;
+    message->source_user = 0;
+    message->source_host = 0;
+    message->verb = NULL;
+    message->verb_id = IRC_VERB_UNKNOWN;
+    message->params_count = 0;
+    message->colon = 0;
+    message->line = line;
+    message->line_len = len;
+    message->slot = NULL;
+
+    /* IRCv3 tags are only split off here, see irc_message_tag() */
+    if (*p == '@') {
+        message->tags = ++p;
+
+        p = espirc_scan_char(p, end, ' ');
+        if (!p)
+            return ESP_ERR_INVALID_ARG;
+
+        *p++ = '\0';
+        while (*p == ' ') p++;
+    }
+
+    if (*p == ':') {
+        message->source = ++p;
+
+        /* Note where the user and host start for irc_source_*() */
+        for (; *p && *p != ' '; p++) {
+            if (*p == '!' && !message->source_user && !message->source_host)
+                message->source_user = p - message->source + 1;
+            else if (*p == '@' && !message->source_host)
+                message->source_host = p - message->source + 1;
+        }
+
+        /* A source must be followed by a verb */
+        if (!*p)
+            return ESP_ERR_INVALID_ARG;
+
+        *p++ = '\0';
+        while (*p == ' ') p++;
+    }
+
+    if (!*p)
+        return ESP_ERR_INVALID_ARG;
+
+    message->verb = p;
+    p = irc_token_end(p, end);
+    message->verb_id = irc_verb_lookup(message->verb, p - message->verb);
+
+    while (p < end) {
+        *p++ = '\0';
+        while (*p == ' ') p++;
+        if (!*p) break;
+
+        /*
+         * The trailing parameter runs until the end of the line and may
+         * contain spaces. Per RFC 1459, the last of the 15 parameters is
+         * also treated as trailing even if the colon is omitted.
+         */
+        if (*p == ':' || message->params_count == IRC_MESSAGE_PARAMS_MAX - 1) {
+            if (*p == ':') {
+                message->colon = 1;
+                p++;
+            }
+
+            message->params[message->params_count++] = p;
+            break;
+        }
+
+        message->params[message->params_count++] = p;
+        p = irc_token_end(p, end);
+    }
+
+    return ESP_OK;
+}
+
+/*
+ * Look up a tag of the message and copy its unescaped value into value
+ * (if not NULL). A tag without a value reads as an empty string.
+ *
+ * Returns ESP_ERR_NOT_FOUND if the message doesn't have the tag and
+ * ESP_ERR_INVALID_SIZE if the value doesn't fit.
+ */
+esp_err_t irc_message_tag(const irc_message_t *message, const char *key, char *value, size_t size)
+{
+    size_t key_len, len = 0;
+    const char *p;
+
+    if (!message || !key)
+        return ESP_ERR_INVALID_ARG;
+
+    key_len = strlen(key);
+
+    for (p = message->tags; p && *p; p += strcspn(p, ";"), p += *p == ';') {
+        if (strncmp(p, key, key_len) || (p[key_len] && p[key_len] != '=' && p[key_len] != ';'))
+            continue;
+
+        p += key_len;
+        if (*p == '=')
+            p++;
+
+        if (!value)
+            return ESP_OK;
+
+        for (; *p && *p != ';'; p++) {
+            if (len + 1 >= size)
+                return ESP_ERR_INVALID_SIZE;
+
+            if (*p != '\\') {
+                value[len++] = *p;
+                continue;
+            }
+
+            /* A lone backslash at the end of the value is dropped */
+            if (!*++p || *p == ';')
+                break;
+
+            switch (*p) {
+                case ':': value[len++] = ';'; break;
+                case 's': value[len++] = ' '; break;
+                case 'r': value[len++] = '\r'; break;
+                case 'n': value[len++] = '\n'; break;
+                default: value[len++] = *p; break;
+            }
+        }
+
+        if (!size)
+            return ESP_ERR_INVALID_SIZE;
+
+        value[len] = '\0';
+        return ESP_OK;
+    }
+
+    return ESP_ERR_NOT_FOUND;
+}
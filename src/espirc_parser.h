@@ -0,0 +1,14 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * Copyright (c) 2024 Danct12
+ */
+
+#ifndef __ESPIRC_PARSER_H__
+#define __ESPIRC_PARSER_H__
+
+#include "espirc.h"
+#include "esp_err.h"
+
+irc_verb_t irc_verb_lookup(const char *verb, size_t len);
+esp_err_t irc_parse_message(char *line, size_t len, irc_message_t *message);
+#endif
@@ -0,0 +1,127 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * Copyright (c) 2024 Danct12
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+
+#include "espirc.h"
+#include "espirc_mem.h"
+#include "espirc_pool.h"
+
+#include "esp_err.h"
+
+/* Slots are laid out back to back, so each one is padded to keep the next aligned */
+#define SLOT_ALIGN _Alignof(struct irc_message_slot)
+#define SLOT_SIZE(line_size) \
+    ((sizeof(struct irc_message_slot) + (line_size) + SLOT_ALIGN - 1) & ~(SLOT_ALIGN - 1))
+
+esp_err_t espirc_pool_init(espirc_pool_t *pool, size_t count, size_t line_size)
+{
+    struct irc_message_slot *slot;
+
+    pool->count = count;
+    pool->line_size = line_size;
+
+    pool->slots = espirc_calloc(count, SLOT_SIZE(line_size));
+    pool->free = xQueueCreate(count, sizeof(struct irc_message_slot *));
+
+    if (!pool->slots || !pool->free) {
+        espirc_pool_deinit(pool);
+        return ESP_ERR_NO_MEM;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        slot = (struct irc_message_slot *) ((char *) pool->slots + i * SLOT_SIZE(line_size));
+        slot->free = pool->free;
+        xQueueSend(pool->free, &slot, 0);
+    }
+
+    return ESP_OK;
+}
+
+void espirc_pool_deinit(espirc_pool_t *pool)
+{
+    if (pool->free)
+        vQueueDelete(pool->free);
+
+    espirc_free(pool->slots);
+
+    pool->free = NULL;
+    pool->slots = NULL;
+}
+
+/*
+ * Copy a parsed line into a free slot, waiting up to the given time for one
+ * to be released. The line is copied as is (NUL bytes from tokenizing
+ * included), so every pointer of the message keeps its offset.
+ */
+struct irc_message_slot *espirc_pool_get(espirc_pool_t *pool, const irc_message_t *message,
+                                    const char *line, size_t len, TickType_t wait)
+{
+    struct irc_message_slot *slot;
+    uint32_t in_use;
+
+#define REBASE(ptr) ((ptr) ? slot->line + ((ptr) - line) : NULL)
+
+    if (len >= pool->line_size)
+        return NULL;
+
+    if (xQueueReceive(pool->free, &slot, wait) != pdTRUE)
+        return NULL;
+
+    in_use = pool->count - uxQueueMessagesWaiting(pool->free);
+    if (in_use > pool->peak)
+        __atomic_store_n(&pool->peak, in_use, __ATOMIC_RELAXED);
+
+    memcpy(slot->line, line, len + 1);
+
+    slot->message = *message;
+    slot->message.slot = slot;
+    slot->message.line = slot->line;
+    slot->message.line_len = len;
+    slot->message.tags = REBASE(message->tags);
+    slot->message.source = REBASE(message->source);
+    slot->message.verb = REBASE(message->verb);
+    for (int i = 0; i < message->params_count; i++)
+        slot->message.params[i] = REBASE(message->params[i]);
+
+#undef REBASE
+
+    slot->refcount = 1;
+
+    return slot;
+}
+
+void espirc_pool_put(struct irc_message_slot *slot)
+{
+    if (__atomic_sub_fetch(&slot->refcount, 1, __ATOMIC_ACQ_REL) == 0)
+        xQueueSend(slot->free, &slot, 0);
+}
+
+/*
+ * Keep a message alive after the handler returns, e.g. to pass it on to
+ * another task. The returned message stays valid until irc_message_unref().
+ */
+irc_message_t *irc_message_ref(const irc_message_t *message)
+{
+    struct irc_message_slot *slot;
+
+    if (!message || !message->slot)
+        return NULL;
+
+    slot = message->slot;
+    __atomic_add_fetch(&slot->refcount, 1, __ATOMIC_RELAXED);
+
+    return &slot->message;
+}
+
+void irc_message_unref(const irc_message_t *message)
+{
+    if (message && message->slot)
+        espirc_pool_put(message->slot);
+}
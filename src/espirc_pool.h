@@ -0,0 +1,50 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * Copyright (c) 2024 Danct12
+ */
+
+#ifndef __ESPIRC_POOL_H__
+#define __ESPIRC_POOL_H__
+
+#include <stdint.h>
+
+#include "sdkconfig.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+
+#include "espirc.h"
+#include "esp_err.h"
+
+/*
+ * Preallocated message slot.
+ *
+ * The slot holds its own copy of the line, the message points into it. It's
+ * handed back to the pool once the last reference is dropped.
+ */
+struct irc_message_slot {
+    QueueHandle_t free;
+    uint32_t refcount;
+#ifdef CONFIG_ESPIRC_TRACE
+    uint32_t posted;
+#endif
+    irc_message_t message;
+    char line[];
+};
+
+typedef struct {
+    QueueHandle_t free;
+    void *slots;
+    size_t count;
+    size_t line_size;
+
+    /* Most slots in use at once */
+    uint32_t peak;
+} espirc_pool_t;
+
+esp_err_t espirc_pool_init(espirc_pool_t *pool, size_t count, size_t line_size);
+void espirc_pool_deinit(espirc_pool_t *pool);
+struct irc_message_slot *espirc_pool_get(espirc_pool_t *pool, const irc_message_t *message,
+                                    const char *line, size_t len, TickType_t wait);
+void espirc_pool_put(struct irc_message_slot *slot);
+#endif
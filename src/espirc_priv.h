@@ -0,0 +1,130 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * Copyright (c) 2024 Danct12
+ */
+
+#ifndef __ESPIRC_PRIV_H__
+#define __ESPIRC_PRIV_H__
+
+#include <sys/select.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "espirc.h"
+#include "espirc_cap.h"
+#include "espirc_capture.h"
+#include "espirc_framer.h"
+#include "espirc_isupport.h"
+#include "espirc_keepalive.h"
+#include "espirc_pool.h"
+#include "espirc_sendq.h"
+#include "espirc_socket.h"
+#include "espirc_split.h"
+#include "espirc_state.h"
+#include "espirc_trace.h"
+
+#ifdef CONFIG_ESPIRC_SUPPORT_TLS
+#include "esp_tls.h"
+#endif
+
+struct irc {
+    bool running;
+    bool closing;
+
+    irc_config_t config;
+
+    /* IRC Socket */
+    int socket;
+    espirc_connect_t connect;
+
+#ifdef CONFIG_ESPIRC_SUPPORT_TLS
+    esp_tls_t *tls_ptr;
+    char *wbuf;
+#ifdef CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+    esp_tls_client_session_t *tls_session;
+#endif
+#endif
+
+    /* IRC Task */
+    irc_state_t state;
+    irc_message_t message;
+    espirc_framer_t framer;
+    espirc_sendq_t sendq;
+    int64_t send_at;
+    bool autojoin;
+    int wake_fd;
+    TaskHandle_t task_handle;
+    esp_event_loop_handle_t event_handle;
+
+    /* Server Features */
+    espirc_isupport_t isupport;
+    espirc_self_t self;
+
+    /* Capability Negotiation */
+    irc_cap_state_t cap_state;
+    uint32_t cap_offered;
+    bool sasl_offered;
+
+    /* Statistics */
+    irc_stats_t stats;
+#ifdef CONFIG_ESPIRC_TRACE
+    uint32_t trace[IRC_TRACE_STAGES][IRC_TRACE_BUCKETS];
+#endif
+
+    /* Traffic Capture */
+#ifdef CONFIG_ESPIRC_CAPTURE
+    espirc_capture_t *capture;
+    espirc_replay_t *replay;
+    SemaphoreHandle_t capture_lock;
+#endif
+
+    /* Reconnect */
+    int64_t reconnect_at;
+    uint32_t backoff_ms;
+
+    /* Keepalive */
+    espirc_keepalive_t keepalive;
+
+    /* State Tracking */
+#ifdef CONFIG_ESPIRC_STATE
+    espirc_state_t tracker;
+#endif
+
+    /* IRC Engine */
+    irc_handle_t engine_next;
+
+    /* Message Dispatch */
+    espirc_pool_t pool;
+    bool message_event;
+    bool verb_any;
+    uint32_t verb_handlers[(IRC_VERB_MAX + 31) / 32];
+};
+
+/* How often the IRC task (or engine) samples its stack high-water mark */
+#define IRC_STACK_SAMPLE_US 1000000
+
+/* Counters may be read from any task while the IRC task updates them */
+#define IRC_STAT_ADD(client, field, n) \
+    __atomic_fetch_add(&(client)->stats.field, (n), __ATOMIC_RELAXED)
+
+#define IRC_STAT_SET(client, field, n) \
+    __atomic_store_n(&(client)->stats.field, (n), __ATOMIC_RELAXED)
+
+#define IRC_STAT_MAX(client, field, n) \
+    do { \
+        if ((uint32_t) (n) > (client)->stats.field) \
+            __atomic_store_n(&(client)->stats.field, (n), __ATOMIC_RELAXED); \
+    } while (0)
+
+void irc_wake(irc_handle_t client);
+esp_err_t irc_send(irc_handle_t client, irc_sendq_lane_t lane, const char *fmt, ...);
+
+/* Connection I/O, shared by the IRC task and the engine */
+int irc_wake_fd_create(void);
+void irc_io_wait_min(int64_t *wait, int64_t candidate);
+void irc_io_prepare(irc_handle_t client, fd_set *rfds, fd_set *wfds, int *maxfd, int64_t *wait);
+bool irc_io_service(irc_handle_t client, fd_set *rfds, fd_set *wfds);
+bool irc_io_close(irc_handle_t client);
+int irc_io_select(int maxfd, fd_set *rfds, fd_set *wfds, int64_t wait);
+#endif
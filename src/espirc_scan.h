@@ -0,0 +1,61 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * Copyright (c) 2024 Danct12
+ */
+
+#ifndef __ESPIRC_SCAN_H__
+#define __ESPIRC_SCAN_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Word at a time (SWAR) byte search.
+ *
+ * XORing a word with the wanted byte repeated in every lane turns matches
+ * into zero bytes, which SCAN_HAS_ZERO() finds with three ALU operations.
+ * The lowest flagged lane is always exact (ESP32 chips are little endian),
+ * so the position of the match falls out of a count of trailing zeros.
+ */
+typedef uintptr_t espirc_word_t;
+
+#define SCAN_ONES ((espirc_word_t) -1 / 0xFF)
+#define SCAN_HIGHS (SCAN_ONES * 0x80)
+#define SCAN_HAS_ZERO(x) (((x) - SCAN_ONES) & ~(x) & SCAN_HIGHS)
+
+/*
+ * Find the first c in [p, end), NULL if there isn't one.
+ *
+ * The first word is loaded from the word boundary below p with the lanes
+ * before p filled in, so the buffer p points into must start on a word
+ * boundary (as malloc() returns). Nothing past end is read.
+ */
+static inline char *espirc_scan_char(const char *p, const char *end, char c)
+{
+    espirc_word_t pattern = SCAN_ONES * (uint8_t) c, word;
+    size_t skip = (uintptr_t) p & (sizeof(word) - 1);
+
+    if (p >= end)
+        return NULL;
+
+    p -= skip;
+
+    for (; (size_t) (end - p) >= sizeof(word); p += sizeof(word), skip = 0) {
+        memcpy(&word, p, sizeof(word));
+
+        /* Lanes before p are forced to non-zero so they can't match */
+        word = (word ^ pattern) | (((espirc_word_t) 1 << (skip * 8)) - 1);
+        word = SCAN_HAS_ZERO(word);
+        if (word)
+            return (char *) p + __builtin_ctzl(word) / 8;
+    }
+
+    for (p += skip; p < end; p++) {
+        if (*p == c)
+            return (char *) p;
+    }
+
+    return NULL;
+}
+#endif
@@ -0,0 +1,381 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * Copyright (c) 2024 Danct12
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/ringbuf.h"
+
+#include "espirc.h"
+#include "espirc_cap.h"
+#include "espirc_mem.h"
+#include "espirc_priv.h"
+#include "espirc_sendq.h"
+#include "espirc_socket.h"
+
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+/* non-IRCv3 line length (according to RFC1459) is 512 bytes (incl. CRLF) */
+#define IRC_LINE_MAX 510
+
+/* Enough for a couple of PONGs and a QUIT, SASL adds its own room */
+#define IRC_SENDQ_URGENT_SIZE 1024
+
+static const char* TAG = "espirc_sendq";
+
+/* The storage is allocated here so that it shows up in the heap statistics */
+static esp_err_t espirc_sendq_lane_init(espirc_sendq_t *sendq, irc_sendq_lane_t lane, size_t size)
+{
+    /* Storage of a no-split ring buffer must be 32-bit aligned */
+    size = (size + 3) & ~3;
+
+    sendq->lane_storage[lane] = espirc_malloc(size);
+    if (!sendq->lane_storage[lane])
+        return ESP_ERR_NO_MEM;
+
+    sendq->lane[lane] = xRingbufferCreateStatic(size, RINGBUF_TYPE_NOSPLIT,
+        sendq->lane_storage[lane], &sendq->lane_struct[lane]);
+    if (!sendq->lane[lane])
+        return ESP_ERR_NO_MEM;
+
+    return ESP_OK;
+}
+
+esp_err_t espirc_sendq_init(espirc_sendq_t *sendq, const irc_config_t *config)
+{
+    sendq->lock = xSemaphoreCreateRecursiveMutex();
+
+    if (!sendq->lock ||
+            espirc_sendq_lane_init(sendq, IRC_SENDQ_URGENT,
+                IRC_SENDQ_URGENT_SIZE + espirc_cap_urgent_size(config)) != ESP_OK ||
+            espirc_sendq_lane_init(sendq, IRC_SENDQ_BULK, config->sbuf_size) != ESP_OK) {
+        espirc_sendq_deinit(sendq);
+        return ESP_ERR_NO_MEM;
+    }
+
+    sendq->batch_size = config->wbuf_size;
+    sendq->line_max = IRC_LINE_MAX;
+
+    /*
+     * RFC 1459 style flood timer: every line moves the timer ahead by the
+     * flood interval and lines are held back while it runs more than
+     * (burst - 1) intervals ahead of now.
+     */
+    if (!config->flood_disable) {
+        sendq->flood_interval = config->flood_interval_ms * 1000LL;
+        sendq->flood_window = (config->flood_burst - 1) * sendq->flood_interval;
+    }
+
+    return ESP_OK;
+}
+
+void espirc_sendq_deinit(espirc_sendq_t *sendq)
+{
+    for (int i = 0; i < IRC_SENDQ_LANES; i++) {
+        if (sendq->lane[i])
+            vRingbufferDelete(sendq->lane[i]);
+
+        espirc_free(sendq->lane_storage[i]);
+
+        sendq->lane[i] = NULL;
+        sendq->lane_storage[i] = NULL;
+    }
+
+    if (sendq->lock)
+        vSemaphoreDelete(sendq->lock);
+
+    sendq->lock = NULL;
+}
+
+/* Drop everything left over from a previous connection */
+void espirc_sendq_clear(espirc_sendq_t *sendq)
+{
+    size_t len;
+    void *item;
+
+    for (int i = 0; i < sendq->count; i++)
+        vRingbufferReturnItem(sendq->lane[sendq->item_lane[i]], sendq->iov[i].iov_base);
+
+    if (sendq->spill)
+        vRingbufferReturnItem(sendq->lane[sendq->spill_lane], sendq->spill);
+
+    sendq->count = 0;
+    sendq->len = 0;
+    sendq->sent = 0;
+    sendq->spill = NULL;
+
+    for (int i = 0; i < IRC_SENDQ_LANES; i++) {
+        while ((item = xRingbufferReceive(sendq->lane[i], &len, 0)))
+            vRingbufferReturnItem(sendq->lane[i], item);
+    }
+
+    sendq->flood_timer = 0;
+    sendq->stalled = false;
+}
+
+/*
+ * Reserve room for a line of len bytes (excl. CRLF) in the queue, to be
+ * written in place and then queued with espirc_sendq_queue(). Lines go out
+ * in the order they were reserved in.
+ *
+ * Never waits for room: if the queue has no room for the line, ESP_ERR_NO_MEM
+ * is returned and it's up to the caller to retry later. A bulk line may wait
+ * for another task that holds the queue to finish reserving, which doesn't
+ * wait for anything either. The urgent lane doesn't take the lock at all.
+ */
+esp_err_t espirc_sendq_reserve(espirc_sendq_t *sendq, irc_sendq_lane_t lane, size_t len,
+                                char **line)
+{
+    BaseType_t ret;
+
+    if (len > sendq->line_max)
+        return ESP_ERR_INVALID_ARG;
+
+    if (lane == IRC_SENDQ_BULK)
+        espirc_sendq_hold(sendq);
+
+    ret = xRingbufferSendAcquire(sendq->lane[lane], (void **) line, len + 2, 0);
+
+    if (lane == IRC_SENDQ_BULK)
+        espirc_sendq_release(sendq);
+
+    if (ret != pdTRUE) {
+        __atomic_fetch_add(&sendq->dropped, 1, __ATOMIC_RELAXED);
+        return ESP_ERR_NO_MEM;
+    }
+
+    return ESP_OK;
+}
+
+void espirc_sendq_queue(espirc_sendq_t *sendq, irc_sendq_lane_t lane, char *line, size_t len)
+{
+    memcpy(line + len, "\r\n", 2);
+
+    ESP_LOGD(TAG, "<< %.*s", (int) len, line);
+
+    xRingbufferSendComplete(sendq->lane[lane], line);
+}
+
+/*
+ * Bulk lines reserved by other tasks go after, not between the lines reserved
+ * until released. Nothing but reserving is to be done while held.
+ */
+void espirc_sendq_hold(espirc_sendq_t *sendq)
+{
+    xSemaphoreTakeRecursive(sendq->lock, portMAX_DELAY);
+}
+
+void espirc_sendq_release(espirc_sendq_t *sendq)
+{
+    xSemaphoreGiveRecursive(sendq->lock);
+}
+
+/* Format a line straight into the queue */
+esp_err_t espirc_sendq_vpush(espirc_sendq_t *sendq, irc_sendq_lane_t lane,
+                                    const char *fmt, va_list ap)
+{
+    va_list aq;
+    esp_err_t err;
+    char *item;
+    int len;
+
+    va_copy(aq, ap);
+    len = vsnprintf(NULL, 0, fmt, aq);
+    va_end(aq);
+
+    if (len < 0)
+        return ESP_ERR_INVALID_ARG;
+
+    err = espirc_sendq_reserve(sendq, lane, len, &item);
+    if (err != ESP_OK)
+        return err;
+
+    /* The NUL byte written by vsnprintf is replaced by the CRLF */
+    vsnprintf(item, len + 1, fmt, ap);
+    espirc_sendq_queue(sendq, lane, item, len);
+
+    return ESP_OK;
+}
+
+static UBaseType_t espirc_sendq_depth(espirc_sendq_t *sendq, irc_sendq_lane_t lane)
+{
+    UBaseType_t waiting;
+
+    vRingbufferGetInfo(sendq->lane[lane], NULL, NULL, NULL, NULL, &waiting);
+
+    return waiting;
+}
+
+/*
+ * Write out the batch and release its lines. Returns ESP_ERR_NOT_FINISHED if
+ * the socket is full, the batch is then kept as is until it can take the rest.
+ */
+static esp_err_t espirc_sendq_commit(irc_handle_t client)
+{
+    espirc_sendq_t *sendq = &client->sendq;
+    ssize_t ret;
+
+    if (!sendq->count)
+        return ESP_OK;
+
+    ret = espirc_socket_writev(client, sendq->iov, sendq->count, sendq->sent);
+
+    if (ret > 0) {
+        IRC_STAT_ADD(client, bytes_sent, ret);
+        sendq->sent += ret;
+    }
+
+    if (ret >= 0 && sendq->sent < sendq->len) {
+        ESP_LOGD(TAG, "Socket is full, %zu of %zu bytes left", sendq->len - sendq->sent,
+            sendq->len);
+        return ESP_ERR_NOT_FINISHED;
+    }
+
+    /* Lines are released in the order they were received */
+    for (int i = 0; i < sendq->count; i++)
+        vRingbufferReturnItem(sendq->lane[sendq->item_lane[i]], sendq->iov[i].iov_base);
+
+    ESP_LOGD(TAG, "Wrote %d lines (%zu bytes)", sendq->count, sendq->len);
+
+    if (ret >= 0)
+        IRC_STAT_ADD(client, lines_sent, sendq->count);
+
+    sendq->count = 0;
+    sendq->len = 0;
+    sendq->sent = 0;
+
+    if (ret < 0) {
+        ESP_LOGE(TAG, "Failed to send message (%d)", errno);
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
+
+/*
+ * Add the next line of a lane to the batch, writing out the batch if it's
+ * full. A line left over from a full socket goes first, whatever the lane.
+ */
+static esp_err_t espirc_sendq_gather(irc_handle_t client, irc_sendq_lane_t lane, int64_t now)
+{
+    espirc_sendq_t *sendq = &client->sendq;
+    esp_err_t err;
+    size_t len;
+    char *item;
+
+    if (sendq->spill) {
+        item = sendq->spill;
+        len = sendq->spill_len;
+        lane = sendq->spill_lane;
+        sendq->spill = NULL;
+    } else {
+        item = xRingbufferReceive(sendq->lane[lane], &len, 0);
+        if (!item)
+            return ESP_ERR_NOT_FOUND;
+
+        if (sendq->flood_timer < now)
+            sendq->flood_timer = now;
+
+        sendq->flood_timer += sendq->flood_interval;
+    }
+
+    if (sendq->count == IRC_SENDQ_BATCH_MAX || sendq->len + len > sendq->batch_size) {
+        err = espirc_sendq_commit(client);
+        if (err == ESP_ERR_NOT_FINISHED) {
+            sendq->spill = item;
+            sendq->spill_len = len;
+            sendq->spill_lane = lane;
+            return err;
+        }
+
+        if (err != ESP_OK) {
+            vRingbufferReturnItem(sendq->lane[lane], item);
+            return err;
+        }
+    }
+
+    sendq->iov[sendq->count].iov_base = item;
+    sendq->iov[sendq->count].iov_len = len;
+    sendq->item_lane[sendq->count] = lane;
+    sendq->count++;
+    sendq->len += len;
+
+    return ESP_OK;
+}
+
+/* Whether part of a batch is waiting for the socket to become writable */
+bool espirc_sendq_blocked(espirc_sendq_t *sendq)
+{
+    return sendq->count > 0;
+}
+
+/*
+ * Write out every queued line flood control allows, only to be called from
+ * the IRC task. If bulk lines are being held back, wait_us is set to the time
+ * until the next one may go out, otherwise it's set to -1. A full socket
+ * isn't an error, the rest goes out once espirc_sendq_blocked() clears.
+ */
+esp_err_t espirc_sendq_flush(irc_handle_t client, int64_t *wait_us)
+{
+    espirc_sendq_t *sendq = &client->sendq;
+    int64_t now = esp_timer_get_time();
+    int64_t ahead;
+    esp_err_t err;
+
+    *wait_us = -1;
+
+    /* What's left of a batch the socket was too full for */
+    if (espirc_sendq_blocked(sendq)) {
+        err = espirc_sendq_commit(client);
+        if (err != ESP_OK)
+            return err == ESP_ERR_NOT_FINISHED ? ESP_OK : err;
+    }
+
+    while ((err = espirc_sendq_gather(client, IRC_SENDQ_URGENT, now)) == ESP_OK);
+    if (err == ESP_ERR_NOT_FINISHED)
+        return ESP_OK;
+    if (err != ESP_ERR_NOT_FOUND)
+        return err;
+
+    for (;;) {
+        ahead = sendq->flood_timer - now;
+        if (ahead > sendq->flood_window) {
+            if (espirc_sendq_depth(sendq, IRC_SENDQ_BULK)) {
+                *wait_us = ahead - sendq->flood_window;
+                sendq->stalled = true;
+            }
+            break;
+        }
+
+        err = espirc_sendq_gather(client, IRC_SENDQ_BULK, now);
+        if (err == ESP_ERR_NOT_FOUND)
+            break;
+        if (err == ESP_ERR_NOT_FINISHED)
+            return ESP_OK;
+        if (err != ESP_OK)
+            return err;
+
+        if (sendq->stalled) {
+            sendq->delayed++;
+            sendq->stalled = false;
+        }
+    }
+
+    err = espirc_sendq_commit(client);
+
+    return err == ESP_ERR_NOT_FINISHED ? ESP_OK : err;
+}
+
+void espirc_sendq_stats(espirc_sendq_t *sendq, irc_sendq_stats_t *stats)
+{
+    stats->urgent_depth = espirc_sendq_depth(sendq, IRC_SENDQ_URGENT);
+    stats->bulk_depth = espirc_sendq_depth(sendq, IRC_SENDQ_BULK);
+    stats->dropped = __atomic_load_n(&sendq->dropped, __ATOMIC_RELAXED);
+    stats->delayed = sendq->delayed;
+}
@@ -0,0 +1,94 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * Copyright (c) 2024 Danct12
+ */
+
+#ifndef __ESPIRC_SENDQ_H__
+#define __ESPIRC_SENDQ_H__
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/ringbuf.h"
+#include "freertos/semphr.h"
+
+#include "espirc.h"
+#include "esp_err.h"
+
+/* Maximum number of lines coalesced into a single write */
+#define IRC_SENDQ_BATCH_MAX 8
+
+typedef enum {
+    IRC_SENDQ_URGENT,
+    IRC_SENDQ_BULK,
+    IRC_SENDQ_LANES
+} irc_sendq_lane_t;
+
+/*
+ * Outbound queue of preformatted lines (incl. CRLF).
+ *
+ * Any task may push lines, only the IRC task pops them and writes them to the
+ * socket, so lines from different tasks never interleave on the wire.
+ *
+ * Lines in the urgent lane (PONG, QUIT) are always written first and are not
+ * held back by flood control, bulk lines are paced by the flood timer.
+ *
+ * Whatever is ready to go out is coalesced into a batch of up to wbuf_size
+ * bytes, which is then written to the socket at once. If a non-blocking
+ * socket only takes part of it, the batch is kept until the rest is written.
+ */
+typedef struct {
+    RingbufHandle_t lane[IRC_SENDQ_LANES];
+    StaticRingbuffer_t lane_struct[IRC_SENDQ_LANES];
+    uint8_t *lane_storage[IRC_SENDQ_LANES];
+
+    /*
+     * Held while reserving a bulk line, and by espirc_sendq_hold() across
+     * reserving the lines of a message that must stay together
+     */
+    SemaphoreHandle_t lock;
+
+    /* Lines gathered for the next write, of which sent bytes are written */
+    struct iovec iov[IRC_SENDQ_BATCH_MAX];
+    irc_sendq_lane_t item_lane[IRC_SENDQ_BATCH_MAX];
+    int count;
+    size_t len;
+    size_t sent;
+    size_t batch_size;
+
+    /* A line that didn't fit into a batch that's still being written */
+    char *spill;
+    size_t spill_len;
+    irc_sendq_lane_t spill_lane;
+
+    /* Longest line (excl. CRLF), follows the server's LINELEN */
+    size_t line_max;
+
+    /* Flood control */
+    int64_t flood_timer;
+    int64_t flood_interval;
+    int64_t flood_window;
+    bool stalled;
+
+    /* Statistics */
+    uint32_t dropped;
+    uint32_t delayed;
+} espirc_sendq_t;
+
+esp_err_t espirc_sendq_init(espirc_sendq_t *sendq, const irc_config_t *config);
+void espirc_sendq_deinit(espirc_sendq_t *sendq);
+void espirc_sendq_clear(espirc_sendq_t *sendq);
+esp_err_t espirc_sendq_reserve(espirc_sendq_t *sendq, irc_sendq_lane_t lane, size_t len,
+                                char **line);
+void espirc_sendq_queue(espirc_sendq_t *sendq, irc_sendq_lane_t lane, char *line, size_t len);
+void espirc_sendq_hold(espirc_sendq_t *sendq);
+void espirc_sendq_release(espirc_sendq_t *sendq);
+esp_err_t espirc_sendq_vpush(espirc_sendq_t *sendq, irc_sendq_lane_t lane,
+                                    const char *fmt, va_list ap);
+esp_err_t espirc_sendq_flush(irc_handle_t client, int64_t *wait_us);
+bool espirc_sendq_blocked(espirc_sendq_t *sendq);
+void espirc_sendq_stats(espirc_sendq_t *sendq, irc_sendq_stats_t *stats);
+#endif
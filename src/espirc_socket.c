@@ -3,15 +3,30 @@
  * Copyright (c) 2024 Danct12
  */
 
+#include <stdio.h>
+#include <string.h>
 #include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <netdb.h>
+#include <sys/param.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
 
 #include "espirc.h"
+#include "espirc_capture.h"
+#include "espirc_mem.h"
+#include "espirc_priv.h"
+#include "espirc_sendq.h"
 #include "espirc_socket.h"
 
 #include "esp_err.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 
 #ifdef CONFIG_ESPIRC_SUPPORT_TLS
 #include "esp_tls.h"
@@ -19,91 +34,595 @@
 
 static const char* TAG = "espirc_socket";
 
-esp_err_t espirc_socket_connect(irc_handle_t client)
+/* A peer that went away should fail the write with EPIPE, not raise SIGPIPE */
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+/* Stack of the task a reconnect looks the host up on */
+#define IRC_RESOLVE_STACK_SIZE 3072
+
+/*
+ * A lookup on a task of its own, so that a slow resolver holds up neither
+ * the IRC task nor the other clients of an engine. The client may give up
+ * on it before it's done, whichever of the two is done with it last frees
+ * it. The lock keeps the task from waking a client that's gone.
+ */
+struct espirc_resolve {
+    SemaphoreHandle_t lock;
+    int refs;
+    bool done;
+    bool abandoned;
+    int wake_fd;
+    struct addrinfo *res;
+    char port[6];
+    char host[];
+};
+
+static struct addrinfo *espirc_socket_lookup(const char *host, const char *port)
 {
     struct addrinfo hints, *res;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    if (getaddrinfo(host, port, &hints, &res) != 0) {
+        ESP_LOGE(TAG, "getaddrinfo failed");
+        return NULL;
+    }
+
+    return res;
+}
+
+/*
+ * Order the looked up addresses the way they will be tried: alternating
+ * between address families, starting with the one the resolver preferred
+ * (RFC 8305).
+ */
+static void espirc_socket_order(espirc_connect_t *conn)
+{
+    struct addrinfo *family[2][IRC_CONNECT_ADDRS_MAX];
+    struct addrinfo *ai;
+    int count[2] = { 0 }, i;
+
+    for (ai = conn->res; ai; ai = ai->ai_next) {
+        i = ai->ai_family != conn->res->ai_family;
+        if (count[i] < IRC_CONNECT_ADDRS_MAX)
+            family[i][count[i]++] = ai;
+    }
+
+    conn->addrs_count = 0;
+    for (i = 0; i < count[0] || i < count[1]; i++) {
+        if (i < count[0] && conn->addrs_count < IRC_CONNECT_ADDRS_MAX)
+            conn->addrs[conn->addrs_count++] = family[0][i];
+        if (i < count[1] && conn->addrs_count < IRC_CONNECT_ADDRS_MAX)
+            conn->addrs[conn->addrs_count++] = family[1][i];
+    }
+
+    ESP_LOGD(TAG, "Resolved %d addresses", conn->addrs_count);
+}
+
+/* Resolve the server on the calling task */
+esp_err_t espirc_socket_resolve(irc_handle_t client)
+{
+    espirc_connect_t *conn = &client->connect;
     char port[6];
 
     if (!client->config.host && !client->config.port)
         return ESP_ERR_INVALID_ARG;
 
-    if (client->socket)
+    if (conn->step != IRC_CONNECT_IDLE)
         return ESP_ERR_INVALID_STATE;
 
-#ifdef CONFIG_ESPIRC_SUPPORT_TLS
-    if (client->tls_ptr)
-        return ESP_ERR_INVALID_STATE;
+    espirc_socket_forget(client);
 
-    if (client->config.tls) {
-        client->tls_ptr = esp_tls_init();
-        if (!client->tls_ptr)
-            return ESP_ERR_NO_MEM;
+#ifdef CONFIG_ESPIRC_CAPTURE
+    /* Nothing to look up, the recording stands in for the server */
+    if (client->replay)
+        return ESP_OK;
+#endif
 
-        if (esp_tls_conn_new_sync(client->config.host, strlen(client->config.host),
-            client->config.port, &client->config.tls_cfg, client->tls_ptr) < 0)
-            goto esp_tls_failure;
+    if (snprintf(port, sizeof(port), "%d", client->config.port) < 0)
+        return ESP_ERR_INVALID_ARG;
 
-        esp_tls_get_conn_sockfd(client->tls_ptr, &client->socket);
-    } else
-#endif
-    {
-        if (sprintf(port, "%d", client->config.port) < 0)
-            return ESP_ERR_INVALID_ARG;
+    conn->res = espirc_socket_lookup(client->config.host, port);
+    if (!conn->res)
+        return ESP_FAIL;
+
+    espirc_socket_order(conn);
+
+    return ESP_OK;
+}
+
+static void espirc_socket_resolve_put(espirc_resolve_t *req)
+{
+    if (__atomic_sub_fetch(&req->refs, 1, __ATOMIC_ACQ_REL))
+        return;
+
+    if (req->res)
+        freeaddrinfo(req->res);
+
+    vSemaphoreDelete(req->lock);
+    espirc_free(req);
+}
+
+static void espirc_socket_resolve_task(void *args)
+{
+    espirc_resolve_t *req = args;
+    struct addrinfo *res = espirc_socket_lookup(req->host, req->port);
+    uint64_t count = 1;
+
+    xSemaphoreTake(req->lock, portMAX_DELAY);
+    req->res = res;
+    req->done = true;
+    if (!req->abandoned)
+        write(req->wake_fd, &count, sizeof(count));
+    xSemaphoreGive(req->lock);
+
+    espirc_socket_resolve_put(req);
+    vTaskDelete(NULL);
+}
+
+/* Start looking up the server on a task of its own */
+static esp_err_t espirc_socket_resolve_start(irc_handle_t client, int64_t now)
+{
+    espirc_connect_t *conn = &client->connect;
+    size_t len = strlen(client->config.host);
+    espirc_resolve_t *req;
+
+    req = espirc_calloc(1, sizeof(*req) + len + 1);
+    if (!req)
+        return ESP_ERR_NO_MEM;
+
+    req->lock = xSemaphoreCreateMutex();
+    if (!req->lock) {
+        espirc_free(req);
+        return ESP_ERR_NO_MEM;
+    }
+
+    req->refs = 2;
+    req->wake_fd = client->wake_fd;
+    snprintf(req->port, sizeof(req->port), "%d", client->config.port);
+    memcpy(req->host, client->config.host, len + 1);
+
+    if (xTaskCreate(espirc_socket_resolve_task, "irc_resolve", IRC_RESOLVE_STACK_SIZE, req,
+            client->config.task_priority, NULL) != pdTRUE) {
+        ESP_LOGE(TAG, "Failed to create lookup task");
+        vSemaphoreDelete(req->lock);
+        espirc_free(req);
+        return ESP_FAIL;
+    }
+
+    conn->resolve = req;
+    conn->step = IRC_CONNECT_RESOLVE;
+    conn->deadline = now + client->config.connect_timeout_ms * 1000LL;
+
+    return ESP_OK;
+}
+
+/* Leave a lookup that's still running to finish and clean up by itself */
+static void espirc_socket_resolve_cancel(espirc_connect_t *conn)
+{
+    espirc_resolve_t *req = conn->resolve;
+
+    if (!req)
+        return;
 
-        memset(&hints, 0, sizeof(hints));
-        hints.ai_family = AF_UNSPEC;
-        hints.ai_socktype = SOCK_STREAM;
+    xSemaphoreTake(req->lock, portMAX_DELAY);
+    req->abandoned = true;
+    xSemaphoreGive(req->lock);
 
-        if (getaddrinfo(client->config.host, port, &hints, &res) != 0) {
-            ESP_LOGE(TAG, "getaddrinfo failed");
+    espirc_socket_resolve_put(req);
+    conn->resolve = NULL;
+}
+
+/* Pick up the addresses once the lookup task is done */
+static esp_err_t espirc_socket_resolve_service(irc_handle_t client, int64_t now)
+{
+    espirc_connect_t *conn = &client->connect;
+    espirc_resolve_t *req = conn->resolve;
+    bool done;
+
+    xSemaphoreTake(req->lock, portMAX_DELAY);
+    done = req->done;
+    if (done) {
+        conn->res = req->res;
+        req->res = NULL;
+    }
+    xSemaphoreGive(req->lock);
+
+    if (!done) {
+        if (now < conn->deadline)
+            return ESP_ERR_NOT_FINISHED;
+
+        ESP_LOGE(TAG, "Lookup of %s timed out", client->config.host);
+        espirc_socket_resolve_cancel(conn);
+        return ESP_ERR_TIMEOUT;
+    }
+
+    espirc_socket_resolve_put(req);
+    conn->resolve = NULL;
+
+    if (!conn->res)
+        return ESP_FAIL;
+
+    espirc_socket_order(conn);
+
+    return ESP_OK;
+}
+
+/* Start a non-blocking connect to the next address */
+static esp_err_t espirc_socket_attempt(espirc_connect_t *conn, int slot)
+{
+    struct addrinfo *ai = conn->addrs[conn->addrs_next++];
+    int fd;
+
+    fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (fd < 0) {
+        ESP_LOGE(TAG, "Socket creation failed (%d)", errno);
+        return ESP_FAIL;
+    }
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+
+    if (connect(fd, ai->ai_addr, ai->ai_addrlen) < 0 && errno != EINPROGRESS) {
+        ESP_LOGD(TAG, "Failed to connect (%d)", errno);
+        close(fd);
+        return ESP_FAIL;
+    }
+
+    conn->fds[slot] = fd;
+
+    return ESP_OK;
+}
+
+/* Start the next attempt in a free slot, skipping addresses that fail outright */
+static void espirc_socket_attempt_next(irc_handle_t client, int64_t now)
+{
+    espirc_connect_t *conn = &client->connect;
+
+    for (int i = 0; i < IRC_CONNECT_RACE_MAX; i++) {
+        if (conn->fds[i] >= 0)
+            continue;
+
+        while (conn->addrs_next < conn->addrs_count) {
+            if (espirc_socket_attempt(conn, i) == ESP_OK) {
+                conn->next_at = now + client->config.connect_stagger_ms * 1000LL;
+                return;
+            }
+        }
+    }
+}
+
+static void espirc_socket_abort(espirc_connect_t *conn)
+{
+    for (int i = 0; i < IRC_CONNECT_RACE_MAX; i++) {
+        if (conn->fds[i] >= 0)
+            close(conn->fds[i]);
+        conn->fds[i] = -1;
+    }
+}
+
+/* Drop the cached addresses, the next connection resolves the host again */
+void espirc_socket_forget(irc_handle_t client)
+{
+    espirc_connect_t *conn = &client->connect;
+
+    espirc_socket_resolve_cancel(conn);
+
+    if (conn->res)
+        freeaddrinfo(conn->res);
+
+    conn->res = NULL;
+    conn->addrs_count = 0;
+    conn->addrs_next = 0;
+}
+
+/* Start racing connections to the resolved addresses */
+static void espirc_socket_connect_tcp(irc_handle_t client, int64_t now)
+{
+    espirc_connect_t *conn = &client->connect;
+
+    for (int i = 0; i < IRC_CONNECT_RACE_MAX; i++)
+        conn->fds[i] = -1;
+
+    conn->step = IRC_CONNECT_TCP;
+    conn->addrs_next = 0;
+    conn->next_at = now;
+    conn->deadline = now + client->config.connect_timeout_ms * 1000LL;
+}
+
+/*
+ * Start connecting to the resolved addresses, which are kept for reconnecting
+ * until espirc_socket_forget(). Without any, the host is looked up again on a
+ * task of its own first. The connection is then driven
+ * by espirc_socket_connect_prepare() and espirc_socket_connect_service() from
+ * the select() loop of the IRC task or engine.
+ */
+esp_err_t espirc_socket_connect(irc_handle_t client)
+{
+    espirc_connect_t *conn = &client->connect;
+    int64_t now = esp_timer_get_time();
+
+#ifdef CONFIG_ESPIRC_CAPTURE
+    if (client->replay && conn->step == IRC_CONNECT_IDLE) {
+        if (espirc_replay_connect(client) != ESP_OK)
             return ESP_FAIL;
+
+        conn->step = IRC_CONNECT_DONE;
+        conn->deadline = now + client->config.handshake_timeout_ms * 1000LL;
+        return ESP_OK;
+    }
+#endif
+
+    if (conn->step != IRC_CONNECT_IDLE)
+        return ESP_ERR_INVALID_STATE;
+
+    if (!conn->addrs_count)
+        return espirc_socket_resolve_start(client, now);
+
+    espirc_socket_connect_tcp(client, now);
+
+    return ESP_OK;
+}
+
+void espirc_socket_connect_prepare(irc_handle_t client, fd_set *rfds, fd_set *wfds,
+                                    int *maxfd, int64_t *wait)
+{
+    espirc_connect_t *conn = &client->connect;
+    int64_t now = esp_timer_get_time();
+
+    if (conn->step == IRC_CONNECT_TCP) {
+        for (int i = 0; i < IRC_CONNECT_RACE_MAX; i++) {
+            if (conn->fds[i] < 0)
+                continue;
+
+            FD_SET(conn->fds[i], wfds);
+            *maxfd = MAX(*maxfd, conn->fds[i]);
         }
 
-        client->socket = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
-        if (client->socket < 0) {
-            ESP_LOGE(TAG, "Socket creation failed (%d)", errno);
-            goto plain_failure;
+        if (conn->addrs_next < conn->addrs_count)
+            irc_io_wait_min(wait, MAX(conn->next_at - now, 0));
+    } else if (conn->step == IRC_CONNECT_TLS) {
+        FD_SET(client->socket, rfds);
+        *maxfd = MAX(*maxfd, client->socket);
+    }
+
+    irc_io_wait_min(wait, MAX(conn->deadline - now, 0));
+}
+
+/*
+ * Move the connection along. Returns ESP_ERR_NOT_FINISHED while connecting,
+ * ESP_OK once the socket (and TLS session) is established.
+ */
+esp_err_t espirc_socket_connect_service(irc_handle_t client, fd_set *rfds, fd_set *wfds)
+{
+    espirc_connect_t *conn = &client->connect;
+    int64_t now = esp_timer_get_time();
+    socklen_t optlen;
+    int err;
+
+    if (conn->step == IRC_CONNECT_RESOLVE) {
+        err = espirc_socket_resolve_service(client, now);
+        if (err != ESP_OK)
+            return err;
+
+        espirc_socket_connect_tcp(client, now);
+        return ESP_ERR_NOT_FINISHED;
+    }
+
+    if (conn->step == IRC_CONNECT_TCP) {
+        for (int i = 0; i < IRC_CONNECT_RACE_MAX && !client->socket; i++) {
+            if (conn->fds[i] < 0 || !FD_ISSET(conn->fds[i], wfds))
+                continue;
+
+            optlen = sizeof(err);
+            if (getsockopt(conn->fds[i], SOL_SOCKET, SO_ERROR, &err, &optlen) < 0 || err) {
+                ESP_LOGD(TAG, "Connection attempt failed (%d)", err);
+                close(conn->fds[i]);
+                conn->fds[i] = -1;
+
+                /* Don't wait for the stagger delay after a failure */
+                conn->next_at = now;
+                continue;
+            }
+
+            client->socket = conn->fds[i];
+            conn->fds[i] = -1;
         }
 
-        if (connect(client->socket, res->ai_addr, res->ai_addrlen) < 0) {
-            ESP_LOGE(TAG, "Failed to connect (%d)", errno);
-            goto plain_failure;
+        if (!client->socket) {
+            if (now >= conn->deadline) {
+                ESP_LOGE(TAG, "Connect timed out");
+
+                /* Addresses that weren't tried yet may still work next time */
+                if (conn->addrs_next >= conn->addrs_count)
+                    espirc_socket_forget(client);
+                return ESP_ERR_TIMEOUT;
+            }
+
+            if (now >= conn->next_at)
+                espirc_socket_attempt_next(client, now);
+
+            for (int i = 0; i < IRC_CONNECT_RACE_MAX; i++) {
+                if (conn->fds[i] >= 0)
+                    return ESP_ERR_NOT_FINISHED;
+            }
+
+            /* The addresses may be stale, look them up again next time */
+            ESP_LOGE(TAG, "Failed to connect to any address");
+            espirc_socket_forget(client);
+            return ESP_FAIL;
         }
 
-        freeaddrinfo(res);
-    }
+        /* Drop the attempts that lost the race */
+        espirc_socket_abort(conn);
+        conn->deadline = now + client->config.handshake_timeout_ms * 1000LL;
+        conn->step = IRC_CONNECT_DONE;
 
-    return ESP_OK;
+#ifdef CONFIG_ESPIRC_SUPPORT_TLS
+        if (client->config.tls) {
+            client->tls_ptr = esp_tls_init();
+            if (!client->tls_ptr)
+                return ESP_ERR_NO_MEM;
+
+#ifdef CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+            /* Resume the previous session if there's one */
+            client->config.tls_cfg.client_session = client->tls_session;
+#endif
+
+            /* Let esp_tls take over the connected socket */
+            esp_tls_set_conn_sockfd(client->tls_ptr, client->socket);
+            esp_tls_set_conn_state(client->tls_ptr, ESP_TLS_CONNECTING);
+            conn->step = IRC_CONNECT_TLS;
+        }
+#endif
+    }
 
 #ifdef CONFIG_ESPIRC_SUPPORT_TLS
-esp_tls_failure:
-    esp_tls_conn_destroy(client->tls_ptr);
-    return ESP_FAIL;
+    if (conn->step == IRC_CONNECT_TLS) {
+        err = esp_tls_conn_new_async(client->config.host, strlen(client->config.host),
+            client->config.port, &client->config.tls_cfg, client->tls_ptr);
+        if (err < 0) {
+            ESP_LOGE(TAG, "TLS handshake failed");
+#ifdef CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+            if (client->tls_session) {
+                esp_tls_free_client_session(client->tls_session);
+                client->tls_session = NULL;
+            }
+#endif
+            return ESP_FAIL;
+        }
+
+        if (err == 0) {
+            if (now >= conn->deadline) {
+                ESP_LOGE(TAG, "TLS handshake timed out");
+                return ESP_ERR_TIMEOUT;
+            }
+
+            return ESP_ERR_NOT_FINISHED;
+        }
+
+        conn->step = IRC_CONNECT_DONE;
+    }
 #endif
 
-plain_failure:
-    freeaddrinfo(res);
-    return ESP_FAIL;
+    /*
+     * A task of its own may block on its socket. Sockets of an engine stay
+     * non-blocking, so that a peer that doesn't keep up only holds up itself.
+     */
+    if (!client->config.engine)
+        fcntl(client->socket, F_SETFL, fcntl(client->socket, F_GETFL, 0) & ~O_NONBLOCK);
+
+    ESP_LOGD(TAG, "Socket: %d", client->socket);
+
+    espirc_capture_record(client, IRC_CAPTURE_CONNECT, NULL, 0);
+
+    return ESP_OK;
 }
 
 esp_err_t espirc_socket_close(irc_handle_t client)
 {
-    int ret;
+    int ret = 0;
+
+    espirc_socket_resolve_cancel(&client->connect);
+    espirc_socket_abort(&client->connect);
+
+    if (client->connect.step == IRC_CONNECT_DONE)
+        espirc_capture_record(client, IRC_CAPTURE_CLOSE, NULL, 0);
 
 #ifdef CONFIG_ESPIRC_SUPPORT_TLS
-    if (client->tls_ptr)
+    if (client->tls_ptr) {
+#ifdef CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+        /* Keep the session around to skip the full handshake next time */
+        if (client->connect.step == IRC_CONNECT_DONE) {
+            esp_tls_client_session_t *session = esp_tls_get_client_session(client->tls_ptr);
+
+            if (session) {
+                if (client->tls_session)
+                    esp_tls_free_client_session(client->tls_session);
+                client->tls_session = session;
+            }
+        }
+#endif
         ret = esp_tls_conn_destroy(client->tls_ptr);
-    else
+        client->tls_ptr = NULL;
+    } else
 #endif
+    if (client->socket)
         ret = close(client->socket);
 
+    client->socket = 0;
+    client->connect.step = IRC_CONNECT_IDLE;
+
     return ret;
 }
 
+/* Whether the descriptors the client waits on in select() are still open */
+bool espirc_socket_valid(irc_handle_t client)
+{
+    espirc_connect_t *conn = &client->connect;
+
+    for (int i = 0; i < IRC_CONNECT_RACE_MAX; i++) {
+        if (conn->fds[i] >= 0 && fcntl(conn->fds[i], F_GETFL) < 0 && errno == EBADF)
+            return false;
+    }
+
+    return !client->socket || fcntl(client->socket, F_GETFL) >= 0 || errno != EBADF;
+}
+
+/* Add the connected socket to the select() read set */
+void espirc_socket_prepare(irc_handle_t client, fd_set *rfds, int *maxfd, int64_t *wait)
+{
+#ifdef CONFIG_ESPIRC_CAPTURE
+    /* There's no socket, wake up when the next record is due instead */
+    if (client->replay) {
+        irc_io_wait_min(wait, MAX(espirc_replay_wait(client), 0));
+        return;
+    }
+#endif
+
+    FD_SET(client->socket, rfds);
+    *maxfd = MAX(*maxfd, client->socket);
+}
+
+/* Whether espirc_socket_recv() won't block after select() */
+bool espirc_socket_readable(irc_handle_t client, fd_set *rfds)
+{
+#ifdef CONFIG_ESPIRC_CAPTURE
+    if (client->replay)
+        return espirc_replay_pending(client) > 0;
+#endif
+
+    return espirc_socket_pending(client) > 0 || FD_ISSET(client->socket, rfds);
+}
+
+/* Bytes that can be read without waiting for the socket */
+ssize_t espirc_socket_pending(irc_handle_t client)
+{
+#ifdef CONFIG_ESPIRC_CAPTURE
+    if (client->replay)
+        return espirc_replay_pending(client);
+#endif
+
+#ifdef CONFIG_ESPIRC_SUPPORT_TLS
+    if (client->tls_ptr)
+        return esp_tls_get_bytes_avail(client->tls_ptr);
+#endif
+
+    return 0;
+}
+
 ssize_t espirc_socket_recv(irc_handle_t client, void *buf, size_t buf_len)
 {
     int ret;
 
+#ifdef CONFIG_ESPIRC_CAPTURE
+    if (client->replay)
+        ret = espirc_replay_recv(client, buf, buf_len);
+    else
+#endif
 #ifdef CONFIG_ESPIRC_SUPPORT_TLS
     if (client->tls_ptr)
         ret = esp_tls_conn_read(client->tls_ptr, buf, buf_len);
@@ -111,19 +630,129 @@ ssize_t espirc_socket_recv(irc_handle_t client, void *buf, size_t buf_len)
 #endif
         ret = recv(client->socket, buf, buf_len, 0);
 
+#ifdef CONFIG_ESPIRC_SUPPORT_TLS
+    /* Only part of a record has arrived, nothing to read yet */
+    if (client->tls_ptr && (ret == ESP_TLS_ERR_SSL_WANT_READ ||
+            ret == ESP_TLS_ERR_SSL_WANT_WRITE)) {
+        errno = EAGAIN;
+        ret = -1;
+    }
+#endif
+
+    if (ret > 0)
+        espirc_capture_record(client, IRC_CAPTURE_RX, &(struct iovec) { buf, ret }, 1);
+
     return ret;
 }
 
-ssize_t espirc_socket_write(irc_handle_t client, const void *buf, size_t buf_len)
+/* Record the first len bytes of a batch, as far as a write got */
+static void espirc_socket_record_tx(irc_handle_t client, const struct iovec *iov, int iovcnt,
+                                    size_t len)
 {
-    int ret;
+#ifdef CONFIG_ESPIRC_CAPTURE
+    struct iovec sent[IRC_SENDQ_BATCH_MAX];
+    int n;
+
+    for (n = 0; n < iovcnt && len; n++) {
+        sent[n].iov_base = iov[n].iov_base;
+        sent[n].iov_len = MIN(iov[n].iov_len, len);
+        len -= sent[n].iov_len;
+    }
+
+    espirc_capture_record(client, IRC_CAPTURE_TX, sent, n);
+#endif
+}
+
+/*
+ * Write out a batch of buffers with as few writes as possible, skipping the
+ * first offset bytes which an earlier call already wrote. Plain sockets use
+ * scatter/gather, for TLS the batch is gathered into wbuf first so that it
+ * ends up in a single TLS record. The batch must not exceed wbuf_size bytes,
+ * nor IRC_SENDQ_BATCH_MAX buffers. The caller's iovecs are left as they are.
+ *
+ * Returns the bytes written from offset on, which fall short of the batch if
+ * a non-blocking socket is full, or -1 on error. The rest of the batch is
+ * then to be written again, unchanged, once the socket is writable.
+ */
+ssize_t espirc_socket_writev(irc_handle_t client, const struct iovec *iov, int iovcnt,
+                                size_t offset)
+{
+    struct iovec rest[IRC_SENDQ_BATCH_MAX], *next = rest;
+    struct msghdr msg = { 0 };
+    size_t total = 0;
+    ssize_t ret;
+
+    if (iovcnt < 0 || iovcnt > IRC_SENDQ_BATCH_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
+
+#ifdef CONFIG_ESPIRC_CAPTURE
+    if (client->replay) {
+        for (int i = 0; i < iovcnt; i++)
+            total += iov[i].iov_len;
+
+        espirc_socket_record_tx(client, iov, iovcnt, total);
+        return total - offset;
+    }
+#endif
 
 #ifdef CONFIG_ESPIRC_SUPPORT_TLS
-    if (client->tls_ptr)
-        ret = esp_tls_conn_write(client->tls_ptr, buf, buf_len);
-    else
+    if (client->tls_ptr) {
+        size_t len = 0;
+
+        /* Gathered again on a retry, TLS wants the same data passed again */
+        for (int i = 0; i < iovcnt; i++) {
+            memcpy(client->wbuf + len, iov[i].iov_base, iov[i].iov_len);
+            len += iov[i].iov_len;
+        }
+
+        for (total = offset; total < len; total += ret) {
+            ret = esp_tls_conn_write(client->tls_ptr, client->wbuf + total, len - total);
+            if (ret == ESP_TLS_ERR_SSL_WANT_WRITE || ret == ESP_TLS_ERR_SSL_WANT_READ)
+                break;
+            if (ret < 0)
+                return ret;
+
+            espirc_socket_record_tx(client,
+                &(struct iovec) { client->wbuf + total, ret }, 1, ret);
+        }
+
+        return total - offset;
+    }
 #endif
-        ret = write(client->socket, buf, buf_len);
 
-    return ret;
+    /* A partial write moves our copy along, not the caller's buffers */
+    memcpy(rest, iov, iovcnt * sizeof(*iov));
+    ret = offset;
+
+    for (;;) {
+        /* Skip over whatever made it out in case of a partial write */
+        while (iovcnt && (size_t) ret >= next->iov_len) {
+            ret -= next->iov_len;
+            next++;
+            iovcnt--;
+        }
+
+        if (!iovcnt)
+            break;
+
+        next->iov_base = (char *) next->iov_base + ret;
+        next->iov_len -= ret;
+
+        msg.msg_iov = next;
+        msg.msg_iovlen = iovcnt;
+
+        ret = sendmsg(client->socket, &msg, MSG_NOSIGNAL);
+        if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (ret < 0)
+            return ret;
+
+        /* Only what made it out is recorded, a failed write isn't */
+        espirc_socket_record_tx(client, next, iovcnt, ret);
+        total += ret;
+    }
+
+    return total;
 }
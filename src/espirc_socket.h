@@ -6,11 +6,56 @@
 #ifndef __ESPIRC_SOCKET_H__
 #define __ESPIRC_SOCKET_H__
 
+#include <netdb.h>
+#include <stdbool.h>
+#include <sys/select.h>
+#include <sys/uio.h>
+
 #include "espirc.h"
 #include "esp_err.h"
 
+/* Resolved addresses to try, and attempts in flight at once */
+#define IRC_CONNECT_ADDRS_MAX 8
+#define IRC_CONNECT_RACE_MAX 3
+
+typedef enum {
+    IRC_CONNECT_IDLE,
+    IRC_CONNECT_RESOLVE,
+    IRC_CONNECT_TCP,
+    IRC_CONNECT_TLS,
+    IRC_CONNECT_DONE,
+} irc_connect_step_t;
+
+typedef struct espirc_resolve espirc_resolve_t;
+
+typedef struct {
+    irc_connect_step_t step;
+
+    /* Lookup in progress on a task of its own, when reconnecting */
+    espirc_resolve_t *resolve;
+
+    struct addrinfo *res;
+    struct addrinfo *addrs[IRC_CONNECT_ADDRS_MAX];
+    int addrs_count;
+    int addrs_next;
+
+    int fds[IRC_CONNECT_RACE_MAX];
+    int64_t next_at;
+    int64_t deadline;
+} espirc_connect_t;
+
+esp_err_t espirc_socket_resolve(irc_handle_t client);
 esp_err_t espirc_socket_connect(irc_handle_t client);
+void espirc_socket_forget(irc_handle_t client);
+void espirc_socket_connect_prepare(irc_handle_t client, fd_set *rfds, fd_set *wfds,
+                                    int *maxfd, int64_t *wait);
+esp_err_t espirc_socket_connect_service(irc_handle_t client, fd_set *rfds, fd_set *wfds);
 esp_err_t espirc_socket_close(irc_handle_t client);
+bool espirc_socket_valid(irc_handle_t client);
+void espirc_socket_prepare(irc_handle_t client, fd_set *rfds, int *maxfd, int64_t *wait);
+bool espirc_socket_readable(irc_handle_t client, fd_set *rfds);
+ssize_t espirc_socket_pending(irc_handle_t client);
 ssize_t espirc_socket_recv(irc_handle_t client, void *buf, size_t buf_len);
-ssize_t espirc_socket_write(irc_handle_t client, const void *buf, size_t buf_len);
+ssize_t espirc_socket_writev(irc_handle_t client, const struct iovec *iov, int iovcnt,
+                                size_t offset);
 #endif
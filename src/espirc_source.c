@@ -0,0 +1,107 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * Copyright (c) 2024 Danct12
+ */
+
+#include <string.h>
+
+#include "espirc.h"
+#include "espirc_casemap.h"
+
+/* The offsets are recorded by the parser, nothing is scanned here */
+irc_view_t irc_source_nick(const irc_message_t *message)
+{
+    irc_view_t view = { message->source, 0 };
+
+    if (!message->source)
+        return view;
+
+    if (message->source_user)
+        view.len = message->source_user - 1;
+    else if (message->source_host)
+        view.len = message->source_host - 1;
+    else
+        view.len = strlen(message->source);
+
+    return view;
+}
+
+irc_view_t irc_source_user(const irc_message_t *message)
+{
+    irc_view_t view = { NULL, 0 };
+
+    if (!message->source || !message->source_user)
+        return view;
+
+    view.ptr = message->source + message->source_user;
+    if (message->source_host)
+        view.len = message->source_host - message->source_user - 1;
+    else
+        view.len = strlen(view.ptr);
+
+    return view;
+}
+
+irc_view_t irc_source_host(const irc_message_t *message)
+{
+    irc_view_t view = { NULL, 0 };
+
+    if (!message->source || !message->source_host)
+        return view;
+
+    view.ptr = message->source + message->source_host;
+    view.len = strlen(view.ptr);
+
+    return view;
+}
+
+bool irc_view_equal(irc_view_t view, const char *str)
+{
+    return view.ptr && !strncmp(view.ptr, str, view.len) && !str[view.len];
+}
+
+bool irc_view_equal_nocase(irc_view_t view, const char *str)
+{
+    size_t i;
+
+    if (!view.ptr)
+        return false;
+
+    for (i = 0; i < view.len; i++) {
+        if (!str[i] || irc_tolower(view.ptr[i]) != irc_tolower(str[i]))
+            return false;
+    }
+
+    return !str[i];
+}
+
+/*
+ * Match the source against a hostmask such as "*!*@example.com", where '*'
+ * matches any run of characters and '?' a single one. Case insensitive.
+ */
+bool irc_source_match(const irc_message_t *message, const char *mask)
+{
+    const char *s = message->source, *star = NULL, *retry = NULL;
+
+    if (!s || !mask)
+        return false;
+
+    while (*s) {
+        if (*mask == '*') {
+            star = ++mask;
+            retry = s;
+        } else if (*mask && (*mask == '?' || irc_tolower(*mask) == irc_tolower(*s))) {
+            mask++;
+            s++;
+        } else if (star) {
+            mask = star;
+            s = ++retry;
+        } else {
+            return false;
+        }
+    }
+
+    while (*mask == '*') mask++;
+
+    return !*mask;
+}
@@ -0,0 +1,286 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * Copyright (c) 2024 Danct12
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/param.h>
+
+#include "espirc.h"
+#include "espirc_isupport.h"
+#include "espirc_priv.h"
+#include "espirc_sendq.h"
+#include "espirc_split.h"
+
+#include "esp_err.h"
+#include "esp_log.h"
+
+static const char* TAG = "espirc_split";
+
+/* Assumed until the server tells us our host, as many servers cap it here */
+#define IRC_HOST_GUESS 63
+
+/* Smallest room for text that still gets a UTF-8 character across */
+#define IRC_SPLIT_MIN 4
+
+/* Reserved pieces kept track of at once, before they're written */
+#define IRC_SPLIT_BATCH 16
+
+static void espirc_split_set_nick(espirc_self_t *self, const char *nick, size_t len)
+{
+    snprintf(self->nick, sizeof(self->nick), "%.*s", (int) len, nick);
+    self->nick_len = MIN(len, UINT8_MAX);
+}
+
+static bool espirc_split_is_self(irc_handle_t client, irc_view_t nick)
+{
+    const uint8_t *lower = client->isupport.lower;
+    const espirc_self_t *self = &client->self;
+
+    if (!nick.ptr || nick.len != self->nick_len || nick.len > IRC_SELF_NICK_MAX)
+        return false;
+
+    for (size_t i = 0; i < nick.len; i++) {
+        if (lower[(uint8_t) nick.ptr[i]] != lower[(uint8_t) self->nick[i]])
+            return false;
+    }
+
+    return true;
+}
+
+/* Our nick from the config, with the user and host unknown */
+void espirc_split_reset(irc_handle_t client)
+{
+    espirc_self_t *self = &client->self;
+
+    espirc_split_set_nick(self, client->config.nick, strlen(client->config.nick));
+    self->user_len = 0;
+    self->host_len = 0;
+}
+
+/* Many servers end the welcome with our full source, "... nick!user@host" */
+static void espirc_split_welcome(irc_handle_t client, const char *text)
+{
+    espirc_self_t *self = &client->self;
+    const char *token = strrchr(text, ' '), *bang, *at;
+
+    token = token ? token + 1 : text;
+
+    bang = strchr(token, '!');
+    at = bang ? strchr(bang, '@') : NULL;
+    if (!at || !espirc_split_is_self(client, (irc_view_t) { token, bang - token }))
+        return;
+
+    self->user_len = MIN(at - bang - 1, UINT8_MAX);
+    self->host_len = MIN(strlen(at + 1), UINT8_MAX);
+}
+
+/* Keep up with our nick, user and host, as relayed by the server */
+void espirc_split_handle(irc_handle_t client, irc_message_t *message)
+{
+    espirc_self_t *self = &client->self;
+    irc_view_t user, host;
+
+    switch (message->verb_id) {
+        case IRC_RPL_WELCOME:
+            if (message->params_count)
+                espirc_split_set_nick(self, message->params[0], strlen(message->params[0]));
+            if (message->params_count >= 2)
+                espirc_split_welcome(client, message->params[message->params_count - 1]);
+            break;
+        case IRC_RPL_HOSTHIDDEN:
+            if (message->params_count >= 2)
+                self->host_len = MIN(strlen(message->params[1]), UINT8_MAX);
+            break;
+        case IRC_VERB_JOIN:
+            user = irc_source_user(message);
+            host = irc_source_host(message);
+            if (user.ptr && host.ptr && espirc_split_is_self(client, irc_source_nick(message))) {
+                self->user_len = MIN(user.len, UINT8_MAX);
+                self->host_len = MIN(host.len, UINT8_MAX);
+            }
+            break;
+        case IRC_VERB_CHGHOST:
+            if (message->params_count >= 2 &&
+                    espirc_split_is_self(client, irc_source_nick(message))) {
+                self->user_len = MIN(strlen(message->params[0]), UINT8_MAX);
+                self->host_len = MIN(strlen(message->params[1]), UINT8_MAX);
+            }
+            break;
+        case IRC_VERB_NICK:
+            if (message->params_count && espirc_split_is_self(client, irc_source_nick(message)))
+                espirc_split_set_nick(self, message->params[0], strlen(message->params[0]));
+            break;
+        default:
+            break;
+    }
+}
+
+/*
+ * Room for text in "<command> <target> :<text>", as the server relays it
+ * to others: ":<nick>!<user>@<host> <command> <target> :<text>\r\n" must
+ * stay within LINELEN. Unknown lengths are assumed to be as long as they
+ * can get, an ident-less user starts with '~'.
+ */
+static size_t espirc_split_budget(irc_handle_t client, size_t overhead)
+{
+    const espirc_self_t *self = &client->self;
+    size_t user_len, host_len, prefix, relayed, ours;
+
+    user_len = self->user_len ? self->user_len : strlen(client->config.user) + 1;
+    host_len = self->host_len ? self->host_len : IRC_HOST_GUESS;
+    prefix = 1 + self->nick_len + 1 + user_len + 1 + host_len + 1;
+
+    relayed = client->isupport.info.linelen - 2;
+    ours = client->sendq.line_max;
+
+    if (relayed < prefix + overhead || ours < overhead)
+        return 0;
+
+    return MIN(relayed - prefix - overhead, ours - overhead);
+}
+
+/*
+ * Length of the next piece of text, at most max bytes: up to the last space
+ * that fits, or for a word longer than that, up to the last whole UTF-8
+ * character.
+ */
+static size_t espirc_split_cut(const char *text, size_t len, size_t max)
+{
+    size_t cut;
+
+    if (len <= max)
+        return len;
+
+    for (cut = max; cut > 0 && text[cut] != ' '; cut--);
+    if (cut > 0)
+        return cut;
+
+    for (cut = max; cut > 0 && ((uint8_t) text[cut] & 0xc0) == 0x80; cut--);
+
+    return cut > 0 ? cut : max;
+}
+
+typedef struct {
+    const char *p;
+    const char *eol;
+    const char *end;
+    size_t budget;
+} espirc_split_t;
+
+/* The next piece of text, false once there's none left */
+static bool espirc_split_next(espirc_split_t *split, const char **piece, size_t *len)
+{
+    while (split->p < split->end) {
+        /* Line breaks can't be sent, each one ends a piece */
+        if (split->p >= split->eol) {
+            if (*split->p == '\r' || *split->p == '\n') {
+                split->p++;
+                continue;
+            }
+
+            for (split->eol = split->p;
+                split->eol < split->end && *split->eol != '\r' && *split->eol != '\n';
+                split->eol++);
+        }
+
+        *piece = split->p;
+        *len = espirc_split_cut(split->p, split->eol - split->p, split->budget);
+
+        /* The space the text was cut at goes with the cut */
+        for (split->p += *len; split->p < split->eol && *split->p == ' '; split->p++);
+
+        return true;
+    }
+
+    return false;
+}
+
+/* Write the next count pieces of text into the lines reserved for them */
+static void espirc_split_write(irc_handle_t client, espirc_split_t *split, char **lines,
+                                size_t count, const char *name, const char *target)
+{
+    size_t name_len = strlen(name), target_len = strlen(target);
+    size_t overhead = name_len + 1 + target_len + 2, cut;
+    const char *piece;
+    char *line;
+
+    for (size_t i = 0; i < count; i++) {
+        espirc_split_next(split, &piece, &cut);
+        line = lines[i];
+
+        memcpy(line, name, name_len);
+        line[name_len] = ' ';
+        memcpy(line + name_len + 1, target, target_len);
+        memcpy(line + name_len + 1 + target_len, " :", 2);
+        memcpy(line + overhead, piece, cut);
+
+        espirc_sendq_queue(&client->sendq, IRC_SENDQ_BULK, line, overhead + cut);
+    }
+}
+
+/*
+ * The pieces are written from text straight into the send queue. They're all
+ * reserved while the queue is held, so no other line ends up in between, and
+ * then written with the queue free for others again. Past IRC_SPLIT_BATCH
+ * pieces, those reserved so far are written before reserving more.
+ */
+esp_err_t irc_send_long(irc_handle_t client, irc_targmax_t command, const char* target,
+                        const char* text, size_t len)
+{
+    espirc_split_t split, fill;
+    const char *name, *piece;
+    size_t overhead, budget, cut, count = 0;
+    char *lines[IRC_SPLIT_BATCH];
+    esp_err_t err = ESP_OK;
+    bool queued = false;
+
+    if (!client || !target || !*target || strpbrk(target, " \r\n") || (len && !text))
+        return ESP_ERR_INVALID_ARG;
+
+    if (command != IRC_TARGMAX_PRIVMSG && command != IRC_TARGMAX_NOTICE)
+        return ESP_ERR_INVALID_ARG;
+
+    if (client->state < IRC_STATE_CONNECTING)
+        return ESP_ERR_INVALID_STATE;
+
+    name = espirc_isupport_command(command);
+
+    /* "<command> <target> :" */
+    overhead = strlen(name) + 1 + strlen(target) + 2;
+    budget = espirc_split_budget(client, overhead);
+    if (budget < IRC_SPLIT_MIN)
+        return ESP_ERR_INVALID_ARG;
+
+    split = fill = (espirc_split_t) { text, text, text + len, budget };
+
+    espirc_sendq_hold(&client->sendq);
+
+    while (espirc_split_next(&split, &piece, &cut)) {
+        if (count == IRC_SPLIT_BATCH) {
+            espirc_split_write(client, &fill, lines, count, name, target);
+            queued = true;
+            count = 0;
+        }
+
+        err = espirc_sendq_reserve(&client->sendq, IRC_SENDQ_BULK, overhead + cut, &lines[count]);
+        if (err != ESP_OK) {
+            ESP_LOGW(TAG, "Send queue is full, %zu of %zu bytes left out",
+                (size_t) (split.end - piece), len);
+            break;
+        }
+
+        count++;
+    }
+
+    espirc_sendq_release(&client->sendq);
+
+    espirc_split_write(client, &fill, lines, count, name, target);
+
+    if (queued || count)
+        irc_wake(client);
+
+    return err;
+}
@@ -0,0 +1,29 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * Copyright (c) 2024 Danct12
+ */
+
+#ifndef __ESPIRC_SPLIT_H__
+#define __ESPIRC_SPLIT_H__
+
+#include <stdint.h>
+
+#include "espirc.h"
+
+#define IRC_SELF_NICK_MAX 63
+
+/*
+ * Our own "nick!user@host" as the server sends it to others, which takes
+ * up part of every line relayed from us. user_len and host_len are 0 until
+ * the server told us.
+ */
+typedef struct {
+    char nick[IRC_SELF_NICK_MAX + 1];
+    uint8_t nick_len;
+    uint8_t user_len;
+    uint8_t host_len;
+} espirc_self_t;
+
+void espirc_split_reset(irc_handle_t client);
+void espirc_split_handle(irc_handle_t client, irc_message_t *message);
+#endif
@@ -0,0 +1,916 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * Copyright (c) 2024 Danct12
+ */
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "espirc.h"
+#include "espirc_isupport.h"
+#include "espirc_mem.h"
+#include "espirc_priv.h"
+#include "espirc_state.h"
+
+#include "esp_err.h"
+#include "esp_log.h"
+
+static const char* TAG = "espirc_state";
+
+#ifdef CONFIG_ESPIRC_STATE
+#define IRC_STATE_TABLE_MIN 8
+
+/* refs counts the channels a nick is in, plus one for a channel's own name */
+struct espirc_str {
+    uint32_t hash;
+    uint16_t refs;
+    uint8_t len;
+    char str[];
+};
+
+typedef struct {
+    uint32_t hash;
+    espirc_str_t *name;
+    bool synced;    /* The NAMES reply is over */
+    bool partial;   /* Members were left out for lack of memory */
+    espirc_table_t members;
+} espirc_channel_t;
+
+typedef bool (*espirc_match_t)(const void *entry, const void *key);
+
+/*
+ * Memory
+ */
+
+static void *espirc_state_alloc(espirc_state_t *state, size_t size)
+{
+    void *ptr;
+
+    if (state->mem_used + size > state->mem_max)
+        return NULL;
+
+    ptr = espirc_malloc(size);
+    if (ptr)
+        state->mem_used += size;
+
+    return ptr;
+}
+
+static void espirc_state_free(espirc_state_t *state, void *ptr, size_t size)
+{
+    if (!ptr)
+        return;
+
+    espirc_free(ptr);
+    state->mem_used -= size;
+}
+
+/*
+ * Tables
+ */
+
+static uint32_t espirc_entry_hash(const void *entry)
+{
+    return *(const uint32_t *) entry;
+}
+
+static size_t espirc_table_bytes(uint32_t size, bool modes)
+{
+    return size * (sizeof(void *) + (modes ? 1 : 0));
+}
+
+/* The slot holding the entry, or the empty slot it would go in. -1 if the table is empty */
+static int espirc_table_find(const espirc_table_t *table, uint32_t hash, espirc_match_t match,
+                            const void *key)
+{
+    uint32_t mask = table->size - 1, i;
+
+    if (!table->size)
+        return -1;
+
+    for (i = hash & mask; table->slots[i] && !match(table->slots[i], key); i = (i + 1) & mask);
+
+    return i;
+}
+
+/* Make room for one more entry, doubling the table when it gets 3/4 full */
+static bool espirc_table_reserve(espirc_state_t *state, espirc_table_t *table, bool modes)
+{
+    uint32_t size, mask, j;
+    uint8_t *new_modes;
+    void **slots;
+
+    if ((table->count + 1) * 4 <= table->size * 3)
+        return true;
+
+    size = table->size ? table->size * 2 : IRC_STATE_TABLE_MIN;
+    mask = size - 1;
+
+    slots = espirc_state_alloc(state, espirc_table_bytes(size, modes));
+    if (!slots)
+        return false;
+
+    memset(slots, 0, size * sizeof(void *));
+    new_modes = modes ? (uint8_t *) (slots + size) : NULL;
+
+    for (uint32_t i = 0; i < table->size; i++) {
+        if (!table->slots[i])
+            continue;
+
+        for (j = espirc_entry_hash(table->slots[i]) & mask; slots[j]; j = (j + 1) & mask);
+
+        slots[j] = table->slots[i];
+        if (modes)
+            new_modes[j] = table->modes[i];
+    }
+
+    espirc_state_free(state, table->slots, espirc_table_bytes(table->size, modes));
+    table->slots = slots;
+    table->modes = new_modes;
+    table->size = size;
+
+    return true;
+}
+
+static void espirc_table_insert(espirc_table_t *table, int i, void *entry, uint8_t modes)
+{
+    table->slots[i] = entry;
+    if (table->modes)
+        table->modes[i] = modes;
+    table->count++;
+}
+
+/*
+ * Remove without leaving a tombstone: later entries of the probe run move
+ * up into the hole, unless that would put them before their home slot.
+ */
+static void espirc_table_remove(espirc_table_t *table, uint32_t i)
+{
+    uint32_t mask = table->size - 1, j = i, home;
+
+    table->count--;
+
+    for (;;) {
+        table->slots[i] = NULL;
+
+        do {
+            j = (j + 1) & mask;
+            if (!table->slots[j])
+                return;
+
+            home = espirc_entry_hash(table->slots[j]) & mask;
+        } while (i <= j ? (i < home && home <= j) : (i < home || home <= j));
+
+        table->slots[i] = table->slots[j];
+        if (table->modes)
+            table->modes[i] = table->modes[j];
+        i = j;
+    }
+}
+
+static void espirc_table_free(espirc_state_t *state, espirc_table_t *table)
+{
+    espirc_state_free(state, table->slots, espirc_table_bytes(table->size, table->modes));
+    memset(table, 0, sizeof(*table));
+}
+
+/*
+ * Interned names
+ */
+
+/* FNV-1a of the casemapped name */
+static uint32_t espirc_name_hash(espirc_state_t *state, irc_view_t name)
+{
+    uint32_t hash = 2166136261u;
+
+    for (size_t i = 0; i < name.len; i++) {
+        hash ^= state->isupport->lower[(uint8_t) name.ptr[i]];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+/* A name to look up, with the casemapping to compare it with */
+typedef struct {
+    irc_view_t name;
+    const uint8_t *lower;
+} espirc_name_key_t;
+
+static bool espirc_match_name(const void *entry, const void *key)
+{
+    const espirc_str_t *str = entry;
+    const espirc_name_key_t *name = key;
+
+    if (str->len != name->name.len)
+        return false;
+
+    for (size_t i = 0; i < str->len; i++) {
+        if (name->lower[(uint8_t) str->str[i]] != name->lower[(uint8_t) name->name.ptr[i]])
+            return false;
+    }
+
+    return true;
+}
+
+static bool espirc_match_ptr(const void *entry, const void *key)
+{
+    return entry == key;
+}
+
+static bool espirc_match_channel(const void *entry, const void *key)
+{
+    return ((const espirc_channel_t *) entry)->name == key;
+}
+
+static irc_view_t espirc_view(const char *str)
+{
+    return (irc_view_t) { str, strlen(str) };
+}
+
+static espirc_str_t *espirc_str_find(espirc_state_t *state, irc_view_t name)
+{
+    espirc_name_key_t key = { name, state->isupport->lower };
+    int i = espirc_table_find(&state->strs, espirc_name_hash(state, name), espirc_match_name, &key);
+
+    return i < 0 ? NULL : state->strs.slots[i];
+}
+
+/* Take a reference to the interned copy of name, adding it if needed */
+static espirc_str_t *espirc_str_get(espirc_state_t *state, irc_view_t name)
+{
+    espirc_name_key_t key = { name, state->isupport->lower };
+    espirc_str_t *str;
+    uint32_t hash;
+
+    if (!name.len || name.len > UINT8_MAX)
+        return NULL;
+
+    str = espirc_str_find(state, name);
+    if (str) {
+        str->refs++;
+        return str;
+    }
+
+    if (!espirc_table_reserve(state, &state->strs, false))
+        return NULL;
+
+    str = espirc_state_alloc(state, sizeof(*str) + name.len + 1);
+    if (!str)
+        return NULL;
+
+    hash = espirc_name_hash(state, name);
+    str->hash = hash;
+    str->refs = 1;
+    str->len = name.len;
+    memcpy(str->str, name.ptr, name.len);
+    str->str[name.len] = '\0';
+
+    espirc_table_insert(&state->strs, espirc_table_find(&state->strs, hash, espirc_match_name,
+        &key), str, 0);
+
+    return str;
+}
+
+static void espirc_str_put(espirc_state_t *state, espirc_str_t *str)
+{
+    if (!str || --str->refs)
+        return;
+
+    espirc_table_remove(&state->strs, espirc_table_find(&state->strs, str->hash,
+        espirc_match_ptr, str));
+    espirc_state_free(state, str, sizeof(*str) + str->len + 1);
+}
+
+/*
+ * Channels and members
+ */
+
+static espirc_channel_t *espirc_channel_find(espirc_state_t *state, irc_view_t name)
+{
+    espirc_str_t *str = espirc_str_find(state, name);
+    int i;
+
+    if (!str)
+        return NULL;
+
+    i = espirc_table_find(&state->channels, str->hash, espirc_match_channel, str);
+
+    return i < 0 ? NULL : state->channels.slots[i];
+}
+
+static espirc_channel_t *espirc_channel_add(espirc_state_t *state, irc_view_t name)
+{
+    espirc_channel_t *channel = espirc_channel_find(state, name);
+
+    if (channel)
+        return channel;
+
+    if (!espirc_table_reserve(state, &state->channels, false))
+        return NULL;
+
+    channel = espirc_state_alloc(state, sizeof(*channel));
+    if (!channel)
+        return NULL;
+
+    memset(channel, 0, sizeof(*channel));
+
+    channel->name = espirc_str_get(state, name);
+    if (!channel->name) {
+        espirc_state_free(state, channel, sizeof(*channel));
+        return NULL;
+    }
+
+    channel->hash = channel->name->hash;
+    espirc_table_insert(&state->channels, espirc_table_find(&state->channels, channel->hash,
+        espirc_match_channel, channel->name), channel, 0);
+
+    return channel;
+}
+
+static void espirc_channel_remove(espirc_state_t *state, espirc_channel_t *channel)
+{
+    for (uint32_t i = 0; i < channel->members.size; i++)
+        espirc_str_put(state, channel->members.slots[i]);
+
+    espirc_table_free(state, &channel->members);
+
+    espirc_table_remove(&state->channels, espirc_table_find(&state->channels, channel->hash,
+        espirc_match_channel, channel->name));
+    espirc_str_put(state, channel->name);
+    espirc_state_free(state, channel, sizeof(*channel));
+}
+
+static int espirc_member_find(espirc_channel_t *channel, espirc_str_t *str)
+{
+    int i;
+
+    if (!str)
+        return -1;
+
+    i = espirc_table_find(&channel->members, str->hash, espirc_match_ptr, str);
+
+    return i >= 0 && channel->members.slots[i] ? i : -1;
+}
+
+/* Add the member, or set its modes if it's there already */
+static void espirc_member_add(espirc_state_t *state, espirc_channel_t *channel,
+                                espirc_str_t *str, uint8_t modes)
+{
+    int i = espirc_member_find(channel, str);
+
+    if (i >= 0) {
+        channel->members.modes[i] = modes;
+        return;
+    }
+
+    if (!str || !espirc_table_reserve(state, &channel->members, true)) {
+        if (!channel->partial)
+            ESP_LOGW(TAG, "Out of memory, %s is no longer tracked in full", channel->name->str);
+        channel->partial = true;
+        state->dropped++;
+        return;
+    }
+
+    str->refs++;
+    espirc_table_insert(&channel->members, espirc_table_find(&channel->members, str->hash,
+        espirc_match_ptr, str), str, modes);
+}
+
+static void espirc_member_add_name(espirc_state_t *state, espirc_channel_t *channel,
+                                    irc_view_t name, uint8_t modes)
+{
+    espirc_str_t *str = espirc_str_get(state, name);
+
+    espirc_member_add(state, channel, str, modes);
+    espirc_str_put(state, str);
+}
+
+static void espirc_member_remove(espirc_state_t *state, espirc_channel_t *channel,
+                                    espirc_str_t *str)
+{
+    int i = espirc_member_find(channel, str);
+
+    if (i < 0)
+        return;
+
+    espirc_table_remove(&channel->members, i);
+    espirc_str_put(state, str);
+}
+
+/*
+ * Messages
+ */
+
+static bool espirc_state_is_self(espirc_state_t *state, irc_view_t nick)
+{
+    return state->self && espirc_str_find(state, nick) == state->self;
+}
+
+static void espirc_state_join(espirc_state_t *state, irc_view_t nick, const char *name)
+{
+    espirc_channel_t *channel;
+
+    if (espirc_state_is_self(state, nick)) {
+        channel = espirc_channel_add(state, espirc_view(name));
+        if (!channel) {
+            ESP_LOGW(TAG, "Out of memory, not tracking %s", name);
+            state->dropped++;
+            return;
+        }
+    } else {
+        channel = espirc_channel_find(state, espirc_view(name));
+        if (!channel)
+            return;
+    }
+
+    espirc_member_add_name(state, channel, nick, 0);
+}
+
+/* Someone left a channel, which is forgotten when it's us */
+static void espirc_state_leave(espirc_state_t *state, irc_view_t nick, const char *name)
+{
+    espirc_channel_t *channel = espirc_channel_find(state, espirc_view(name));
+
+    if (!channel)
+        return;
+
+    if (espirc_state_is_self(state, nick))
+        espirc_channel_remove(state, channel);
+    else
+        espirc_member_remove(state, channel, espirc_str_find(state, nick));
+}
+
+static void espirc_state_quit(espirc_state_t *state, irc_view_t nick)
+{
+    espirc_str_t *str = espirc_str_find(state, nick);
+
+    if (!str)
+        return;
+
+    /* Keep the name around until it's out of every channel */
+    str->refs++;
+    for (uint32_t i = 0; i < state->channels.size; i++) {
+        if (state->channels.slots[i])
+            espirc_member_remove(state, state->channels.slots[i], str);
+    }
+    espirc_str_put(state, str);
+}
+
+static void espirc_state_nick(espirc_state_t *state, irc_view_t nick, const char *new_nick)
+{
+    espirc_str_t *from = espirc_str_find(state, nick), *to;
+    espirc_channel_t *channel;
+    uint8_t modes;
+    int i;
+
+    if (!from)
+        return;
+
+    to = espirc_str_get(state, espirc_view(new_nick));
+
+    /* Only the case changed, which is still the same name */
+    if (to == from) {
+        memcpy(from->str, new_nick, from->len);
+        espirc_str_put(state, to);
+        return;
+    }
+
+    from->refs++;
+
+    for (uint32_t n = 0; n < state->channels.size; n++) {
+        channel = state->channels.slots[n];
+        if (!channel || (i = espirc_member_find(channel, from)) < 0)
+            continue;
+
+        modes = channel->members.modes[i];
+        espirc_member_remove(state, channel, from);
+        espirc_member_add(state, channel, to, modes);
+    }
+
+    if (state->self == from) {
+        state->self = to;
+        if (to)
+            to->refs++;
+        espirc_str_put(state, from);
+    }
+
+    espirc_str_put(state, from);
+    espirc_str_put(state, to);
+}
+
+/*
+ * 005 comes after the welcome, so our nick was hashed with the default
+ * casemapping. Nothing else is tracked before we join a channel, a server
+ * that changes its casemapping later on isn't followed.
+ */
+static void espirc_state_rehash_self(espirc_state_t *state)
+{
+    char nick[UINT8_MAX + 1];
+    espirc_str_t *self = state->self;
+
+    if (!self || state->channels.count)
+        return;
+
+    memcpy(nick, self->str, self->len + 1);
+    espirc_str_put(state, self);
+    state->self = espirc_str_get(state, espirc_view(nick));
+}
+
+/* Only membership modes are tracked, the others are skipped along with their parameter */
+static void espirc_state_mode(espirc_state_t *state, irc_message_t *message)
+{
+    const espirc_isupport_t *isupport = state->isupport;
+    espirc_channel_t *channel;
+    const char *mode;
+    int arg = 2, i, rank;
+    bool set = true;
+
+    if (message->params_count < 2)
+        return;
+
+    channel = espirc_channel_find(state, espirc_view(message->params[0]));
+    if (!channel)
+        return;
+
+    for (mode = message->params[1]; *mode; mode++) {
+        if (*mode == '+' || *mode == '-') {
+            set = *mode == '+';
+            continue;
+        }
+
+        if (IRC_CHARSET_HAS(isupport->prefix_modes, *mode)) {
+            rank = espirc_isupport_prefix_rank(isupport->info.prefix_modes, *mode);
+            if (arg >= message->params_count)
+                break;
+
+            i = espirc_member_find(channel,
+                espirc_str_find(state, espirc_view(message->params[arg++])));
+            if (i < 0)
+                continue;
+
+            if (set)
+                channel->members.modes[i] |= 1 << rank;
+            else
+                channel->members.modes[i] &= ~(1 << rank);
+        } else if (IRC_CHARSET_HAS(isupport->modes_param, *mode) ||
+                (set && IRC_CHARSET_HAS(isupport->modes_param_set, *mode))) {
+            arg++;
+        }
+    }
+}
+
+/* "<client> <symbol> <channel> :[prefix]<nick>[!user@host] ..." */
+static void espirc_state_names(espirc_state_t *state, irc_message_t *message)
+{
+    const espirc_isupport_t *isupport = state->isupport;
+    espirc_channel_t *channel;
+    const char *p;
+    irc_view_t nick;
+    uint8_t modes;
+
+    if (message->params_count < 3)
+        return;
+
+    channel = espirc_channel_find(state,
+        espirc_view(message->params[message->params_count - 2]));
+    if (!channel)
+        return;
+
+    for (p = message->params[message->params_count - 1]; *p; ) {
+        for (modes = 0; IRC_CHARSET_HAS(isupport->prefixes, *p); p++)
+            modes |= 1 << espirc_isupport_prefix_rank(isupport->info.prefix_chars, *p);
+
+        nick.ptr = p;
+        while (*p && *p != ' ' && *p != '!')
+            p++;
+        nick.len = p - nick.ptr;
+
+        if (nick.len)
+            espirc_member_add_name(state, channel, nick, modes);
+
+        while (*p && *p != ' ')
+            p++;
+        while (*p == ' ')
+            p++;
+    }
+}
+
+/*
+ * Follow the message, before it's dispatched. Channels are tracked from our
+ * own JOIN on, until we leave them or disconnect.
+ */
+void espirc_state_handle(irc_handle_t client, irc_message_t *message)
+{
+    espirc_state_t *state = &client->tracker;
+    irc_view_t nick;
+
+    if (!state->lock)
+        return;
+
+    switch (message->verb_id) {
+        case IRC_RPL_WELCOME:
+        case IRC_RPL_ISUPPORT:
+        case IRC_RPL_NAMREPLY:
+        case IRC_RPL_ENDOFNAMES:
+        case IRC_VERB_JOIN:
+        case IRC_VERB_KICK:
+        case IRC_VERB_MODE:
+        case IRC_VERB_NICK:
+        case IRC_VERB_PART:
+        case IRC_VERB_QUIT:
+            break;
+        default:
+            return;
+    }
+
+    nick = irc_source_nick(message);
+
+    xSemaphoreTake(state->lock, portMAX_DELAY);
+
+    switch (message->verb_id) {
+        case IRC_RPL_WELCOME:
+            /* The nick we ended up with, as the server spells it */
+            if (message->params_count) {
+                espirc_str_put(state, state->self);
+                state->self = espirc_str_get(state, espirc_view(message->params[0]));
+            }
+            break;
+        case IRC_RPL_ISUPPORT:
+            espirc_state_rehash_self(state);
+            break;
+        case IRC_RPL_NAMREPLY:
+            espirc_state_names(state, message);
+            break;
+        case IRC_RPL_ENDOFNAMES:
+            if (message->params_count >= 2) {
+                espirc_channel_t *channel = espirc_channel_find(state,
+                    espirc_view(message->params[1]));
+
+                if (channel)
+                    channel->synced = true;
+            }
+            break;
+        case IRC_VERB_JOIN:
+            if (nick.ptr && message->params_count)
+                espirc_state_join(state, nick, message->params[0]);
+            break;
+        case IRC_VERB_PART:
+            if (nick.ptr && message->params_count)
+                espirc_state_leave(state, nick, message->params[0]);
+            break;
+        case IRC_VERB_KICK:
+            if (message->params_count >= 2)
+                espirc_state_leave(state, espirc_view(message->params[1]), message->params[0]);
+            break;
+        case IRC_VERB_QUIT:
+            if (nick.ptr)
+                espirc_state_quit(state, nick);
+            break;
+        case IRC_VERB_NICK:
+            if (nick.ptr && message->params_count)
+                espirc_state_nick(state, nick, message->params[0]);
+            break;
+        case IRC_VERB_MODE:
+            espirc_state_mode(state, message);
+            break;
+        default:
+            break;
+    }
+
+    IRC_STAT_SET(client, state_used, state->mem_used);
+    IRC_STAT_SET(client, state_dropped, state->dropped);
+
+    xSemaphoreGive(state->lock);
+}
+
+/* Forget everything, the next connection starts from scratch */
+void espirc_state_reset(irc_handle_t client)
+{
+    espirc_state_t *state = &client->tracker;
+
+    if (!state->lock)
+        return;
+
+    xSemaphoreTake(state->lock, portMAX_DELAY);
+
+    for (uint32_t i = 0; i < state->channels.size; ) {
+        /* Removing shifts the following channels up into this slot */
+        if (state->channels.slots[i])
+            espirc_channel_remove(state, state->channels.slots[i]);
+        else
+            i++;
+    }
+
+    espirc_str_put(state, state->self);
+    state->self = NULL;
+
+    IRC_STAT_SET(client, state_used, state->mem_used);
+
+    xSemaphoreGive(state->lock);
+}
+
+esp_err_t espirc_state_init(irc_handle_t client)
+{
+    espirc_state_t *state = &client->tracker;
+
+    if (!client->config.state_track)
+        return ESP_OK;
+
+    state->mem_max = client->config.state_mem_max;
+    state->isupport = &client->isupport;
+    state->lock = xSemaphoreCreateMutex();
+
+    return state->lock ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+void espirc_state_deinit(irc_handle_t client)
+{
+    espirc_state_t *state = &client->tracker;
+
+    if (!state->lock)
+        return;
+
+    espirc_state_reset(client);
+    espirc_table_free(state, &state->strs);
+    espirc_table_free(state, &state->channels);
+
+    vSemaphoreDelete(state->lock);
+    state->lock = NULL;
+}
+
+/*
+ * API
+ */
+
+static void espirc_state_modes(espirc_state_t *state, uint8_t modes, char *buf, size_t size)
+{
+    const char *prefix_modes = state->isupport->info.prefix_modes;
+    size_t n = 0;
+
+    for (int i = 0; prefix_modes[i] && n + 1 < size; i++) {
+        if (modes & (1 << i))
+            buf[n++] = prefix_modes[i];
+    }
+
+    buf[n] = '\0';
+}
+
+/* Lock the state and look up the channel, unlocked again on error */
+static esp_err_t espirc_state_lock_channel(irc_handle_t client, const char *name,
+                                            espirc_channel_t **channel)
+{
+    espirc_state_t *state;
+
+    if (!client || !name)
+        return ESP_ERR_INVALID_ARG;
+
+    state = &client->tracker;
+    if (!state->lock)
+        return ESP_ERR_INVALID_STATE;
+
+    xSemaphoreTake(state->lock, portMAX_DELAY);
+
+    *channel = espirc_channel_find(state, espirc_view(name));
+    if (!*channel) {
+        xSemaphoreGive(state->lock);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t irc_state_channel(irc_handle_t client, const char *channel, irc_channel_info_t *info)
+{
+    espirc_channel_t *entry;
+    esp_err_t err;
+
+    if (!info)
+        return ESP_ERR_INVALID_ARG;
+
+    err = espirc_state_lock_channel(client, channel, &entry);
+    if (err != ESP_OK)
+        return err;
+
+    info->members = entry->members.count;
+    info->synced = entry->synced && !entry->partial;
+
+    xSemaphoreGive(client->tracker.lock);
+
+    return ESP_OK;
+}
+
+esp_err_t irc_state_member(irc_handle_t client, const char *channel, const char *nick,
+                            char *modes, size_t size)
+{
+    espirc_channel_t *entry;
+    esp_err_t err;
+    int i;
+
+    if (!nick || (modes && !size))
+        return ESP_ERR_INVALID_ARG;
+
+    err = espirc_state_lock_channel(client, channel, &entry);
+    if (err != ESP_OK)
+        return err;
+
+    i = espirc_member_find(entry, espirc_str_find(&client->tracker, espirc_view(nick)));
+    if (i < 0)
+        err = ESP_ERR_NOT_FOUND;
+    else if (modes)
+        espirc_state_modes(&client->tracker, entry->members.modes[i], modes, size);
+
+    xSemaphoreGive(client->tracker.lock);
+
+    return err;
+}
+
+esp_err_t irc_state_members(irc_handle_t client, const char *channel, irc_state_walk_t walk,
+                            void *arg)
+{
+    espirc_channel_t *entry;
+    espirc_str_t *str;
+    char modes[IRC_ISUPPORT_PREFIX_MAX + 1];
+    esp_err_t err;
+
+    if (!walk)
+        return ESP_ERR_INVALID_ARG;
+
+    err = espirc_state_lock_channel(client, channel, &entry);
+    if (err != ESP_OK)
+        return err;
+
+    for (uint32_t i = 0; i < entry->members.size; i++) {
+        str = entry->members.slots[i];
+        if (!str)
+            continue;
+
+        espirc_state_modes(&client->tracker, entry->members.modes[i], modes, sizeof(modes));
+        if (!walk(str->str, modes, arg))
+            break;
+    }
+
+    xSemaphoreGive(client->tracker.lock);
+
+    return ESP_OK;
+}
+
+esp_err_t irc_state_channels(irc_handle_t client, irc_state_walk_t walk, void *arg)
+{
+    espirc_state_t *state;
+    espirc_channel_t *channel;
+    char modes[IRC_ISUPPORT_PREFIX_MAX + 1];
+    int i;
+
+    if (!client || !walk)
+        return ESP_ERR_INVALID_ARG;
+
+    state = &client->tracker;
+    if (!state->lock)
+        return ESP_ERR_INVALID_STATE;
+
+    xSemaphoreTake(state->lock, portMAX_DELAY);
+
+    for (uint32_t n = 0; n < state->channels.size; n++) {
+        channel = state->channels.slots[n];
+        if (!channel)
+            continue;
+
+        /* Our own modes in the channel */
+        i = espirc_member_find(channel, state->self);
+        espirc_state_modes(state, i < 0 ? 0 : channel->members.modes[i], modes, sizeof(modes));
+
+        if (!walk(channel->name->str, modes, arg))
+            break;
+    }
+
+    xSemaphoreGive(state->lock);
+
+    return ESP_OK;
+}
+#else
+esp_err_t irc_state_channel(irc_handle_t client, const char *channel, irc_channel_info_t *info)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t irc_state_member(irc_handle_t client, const char *channel, const char *nick,
+                            char *modes, size_t size)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t irc_state_members(irc_handle_t client, const char *channel, irc_state_walk_t walk,
+                            void *arg)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t irc_state_channels(irc_handle_t client, irc_state_walk_t walk, void *arg)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+#endif
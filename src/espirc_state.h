@@ -0,0 +1,60 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * Copyright (c) 2024 Danct12
+ */
+
+#ifndef __ESPIRC_STATE_H__
+#define __ESPIRC_STATE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "sdkconfig.h"
+
+#include "espirc.h"
+#include "espirc_isupport.h"
+
+#ifdef CONFIG_ESPIRC_STATE
+typedef struct espirc_str espirc_str_t;
+
+/*
+ * Open addressing with linear probing. Every entry starts with the hash of
+ * its name, the table is a power of two in size and at most 3/4 full.
+ * modes runs alongside slots in member tables.
+ */
+typedef struct {
+    void **slots;
+    uint8_t *modes;
+    uint32_t count;
+    uint32_t size;
+} espirc_table_t;
+
+typedef struct {
+    SemaphoreHandle_t lock;
+    size_t mem_used;
+    size_t mem_max;
+    uint32_t dropped;
+
+    /* Interned names, one copy shared by every channel a nick is in */
+    espirc_table_t strs;
+    espirc_table_t channels;
+    espirc_str_t *self;
+
+    /* Casemapping and membership modes of the connection */
+    const espirc_isupport_t *isupport;
+} espirc_state_t;
+
+esp_err_t espirc_state_init(irc_handle_t client);
+void espirc_state_deinit(irc_handle_t client);
+void espirc_state_reset(irc_handle_t client);
+void espirc_state_handle(irc_handle_t client, irc_message_t *message);
+#else
+static inline esp_err_t espirc_state_init(irc_handle_t client) { return ESP_OK; }
+static inline void espirc_state_deinit(irc_handle_t client) {}
+static inline void espirc_state_reset(irc_handle_t client) {}
+static inline void espirc_state_handle(irc_handle_t client, irc_message_t *message) {}
+#endif
+#endif
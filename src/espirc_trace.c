@@ -0,0 +1,113 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * Copyright (c) 2024 Danct12
+ */
+
+#include <inttypes.h>
+#include <string.h>
+
+#include "sdkconfig.h"
+
+#include "espirc.h"
+#include "espirc_priv.h"
+#include "espirc_trace.h"
+
+#include "esp_err.h"
+#include "esp_log.h"
+
+#ifdef CONFIG_ESPIRC_TRACE
+#ifdef ESP_PLATFORM
+#include "esp_cpu.h"
+#define IRC_TRACE_UNIT "cycles"
+#else
+#include <time.h>
+#define IRC_TRACE_UNIT "ns"
+#endif
+
+static const char* TAG = "espirc_trace";
+
+static const char *stage_names[IRC_TRACE_STAGES] = {
+    [IRC_TRACE_RECV] = "recv",
+    [IRC_TRACE_FRAME] = "frame",
+    [IRC_TRACE_PARSE] = "parse",
+    [IRC_TRACE_DISPATCH] = "dispatch",
+    [IRC_TRACE_HANDLER] = "handler",
+};
+
+uint32_t espirc_trace_now(void)
+{
+#ifdef ESP_PLATFORM
+    return esp_cpu_get_cycle_count();
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t) (ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+#endif
+}
+
+/* Handlers may run on the dispatch task, hence the atomic increment */
+void espirc_trace_record(irc_handle_t client, irc_trace_stage_t stage, uint32_t duration)
+{
+    int bucket = duration ? 32 - __builtin_clz(duration) : 0;
+
+    if (bucket >= IRC_TRACE_BUCKETS)
+        bucket = IRC_TRACE_BUCKETS - 1;
+
+    __atomic_fetch_add(&client->trace[stage][bucket], 1, __ATOMIC_RELAXED);
+}
+#endif
+
+/* Log the histogram of every stage that has samples */
+esp_err_t irc_trace_dump(irc_handle_t client)
+{
+#ifdef CONFIG_ESPIRC_TRACE
+    uint32_t count, total;
+
+    if (!client)
+        return ESP_ERR_INVALID_ARG;
+
+    for (int stage = 0; stage < IRC_TRACE_STAGES; stage++) {
+        total = 0;
+        for (int i = 0; i < IRC_TRACE_BUCKETS; i++)
+            total += client->trace[stage][i];
+
+        if (!total)
+            continue;
+
+        ESP_LOGI(TAG, "%s: %" PRIu32 " samples", stage_names[stage], total);
+
+        for (int i = 0; i < IRC_TRACE_BUCKETS; i++) {
+            count = __atomic_load_n(&client->trace[stage][i], __ATOMIC_RELAXED);
+            if (!count)
+                continue;
+
+            /* The last bucket takes everything longer too */
+            if (i == IRC_TRACE_BUCKETS - 1)
+                ESP_LOGI(TAG, " >= %10" PRIu32 " %s: %" PRIu32,
+                    (uint32_t) 1 << (i - 1), IRC_TRACE_UNIT, count);
+            else
+                ESP_LOGI(TAG, "  < %10" PRIu32 " %s: %" PRIu32,
+                    (uint32_t) 1 << i, IRC_TRACE_UNIT, count);
+        }
+    }
+
+    return ESP_OK;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+esp_err_t irc_trace_reset(irc_handle_t client)
+{
+#ifdef CONFIG_ESPIRC_TRACE
+    if (!client)
+        return ESP_ERR_INVALID_ARG;
+
+    memset(client->trace, 0, sizeof(client->trace));
+
+    return ESP_OK;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
@@ -0,0 +1,48 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * Copyright (c) 2024 Danct12
+ */
+
+#ifndef __ESPIRC_TRACE_H__
+#define __ESPIRC_TRACE_H__
+
+#include <stdint.h>
+
+#include "sdkconfig.h"
+
+#include "espirc.h"
+
+typedef enum {
+    IRC_TRACE_RECV,
+    IRC_TRACE_FRAME,
+    IRC_TRACE_PARSE,
+    IRC_TRACE_DISPATCH,
+    IRC_TRACE_HANDLER,
+    IRC_TRACE_STAGES
+} irc_trace_stage_t;
+
+/*
+ * Log2 buckets: bucket n counts durations in [2^(n-1), 2^n), the last one
+ * everything from 2^(n-1) up
+ */
+#define IRC_TRACE_BUCKETS 32
+
+/*
+ * Tracepoints
+ *
+ * IRC_TRACE_BEGIN() takes a timestamp, IRC_TRACE_END() adds the time since
+ * then to the histogram of a stage. Both compile to nothing unless
+ * CONFIG_ESPIRC_TRACE is enabled.
+ */
+#ifdef CONFIG_ESPIRC_TRACE
+#define IRC_TRACE_BEGIN(name) uint32_t name = espirc_trace_now()
+#define IRC_TRACE_END(client, stage, start) \
+    espirc_trace_record(client, stage, espirc_trace_now() - (start))
+
+uint32_t espirc_trace_now(void);
+void espirc_trace_record(irc_handle_t client, irc_trace_stage_t stage, uint32_t duration);
+#else
+#define IRC_TRACE_BEGIN(name)
+#define IRC_TRACE_END(client, stage, start)
+#endif
+#endif
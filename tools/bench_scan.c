@@ -0,0 +1,143 @@
+// SPDX-License-Identifier: GPL-3.0-only
+/*
+ * Copyright (c) 2024 Danct12
+ */
+
+/*
+ * Host benchmark of the byte scanner used for framing and tokenizing.
+ *
+ * Build and run from the repository root:
+ *   cc -O2 -Isrc -o bench_scan tools/bench_scan.c && ./bench_scan
+ *
+ * It is also built as part of the host build, see host/CMakeLists.txt.
+ *
+ * A buffer of typical server traffic is split into lines and every line
+ * into space separated tokens, once with a byte at a time loop (what the
+ * parser used to do), once with memchr() and once with espirc_scan_char().
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_CYCLES 1
+#endif
+
+#include "espirc_scan.h"
+
+#define BUF_SIZE (1 << 20)
+#define ROUNDS 200
+
+static const char *samples[] = {
+    ":nick!~user@host.example.com PRIVMSG #channel :hello there, how is everyone doing today?\r\n",
+    "PING :irc.example.net\r\n",
+    ":irc.example.net 353 me = #channel :@op +voice nick1 nick2 nick3 nick4 nick5 nick6 nick7\r\n",
+    "@time=2024-01-01T00:00:00.000Z;msgid=abcdef :nick!user@host JOIN #channel * :Real Name\r\n",
+    ":nick!user@host NOTICE me :short\r\n",
+};
+
+typedef const char *(*scan_fn)(const char *p, const char *end, char c);
+
+static const char *scan_bytes(const char *p, const char *end, char c)
+{
+    for (; p < end; p++) {
+        if (*p == c)
+            return p;
+    }
+
+    return NULL;
+}
+
+static const char *scan_memchr(const char *p, const char *end, char c)
+{
+    return memchr(p, c, end - p);
+}
+
+static const char *scan_swar(const char *p, const char *end, char c)
+{
+    return espirc_scan_char(p, end, c);
+}
+
+/* Frame the buffer into lines and count the tokens of every line */
+static size_t run(scan_fn scan, const char *buf, size_t len)
+{
+    const char *p = buf, *end = buf + len, *eol, *tok;
+    size_t tokens = 0;
+
+    while ((eol = scan(p, end, '\n'))) {
+        for (tok = p; tok < eol; tok++) {
+            tok = scan(tok, eol, ' ');
+            if (!tok)
+                break;
+            tokens++;
+        }
+
+        p = eol + 1;
+    }
+
+    return tokens;
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void bench(const char *name, scan_fn scan, const char *buf, size_t len)
+{
+    volatile size_t sink = 0;
+    double start, ns;
+#ifdef HAVE_CYCLES
+    unsigned long long cycles = __rdtsc();
+#endif
+
+    start = now_ns();
+    for (int i = 0; i < ROUNDS; i++)
+        sink += run(scan, buf, len);
+    ns = now_ns() - start;
+
+#ifdef HAVE_CYCLES
+    cycles = __rdtsc() - cycles;
+    printf("%-8s %8.1f MB/s %6.2f bytes/cycle\n", name,
+        (double) len * ROUNDS / ns * 1e3, (double) len * ROUNDS / cycles);
+#else
+    printf("%-8s %8.1f MB/s\n", name, (double) len * ROUNDS / ns * 1e3);
+#endif
+    (void) sink;
+}
+
+int main(void)
+{
+    char *buf = malloc(BUF_SIZE);
+    size_t len = 0, n;
+
+    if (!buf)
+        return 1;
+
+    for (int i = 0; ; i++) {
+        n = strlen(samples[i % 5]);
+        if (len + n > BUF_SIZE)
+            break;
+        memcpy(buf + len, samples[i % 5], n);
+        len += n;
+    }
+
+    if (run(scan_bytes, buf, len) != run(scan_swar, buf, len)) {
+        fprintf(stderr, "Scanner mismatch\n");
+        return 1;
+    }
+
+    bench("bytes", scan_bytes, buf, len);
+    bench("memchr", scan_memchr, buf, len);
+    bench("swar", scan_swar, buf, len);
+
+    free(buf);
+    return 0;
+}